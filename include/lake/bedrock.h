@@ -108,17 +108,40 @@ typedef struct lake_framework {
          *  If set at a non-zero value, this will serve as the limit - the lowest valid page size will be picked.
          *  Whenever the huge page size could not be resolved, normal page size is set (usually 4096KB). */
         u32         huge_page_size;
-        /** Number of empty tagged heaps to prepare. This value only references to user defined tags. */
+        /** Number of empty tagged heaps to prepare, how many user defined tags can be in use at once. 
+         *  Tags are looked up in a hash table, raising it doesn't slow down allocations. If 0, default will be 32. */
         u32         tagged_heap_count;
+        /** How many free blocks of the tagged heaps keep their physical memory, to be reused without page faults.
+         *  Blocks freed by `lake_thfree()` beyond this are decommitted, wherever they are. As many blocks at the start 
+         *  of the heap take hugetlbfs pages, if the host has them. If 0, default will be 64 (128 MiB). */
+        u32         tagged_heap_resident_blocks;
         /** Number of threads to create. If 0, default will be the system's CPU count. 
-         *  Worker threads have CPU affinity, thus we don't allow to create more threads than CPUs available. */
+         *  Worker threads have CPU affinity, thus we don't allow to create more threads than CPUs available.
+         *  Workers are placed on physical cores of one NUMA node first, SMT siblings are used last. */
         u32         worker_thread_count;
         /** Every fiber will have a stack of this size. If 0, default will be 64KB. */
         u32         fiber_stack_size;
         /** Number of fibers to create. If 0, default will be 96 + 4 * worker_thread_count. */
         u32         fiber_count;
-        /** The job queue will be of this size: (1u << log2_job_count). If 0, default will be 10 (1024). */
+        /** Stack size for the `lake_fiber_stack_large` class. If 0, default will be 512KB. */
+        u32         large_fiber_stack_size;
+        /** Number of fibers with a large stack. If 0, default will be worker_thread_count. */
+        u32         large_fiber_count;
+        /** Stack size for the `lake_fiber_stack_huge` class. If 0, default will be 4MB. */
+        u32         huge_fiber_stack_size;
+        /** Number of fibers with a huge stack. If 0, default will be 2. */
+        u32         huge_fiber_count;
+        /** Every worker thread owns a job deque per priority lane of this size: (1u << log2_work_count). If 0, default will be 11 (2048). */
         u32         log2_work_count;
+        /** Work submitted from threads outside of the job system waits in a shared ring of this size: (1u << log2_foreign_work_count). If 0, default will be 10 (1024). */
+        u32         log2_foreign_work_count;
+        /** Objects released with `lake_dec_refcnt_deferred()` wait for destruction in a shared ring of this size: (1u << log2_zero_refcnt_count). If 0, default will be 12 (4096). */
+        u32         log2_zero_refcnt_count;
+        /** Number of timers for delayed or periodic work that can be scheduled at once. If 0, default will be 256. */
+        u32         timer_count;
+        /** If not 0, all work runs on the main thread in a reproducible order, picked by a generator seeded with this value.
+         *  The other worker threads are still created, but stay parked. See `lake_work_schedule_replay()`. */
+        u32         deterministic_seed;
         /** How many frames can the CPU get ahead of the GPU. Usually 2-4. */
         u32         frames_in_flight;
         /** Explicit debug tools will be enabled, may be limited on release/NDEBUG builds.
@@ -151,6 +174,37 @@ LAKE_FORCE_INLINE s32 lake_dec_refcnt(lake_refcnt *refcnt, void *self, PFN_lake_
     return __prev;
 }
 
+/** Queues the zero refcnt callback to run later, together with other released objects, see 
+ *  `lake_zero_refcnt_flush()`. A job destroying a batch of objects is submitted every time
+ *  enough of them were queued, the rest waits for the flush. If the queue is full, or outside
+ *  of the framework, the callback runs inline. Safe to call from foreign threads. */
+LAKEAPI LAKE_NONNULL_ALL LAKE_HOT_FN
+void LAKECALL lake_defer_zero_refcnt(void *self, PFN_lake_work zero_refcnt);
+
+/** Decrement a reference count, the zero refcnt callback is deferred into a batch.
+ *  @return previous refcnt. */
+LAKE_FORCE_INLINE s32 lake_dec_refcnt_deferred(lake_refcnt *refcnt, void *self, PFN_lake_work zero_refcnt) 
+{
+    s32 __prev = lake_atomic_sub_explicit(refcnt, 1, lake_memory_model_release);
+    if (__prev <= 1) {
+        /* see every write made by threads that released their references before us */
+        lake_atomic_thread_fence(lake_memory_model_acquire);
+        lake_defer_zero_refcnt(self, zero_refcnt);
+    }
+    return __prev;
+}
+
+/** Submits jobs to destroy the objects queued by `lake_defer_zero_refcnt()`, many objects 
+ *  per job. Usually called once per frame, so a scene teardown doesn't flood the job system
+ *  with a job for every object. Returns immediately with the number of objects that were queued.
+ *  If none were, but some are still being destroyed, it returns their number instead and the 
+ *  submitted job waits for them. If `out_chain` is not nullptr, it's set to a chain of the 
+ *  submitted jobs, or nullptr if there was nothing to destroy. Objects released by the destructors 
+ *  themselves are queued again, they're destroyed by the next flush. Must be called from a worker 
+ *  thread, but not from a destructor it would wait for. */
+LAKEAPI LAKE_HOT_FN
+u32 LAKECALL lake_zero_refcnt_flush(lake_work_chain *out_chain);
+
 /** Quickly wrap a handle in the header view union. */ \
 #define lake_impl_v(T, v) \
     (T){ .impl = v }
@@ -182,7 +236,7 @@ typedef struct lake_interface_header {
     { return lake_inc_refcnt(&self.header->refcnt); }   \
                                                         \
     LAKE_FORCE_INLINE s32 I##_interface_unref(I##_interface self) { \
-        return lake_dec_refcnt(                         \
+        return lake_dec_refcnt_deferred(                \
                 &self.header->refcnt,                   \
                 self.v,                                 \
                 self.header->zero_refcnt);              \
@@ -205,7 +259,7 @@ typedef struct lake_interface_header {
  *  - a `header` structure to access the known internal layout of an opaque handle,
  *  - a `v` union to view into the header and handle.
  *  - inline functions to increment and decrement the reference count. 
- *  - inline function to submit the zero_refcnt call into work for the job system.
+ *  - the decrement defers the zero_refcnt call, it's destroyed in a batch by the job system.
  *  - inline function to get a pointer to the saved assembly structure. */
 #define LAKE_IMPL_HANDLE_INTERFACED(T, parent, ...)                             \
     /** Header for `struct T##_impl`. */                                        \
@@ -225,7 +279,7 @@ typedef struct lake_interface_header {
     { return T##_ref(lake_impl_v(T, self)); }                                   \
                                                                                 \
     LAKE_FORCE_INLINE s32 T##_unref(T self) {                                   \
-        return lake_dec_refcnt(                                                 \
+        return lake_dec_refcnt_deferred(                                        \
                 &self.header->refcnt,                                           \
                 self.v,                                                         \
                 self.header->zero_refcnt);                                      \
@@ -251,16 +305,20 @@ PFN_LAKE_WORK(PFN_lake_framework, lake_framework const *framework);
  *  will be provided. After init is done, a fiber calls into the `main` procedure, passing 
  *  in the self-defined userdata and immutable framework configuration.
  *
- *  A fiber-aware job queue with a capacity of (1 << log2_work_count is created. The queue 
- *  has NO concept of priority, so there is no job stealing either. `worker_thread_count` 
- *  system threads are created, each one locked to a CPU core. Every fiber of `fiber_count`
- *  has it's own stack region of `fiber_stack_size`. Virtual memory is mapped for internal 
- *  use (TODO and later for custom memory allocators) with a hard limit of `memory_budget`.
+ *  Every worker thread gets a fiber-aware job deque with a capacity of (1 << log2_work_count)
+ *  for every priority lane of `lake_work_priority`. Idle workers steal jobs from other worker's 
+ *  deques, visiting the lanes in order of priority. `worker_thread_count` system threads are 
+ *  created, each one locked to a CPU core. Every fiber of `fiber_count` has it's own stack 
+ *  region of `fiber_stack_size`, additional fibers are created for the large and huge stack 
+ *  size classes. Every stack is preceded by a guard page. Virtual 
+ *  memory is mapped for internal use (TODO and later for custom memory allocators) with 
+ *  a hard limit of `memory_budget`.
  *  The memory budget is aligned to a hugetlb page entry, and if no limit is provided the 
  *  virtual map is set to the amount of RAM in the host system. The `huge_page_size` works 
  *  as a ceiling, and the largest possible value under that will be used for the mapping
  *  (usually 2MB), and if huge pages are not available or the given hint is not valid, this 
- *  will default to the standard page size (usually 4096 bytes).
+ *  will default to the standard page size (usually 4096 bytes). The pages backing parts of 
+ *  the mapping are picked from what the host allows, see `lake_thpages()`.
  *
  *  The framework and internal systems described above are all valid, until the application 
  *  returns from the `main` procedure. */
@@ -200,7 +200,7 @@ template<class T> class _IncludeInsideExternCNotPortable;
 #if !defined(LAKE_FORCE_INLINE) && !defined(LAKE_FORCE_NOINLINE)
     #if defined(LAKE_CC_CLANG_VERSION) || defined(LAKE_CC_GNUC_VERSION)
         #define LAKE_FORCE_INLINE static __attribute__((always_inline)) inline
-        #define LAKE_FORCE_NOINLINE __attribute__(noinline)
+        #define LAKE_FORCE_NOINLINE __attribute__((noinline))
     #elif defined(LAKE_CC_MSVC_VERSION)
         #define LAKE_FORCE_INLINE __forceinline
         #define LAKE_FORCE_NOINLINE __declspec(noinline)
@@ -75,6 +75,19 @@ lake_mpmc_rotate(
     s32 const           pos_delta,
     lake_mpmc_result   *out_result);
 
+/** Either enqueue into or dequeue from the ring buffer, up to `count` consecutive cells at once.
+ *  The cells are claimed with a single compare-exchange, and only as many as are ready right 
+ *  now, so it may return less than `count`. Returns how many cells were claimed, 0 if none. */
+LAKE_NONNULL_ALL LAKE_HOT_FN
+LAKEAPI s32 LAKECALL
+lake_mpmc_rotate_n(
+    lake_mpmc_ring     *ring,
+    atomic_ssize       *in_or_out,
+    s32 const           stride,
+    s32 const           pos_delta,
+    s32 const           count,
+    lake_mpmc_result   *out_result);
+
 /** The producer. The data within cells is persistent, so submissions can be made from the stack.
  *  Everytime a enqueue happens to a cell, existing data is discarded (collisions won't happen). */
 #define lake_mpmc_enqueue_t(ring, T, submit) \
@@ -88,6 +101,21 @@ lake_mpmc_rotate(
         __success; \
     })
 
+/** The bulk producer. Enqueues up to `count` elements from the `submit` array, paying for a single 
+ *  claim on the shared position instead of one per element. Returns how many were enqueued, the
+ *  rest of the array must be submitted again. Every cell is published on its own, in order. */
+#define lake_mpmc_enqueue_n_t(ring, T, submit, count) \
+    ({ \
+        lake_mpmc_result __first; \
+        s32 __claimed = lake_mpmc_rotate_n(ring, &(ring)->enqueue_pos, lake_ssizeof(T), 0, count, &__first); \
+        for (s32 __i = 0; __i < __claimed; __i++) { \
+            T *__node = (T *)lake_elem((ring)->buffer, lake_ssizeof(T), (__first.pos + __i) & (ring)->buffer_mask); \
+            lake_memcpy(&__node->data, &(submit)[__i], sizeof((submit)[0])); \
+            lake_atomic_write_explicit(&__node->sequence, __first.pos + __i + 1, lake_memory_model_release); \
+        }; \
+        __claimed; \
+    })
+
 /** The consumer. It is enough to pass a pointer onto the output instead of copying the data. */
 #define lake_mpmc_dequeue_t(ring, T, submit) \
     ({ \
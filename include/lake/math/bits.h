@@ -104,6 +104,43 @@ s32 lake_ctz(u32 x)
 #endif
 }
 
+/** Count leading zeroes. */
+LAKE_FORCE_INLINE LAKE_PURE_FN
+s32 lake_clz(u32 x)
+{
+#if LAKE_HAS_BUILTIN(__builtin_clz)
+    return x ? __builtin_clz(x) : 32;
+#elif defined(LAKE_CC_MSVC_VERSION)
+    u32 index;
+    return _BitScanReverse(&index, x) ? 31 - index : 32;
+#else
+    if (x == 0) 
+        return 32;
+    u32 count = 0;
+    while ((x & 0x80000000u) == 0) {
+        count++;
+        x <<= 1;
+    }
+    return count;
+#endif
+}
+
+/** Count trailing zeroes of a 64-bit value. */
+LAKE_FORCE_INLINE LAKE_PURE_FN
+s32 lake_ctz_u64(u64 x)
+{
+#if LAKE_HAS_BUILTIN(__builtin_ctzll)
+    return x ? __builtin_ctzll(x) : 64;
+#elif defined(LAKE_CC_MSVC_VERSION)
+    u32 index;
+    return _BitScanForward64(&index, x) ? index : 64;
+#else
+    if ((u32)x) 
+        return lake_ctz((u32)x);
+    return (x >> 32) ? 32 + lake_ctz((u32)(x >> 32)) : 64;
+#endif
+}
+
 /** Computes the bit of the next power of 2. */
 LAKE_FORCE_INLINE LAKE_CONST_FN
 u32 lake_bits_next_pow2(u32 n) 
@@ -12,6 +12,13 @@
  *  desribes an unique lifetime frequency. There is no free(ptr) interface for these 
  *  allocations, instead all blocks under a tag must be freed together. Calling 
  *  `lake_thfree(tag)` is enough to release resources, so they can be reused later.
+ *
+ *  Small objects that must be freed one by one are allocated from size class slabs,
+ *  see `lake_thslab_alloc()`, they're still released together with the rest of the heap.
+ *
+ *  Every worker thread keeps a few free blocks for itself, and for small allocations it 
+ *  owns a block of every heap it recently allocated from. A common allocation is then 
+ *  a pointer bump, without taking the heap lock or touching the shared block bitmap.
  */
 #include <lake/types.h>
 
@@ -59,23 +66,110 @@ lake_thblock_range lake_thblock(lake_heap_tag tag, usize request)
     return (lake_thblock_range){ .memory = nullptr, .alloc = 0lu };
 }
 
-/** Forces release of resources used by a matching tagged heap. 
- *  Tag can now be reused with a new lifetime. */
+/** Objects up to this size are allocated from the slabs of a tagged heap. */
+#define LAKE_THSLAB_MAX_SIZE 2048lu
+
+/** Allocates a small object from a slab of the tagged heap, for objects that come and go 
+ *  individually within the lifetime of the tag. Objects of a similar size share a size class, 
+ *  the slabs of a class are carved from the blocks of the heap. An allocation takes a freed 
+ *  object of the class, or the next one from the slab, both in O(1). The objects are aligned
+ *  to 16 bytes. Objects larger than LAKE_THSLAB_MAX_SIZE are a linear allocation instead,
+ *  they're released only by `lake_thfree(tag)`. All objects are released with the heap. */
+LAKEAPI LAKE_HOT_FN LAKE_MALLOC
+void *LAKECALL lake_thslab_alloc(lake_heap_tag tag, usize size);
+
+/** Returns an object allocated from `lake_thslab_alloc()` to it's size class, to be reused.
+ *  The size must be the same as requested for the allocation. Must not be called after 
+ *  the heap was freed, the object is gone with it. */
+LAKEAPI LAKE_HOT_FN
+void LAKECALL lake_thslab_free(lake_heap_tag tag, void *memory, usize size);
+
+#define lake_thslab_alloc_t(tag, T) \
+    lake_reinterpret_cast(T *, lake_thslab_alloc(tag, sizeof(T)))
+#define lake_thslab_free_t(tag, T, memory) \
+    lake_thslab_free(tag, memory, sizeof(T))
+
+/** Forces release of resources used by a matching tagged heap, slabs included. 
+ *  Tag can now be reused with a new lifetime. Freed blocks beyond the resident limit
+ *  (`tagged_heap_resident_blocks` hint) give their physical memory back to the system. */
 LAKEAPI LAKE_HOT_FN
 void LAKECALL lake_thfree(lake_heap_tag tag);
 
+/** Statistics of a tagged heap, see `lake_thstats_snapshot()`. */
+typedef struct lake_thstats {
+    lake_heap_tag   tag;
+    /** Blocks owned by the heap right now. */
+    u32             blocks;
+    /** The most blocks the heap owned at once. It's kept when the heap is freed, 
+     *  as long as the tag is used again, e.g. a tag for every frame in flight. */
+    u32             blocks_high_water;
+    /** Bytes requested from `lake_thalloc()` since the heap was last freed. Compared with 
+     *  the committed bytes, it shows how much of the blocks is lost to alignment and the
+     *  unused tails of blocks. */
+    u64             bytes_requested;
+    /** The most bytes requested before the heap was freed, kept like `blocks_high_water`. */
+    u64             bytes_requested_high_water;
+    /** Bytes of the blocks owned by the heap. */
+    u64             bytes_committed;
+    /** Calls to `lake_thalloc()` since the heap was last freed. */
+    u64             allocations;
+    /** How many times the heap was found locked by another fiber, since it was last freed. */
+    u64             lock_contentions;
+} lake_thstats;
+
+/** Writes statistics of the roots heap (tag 0) and of every tagged heap in use, up to 
+ *  `capacity` entries into `out`. Returns the number of heaps, `out` may be nullptr to 
+ *  only count them. No locks are taken, so it's safe to call from a worker thread in the
+ *  middle of a frame, but the heaps may change while they're read. Small allocations made 
+ *  by worker threads from their own blocks are counted in batches, they may show up late. */
+LAKEAPI
+u32 LAKECALL lake_thstats_snapshot(u32 capacity, lake_thstats *out);
+
 typedef enum lake_thadvise_mode : u8 {
     /** Request the commitment of physical resources, limited by RAM available
      *  and by the budget limit set at framework initialization. */
     lake_thadvise_commit        = (1u << 0),
     /** Request the release of physical resources, freeing them to the system.
-     *  Only unused memory can be released, fragmented heap may prevent this. */
+     *  Only unused memory can be released. The commitment shrinks if its tail is free,
+     *  otherwise free blocks are decommitted from anywhere in the committed range. */
     lake_thadvise_release       = (1u << 1),
     /** If set, the request may be resolved incomplete without warnings.
      *  Otherwise the request will be ignored unless it can be fulfilled exact. */
     lake_thadvise_suboptimal    = (1u << 2),
 } lake_thadvise_mode;
 
+/** How physical memory backs a part of the framework's mapping. */
+typedef enum lake_page_policy : u8 {
+    /** Standard pages of the host, usually 4 KiB. */
+    lake_page_policy_standard = 0,
+    /** Transparent huge pages, the kernel backs aligned ranges with huge pages when it can. */
+    lake_page_policy_transparent,
+    /** Huge pages reserved up front from the host's hugetlbfs pool. */
+    lake_page_policy_hugetlb,
+} lake_page_policy;
+
+/** What the framework got from the host for its mapping, see `lake_thpages()`. */
+typedef struct lake_thpage_report {
+    /** Internal structures of the framework, carved at the start of the mapping. */
+    lake_page_policy    roots;
+    /** Stacks of the fibers, they're split by guard pages. */
+    lake_page_policy    fiber_stacks;
+    /** Blocks of the tagged heaps (LAKE_TAGGED_HEAP_BLOCK_SIZE). */
+    lake_page_policy    blocks;
+    /** How many blocks from the start of the heap are backed by hugetlbfs pages, the rest 
+     *  of them use transparent huge pages or standard pages. */
+    usize               hugetlb_blocks;
+    /** The huge page size in use, or the standard page size if the host has no huge pages. */
+    usize               huge_page_size;
+} lake_thpage_report;
+
+/** Reports how the framework's memory is backed. The policy is picked at initialization: 
+ *  the first blocks of the tagged heaps, up to `tagged_heap_resident_blocks`, use hugetlbfs 
+ *  pages while the host's pool has them. The rest use transparent huge pages if they're 
+ *  enabled, or standard pages. The roots use transparent huge pages if they can, the fiber 
+ *  stacks always use standard pages. */
+LAKEAPI lake_thpage_report LAKECALL lake_thpages(void);
+
 /** Advises on commitment of host memory resources. 
  *  The request size will be block aligned (256 KiB). */
 LAKEAPI usize LAKECALL lake_thadvise(usize request, lake_thadvise_mode mode);
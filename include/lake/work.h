@@ -30,18 +30,17 @@
  *      [Fibers, Oh My!]
  *      https://graphitemaster.github.io/fibers/
  *
- *  Because the fiber stacks are created as a large flat array, there is NO protection from 
- *  a stack overflow. It will just walk into the neighbouring fiber's stack and corrupt it.
+ *  The fiber stacks are created as a large flat array, but every stack is preceded by 
+ *  a guard page with no access rights. A stack overflow will fault immediately, instead 
+ *  of walking into the neighbouring fiber's stack and corrupting it. Stacks come in a few 
+ *  size classes (see `lake_fiber_stack`), so only the jobs that need it pay for a large stack.
  *
  *  Fundamental to the fiber code is thread local storage (TLS). It's used as a way for the 
- *  system to communicate between jobs. Instead of using an OS or compiler provided TLS,
- *  I'm rolling out my own using a hash lookup on the current thread id. That is because:
- *
- *  - '__thread' on GCC is a GCC specific extension.
- *  - '__declspec(thread)' on windows only supports statically linked libraries.
- *  - 'thread_local' in C++11 is.. C++. I do mostly C here.
- *  - 'TlsAlloc' is uh, just too much work. Lazy motherfucker..
- *  - '_Thread_local' in C11 is nice, but the compiler support for C11 threads is questionable.
+ *  system to communicate between jobs. The TLS is an array of structures indexed by the 
+ *  worker thread index, and only this index is kept in a C23 'thread_local' variable. 
+ *  A fiber may be resumed on a different thread after a yield, so the index is always 
+ *  read through a call that is never inlined - the compiler is free to cache the address 
+ *  of a thread local variable for the whole body of a function.
  *
  *  A job is defined with the following function signature: void function(void *). The typedef 
  *  `PFN_lake_work` can be used to cast compatible functions of different argument type into 
@@ -51,15 +50,53 @@
  *
  *  Some notes:
  *
- *  - A deadlock happens if the MPMC ring buffer is full and running from only one thread. 
- *    This will also happen when dequeuing from an empty buffer, when running a single thread.
- *    The reason being, that the waiting for enqueue/dequeue thread may never leave the loop,
- *    when there is no other thread to try to empty/fill it. This should not really be an issue 
- *    unless stress testing the job system on single core environments.
+ *  - Every worker thread owns a bounded work-stealing deque. Work is submitted into the deque 
+ *    of the worker thread that runs the submitting fiber, the owner pops work from the bottom 
+ *    of it's deque, and idle workers steal from the top of other worker's deques. 
+ *
+ *  - Work is grouped into priority lanes, see `lake_work_priority`. Within a single lane 
+ *    there is no ordering guarantee, and a lower priority job may still run before a higher 
+ *    priority one if it was popped or stolen first.
+ *
+ *  - A worker thread that can't find any work for a while will park on a futex, instead of 
+ *    burning the CPU core. Submitting work wakes up as many parked workers as there are jobs,
+ *    and a finished or released chain wakes up as many workers as there were fibers waiting.
+ *
+ *  - If the deque of a worker is full, the submitting fiber yields to the newest queued work,
+ *    which runs on a fiber of it's own stack class, until there is room for the rest. A burst 
+ *    of work larger than the deque makes progress even with no other thread to steal it.
+ *
+ *  - A submission is published to the deque with a single store per run of the same priority,
+ *    and workers are woken once per submission. Many small jobs can be collected into a batch 
+ *    on the stack with `lake_work_batch_add()`, and submitted together.
+ *
+ *  - The number of active workers can adapt to the load, see `lake_work_adaptive_workers()`.
+ *    Retired workers are not woken up for new work, so on a light load most cores can sleep.
+ *
+ *  - For reproducible runs, a deterministic mode runs all work on the main thread, in an order 
+ *    picked by a seeded generator or replayed from a recording, see `lake_work_schedule_replay()`.
+ *    Timers and work from foreign threads still depend on when they arrive.
+ *
+ *  - Objects released with `lake_dec_refcnt_deferred()` are queued, and destroyed by jobs that 
+ *    take many of them at once, see `lake_zero_refcnt_flush()`. Tearing down a scene submits
+ *    a job per batch of objects, instead of running every destructor on the releasing fiber.
  *
- *  - The free and wait list implementations are pretty naive. There should be a better lockless 
- *    way of accessing them as opposed to looping over them. I suspect there is a lot of cache 
- *    churn and false sharing around index 0 between lots of threads.
+ *  - Threads outside of the job system submit work through a shared ring, see
+ *    `lake_submit_foreign_work()`. Workers move it into their deques between jobs.
+ *
+ *  - Free fibers are kept in a lock-free stack. Every chain has it's own list of waiting fibers,
+ *    when the chain reaches zero the list is closed, and exactly the fibers waiting on it are 
+ *    moved into a ring of ready fibers, that idle workers check before looking for new work.
+ *
+ *  - The time spent by jobs can be accounted by their name, to see which jobs take up the 
+ *    frame budget without attaching a profiler. See `lake_work_accounting()`.
+ *
+ *  - Delayed and periodic work waits on a hierarchical timer wheel, workers advance it between
+ *    dequeues and submit the due work. One of the parked workers sleeps only until the next 
+ *    timer is due, so nothing has to sleep inside a fiber or poll every frame.
+ *
+ *  - The fiber mutex, semaphore and condition variable park the fiber on a wait list in the 
+ *    same way, so a contended lock doesn't keep the worker thread from running other work.
  *
  *  - May get into improving context switching branch prediction, if this can improve speed: 
  *    http://www.crystalclearsoftware.com/soc/coroutine/coroutine/linuxasm.html
@@ -79,11 +116,41 @@ typedef void (LAKECALL *PFN_lake_work)(void *userdata);
 /** Declares a job, can be cast into `PFN_lake_work`. */
 #define FN_LAKE_WORK(fn, arg) void LAKECALL fn(arg)
 
+/** Priority lanes for submitted work. Every worker thread owns a separate deque for each 
+ *  lane, and an idle worker looks for work in the order: critical, normal, background, 
+ *  streaming. To avoid starvation, every few acquisitions the scan begins from a lower 
+ *  priority lane instead, so low priority work is still guaranteed to make progress. */
+typedef enum lake_work_priority : u32 {
+    /** The default, zero-initialized details will run in this lane. */
+    lake_work_priority_normal = 0,
+    /** Latency-sensitive work on the critical path of a frame. */
+    lake_work_priority_critical,
+    /** Work that may take several frames to complete, e.g. asset processing. */
+    lake_work_priority_background,
+    /** Long running I/O bound work, e.g. streaming of resources. */
+    lake_work_priority_streaming,
+    lake_work_priority_count,
+} lake_work_priority;
+
+/** Stack size classes for fibers. A job runs on a fiber with a stack of at least the 
+ *  requested class, the sizes and counts of every class are set in the framework hints. */
+typedef enum lake_fiber_stack : u32 {
+    /** The default, zero-initialized details run on `fiber_stack_size` stacks. */
+    lake_fiber_stack_default = 0,
+    /** Jobs that run deep call chains, `large_fiber_stack_size`. */
+    lake_fiber_stack_large,
+    /** Jobs that call into third party code with unbounded stack usage, `huge_fiber_stack_size`. */
+    lake_fiber_stack_huge,
+    lake_fiber_stack_class_count,
+} lake_fiber_stack;
+
 /** Details of the job description. */
 typedef struct lake_work_details {
-    PFN_lake_work   procedure;  /**< Job to run. */
-    void           *argument;   /**< Data for the job. */
-    const char     *name;       /**< A fiber will adopt this name for profiling. */
+    PFN_lake_work       procedure;  /**< Job to run. */
+    void               *argument;   /**< Data for the job. */
+    const char         *name;       /**< A fiber will adopt this name for profiling. */
+    lake_work_priority  priority;   /**< The lane this job is submitted into. */
+    lake_fiber_stack    stack;      /**< The smallest stack size class this job can run on. */
 } lake_work_details;
 
 /** An atomic counter bound to a work submit. If used within a call to the job system,
@@ -98,17 +165,100 @@ LAKEAPI LAKE_HOT_FN
 lake_work_chain LAKECALL lake_acquire_chain_n(usize initial_value);
 #define lake_acquire_chain() lake_acquire_chain_n(1)
 
-/** Release a chain acquired externally to a work submission. */
-LAKE_FORCE_INLINE void lake_release_chain(lake_work_chain chain)
-{ lake_atomic_write_explicit(chain, 0lu, lake_memory_model_release); }
+/** Release a chain acquired externally to a work submission. Parked worker threads are 
+ *  woken up, so a fiber waiting on this chain can be resumed. Releasing a chain that 
+ *  already reached zero does nothing. */
+LAKEAPI LAKE_NONNULL_ALL
+void LAKECALL lake_release_chain(lake_work_chain chain);
 
 /** Returns an index of the worker thread the current fiber is running on. This index 
- *  can be used to access an array of per-thread data structures. The index is acquired 
- *  by a hash lookup of the worker thread ID. If this function is called from a thread 
- *  that does not run on a fiber (e.g. outside of the framework), 0 is returned. */
-LAKEAPI LAKE_HOT_FN LAKE_PURE_FN 
+ *  can be used to access an array of per-thread data structures. The index is read from 
+ *  a thread local variable. If this function is called from a thread that does not run 
+ *  on a fiber (e.g. outside of the framework), 0 is returned. The result must not be 
+ *  cached across a yield, as the fiber may be resumed on a different worker thread. */
+LAKEAPI LAKE_HOT_FN
 u32 LAKECALL lake_worker_thread_index(void);
 
+/** Starts or stops recording job system events: job begin and end, yields and resumes, 
+ *  work taken from a worker's own deque or stolen from another one, and chains that were 
+ *  completed. Every worker thread records into it's own ring buffer, so only the most 
+ *  recent events are kept. While disabled, the cost of tracing is a single atomic load. */
+LAKEAPI void LAKECALL lake_work_trace(bool enable);
+
+/** Writes the events recorded since the tracer was last enabled into a file at `path`, 
+ *  in the Chrome trace event JSON format. It can be opened in `chrome://tracing` or in 
+ *  the Perfetto UI. Every worker thread is a track, every job is named by it's details.
+ *  Events recorded while the dump is in progress may be lost. Returns false if the file 
+ *  could not be written. */
+LAKEAPI LAKE_NONNULL_ALL 
+bool LAKECALL lake_work_trace_dump(char const *path);
+
+/** Names of accounted jobs are truncated to fit this size, with the null terminator. */
+#define LAKE_WORK_ACCOUNT_NAME_SIZE 48
+
+/** Time spent by the jobs that share a name, as returned by `lake_work_accounting_collect()`. */
+typedef struct lake_work_account {
+    char        name[LAKE_WORK_ACCOUNT_NAME_SIZE];
+    /** How many jobs of this name have finished. */
+    u64         count;
+    /** From the start of a job to it's end. */
+    u64         wall_ns;
+    /** Time the job was running on a worker thread, time it was preempted by the OS included. */
+    u64         cpu_ns;
+    /** Time the job was suspended, waiting on a chain or a fiber synchronization primitive,
+     *  or for room in a full deque. The wall time is the sum of cpu and wait time. */
+    u64         wait_ns;
+} lake_work_account;
+
+/** Starts or stops accounting the time spent by jobs. Only jobs that start while it's 
+ *  enabled are accounted, once they finish. While disabled, the cost is a single atomic load 
+ *  per job. Every worker thread keeps it's own table, without any locks or shared writes. */
+LAKEAPI void LAKECALL lake_work_accounting(bool enable);
+
+/** Collects the time accounted to jobs since the last call, usually called once per frame.
+ *  The tables of all worker threads are merged by job name, sorted by cpu time from the most 
+ *  expensive. Up to `capacity` entries are written into `out`, the number of distinct names 
+ *  is returned. The table of a worker holds a limited number of names, jobs that don't fit 
+ *  are accounted together under the name "(other)". A job that finishes while the tables are
+ *  collected may be split between two frames. */
+LAKEAPI
+u32 LAKECALL lake_work_accounting_collect(u32 capacity, lake_work_account *out);
+
+/** Starts or stops adapting the number of active worker threads to the load. The queue depth 
+ *  and the time workers spend parked are measured every few milliseconds. Workers retire while
+ *  most of them are idle, and are woken up again once work queues up faster than the active 
+ *  ones can take it. Retired workers park on a futex but stay pinned to their CPUs, so they 
+ *  resume quickly. The main thread is never retired. When stopped, all workers are active. */
+LAKEAPI void LAKECALL lake_work_adaptive_workers(bool enable);
+
+/** Returns how many worker threads are active, it's the worker thread count unless the 
+ *  adaptive worker count was enabled. */
+LAKEAPI
+u32 LAKECALL lake_work_active_workers(void);
+
+/** In the deterministic mode, see `lake_framework.hints.deterministic_seed`, every time the 
+ *  scheduler picks what to run next it takes a decision: an index into the fibers that are 
+ *  ready to resume, followed by the queued work. Starting from this call, the decisions are 
+ *  written into `decisions` until `capacity` is reached. The array must stay valid until 
+ *  the recording is stopped, by passing nullptr. Once the application's main returns, the 
+ *  recording and the replay stop, and the work that runs during shutdown is not seeded. */
+LAKEAPI
+void LAKECALL lake_work_schedule_record(u32 capacity, u32 *decisions);
+
+/** Returns how many decisions were taken since the recording started, it may be more than 
+ *  the capacity of the array that was given for the recording. */
+LAKEAPI
+u32 LAKECALL lake_work_schedule_recorded(void);
+
+/** Makes the scheduler take the next `count` decisions from the array, instead of from the 
+ *  seeded generator. The same program replaying the decisions recorded from a run will run 
+ *  it's work in the same order, it may be used to reproduce an interleaving found by some 
+ *  seed while bisecting. A decision is wrapped to the number of choices the scheduler has, 
+ *  so if the program diverges from the recorded run, it goes on but the order may differ. 
+ *  The array must stay valid until all of it was replayed. */
+LAKEAPI
+void LAKECALL lake_work_schedule_replay(u32 count, u32 const *decisions);
+
 /** Returns the name of the work of the currently executing fiber (for this worker thread). */
 LAKEAPI LAKE_HOT_FN LAKE_PURE_FN
 char const *LAKECALL lake_fiber_name(void);
@@ -123,6 +273,23 @@ void LAKECALL lake_submit_work(
     lake_work_details const *work, 
     lake_work_chain         *out_chain);
 
+/** Submits work from a thread that is not a worker thread of the job system, e.g. an audio 
+ *  callback, a display server dispatch thread, or a thread owned by a third-party library. 
+ *  The work is handed over through a shared ring, that workers check between jobs and move
+ *  into their own deques. It never blocks or takes a lock, so it's safe to call from a 
+ *  real-time thread, though it may wake a parked worker with a system call. Foreign threads 
+ *  can't yield, so the work is not chained. Returns how much of the work was submitted, if 
+ *  the ring is full the rest is left to the caller. From a worker thread, it's the same as 
+ *  `lake_submit_work()` without a chain. */
+LAKEAPI LAKE_NONNULL(2) LAKE_HOT_FN
+u32 LAKECALL lake_submit_foreign_work(
+    u32                      work_count, 
+    lake_work_details const *work);
+
+/** Returns true if called from a worker thread of the job system. */
+LAKEAPI LAKE_HOT_FN
+bool LAKECALL lake_is_worker_thread(void);
+
 /** If chain is not NULL, the fiber will yield and won't resume until the completion of work 
  *  that is chained. Otherwise if no chain is given, then the fiber may or may not yield to 
  *  the job system before returning. The chain becomes invalidated and any more yields will 
@@ -141,6 +308,161 @@ LAKE_FORCE_INLINE void lake_submit_work_and_yield(
     lake_yield(chain);
 }
 
+/** How much work a batch collects before it's submitted. */
+#define LAKE_WORK_BATCH_CAPACITY 64
+
+/** Collects many small jobs and submits them together, so the cost of publishing them to the 
+ *  job queue and of waking worker threads is paid once per batch, not once per job. A batch 
+ *  belongs to a single fiber, it's usually placed on the stack and zero-initialized. All work 
+ *  submitted through a batch shares one chain, the batch must be finished with a call to 
+ *  `lake_work_batch_yield()`, that waits for all of it to complete. */
+typedef struct lake_work_batch {
+    /** Acquired by the first flush, the batch holds a reference to it until it's yield. */
+    lake_work_chain     chain;
+    u32                 count;
+    lake_work_details   work[LAKE_WORK_BATCH_CAPACITY];
+} lake_work_batch;
+
+/** Submits the work collected in the batch, it's called when the batch is full. Work that 
+ *  was flushed may start running right away, while the fiber keeps adding more. */
+LAKEAPI LAKE_NONNULL_ALL LAKE_HOT_FN
+void LAKECALL lake_work_batch_flush(lake_work_batch *batch);
+
+/** Submits the rest of the batch and waits until all work submitted through it completes.
+ *  The batch is empty afterwards, and can be used again. */
+LAKEAPI LAKE_NONNULL_ALL LAKE_HOT_FN
+void LAKECALL lake_work_batch_yield(lake_work_batch *batch);
+
+/** Adds work to the batch, the work details are copied. */
+LAKE_FORCE_INLINE void lake_work_batch_add(
+    lake_work_batch         *batch, 
+    lake_work_details const *work)
+{
+    if (batch->count == LAKE_WORK_BATCH_CAPACITY)
+        lake_work_batch_flush(batch);
+    batch->work[batch->count++] = *work;
+}
+
+/** Defines a procedure for the body of a parallel for loop, it processes indices in [begin, end). */
+typedef void (LAKECALL *PFN_lake_parallel_for)(void *userdata, usize begin, usize end);
+/** Declares a procedure for the body of a parallel for loop, can be cast into `PFN_lake_parallel_for`. */
+#define FN_LAKE_PARALLEL_FOR(fn, arg) void LAKECALL fn(arg, usize begin, usize end)
+
+/** Runs `procedure` over the index range [0, count) in parallel, and returns only when the 
+ *  whole range was processed. The calling fiber takes part in the loop, instead of yielding 
+ *  right away. Helper jobs are submitted with the priority and stack class of the calling 
+ *  fiber, and they are named by `name`.
+ *
+ *  The range is split adaptively: every participant claims a chunk of the remaining range 
+ *  proportional to what is left, so chunks start large and shrink towards the end of the 
+ *  loop, balancing the load without much contention. A chunk is never smaller than the 
+ *  `grain_size`, unless it's the end of the range. If `grain_size` is 0, a default grain 
+ *  is picked to split the range into about 8 chunks per worker thread. */
+LAKEAPI LAKE_NONNULL(3) 
+void LAKECALL lake_parallel_for(
+    usize                   count,
+    usize                   grain_size,
+    PFN_lake_parallel_for   procedure,
+    void                   *argument,
+    char const             *name);
+
+/** A handle to delayed or periodic work, returned by `lake_submit_work_after()`. 
+ *  The value 0 is never a valid timer. */
+typedef u64 lake_work_timer;
+
+/** Submits the work after `delay_ns` nanoseconds, and then again every `period_ns` nanoseconds 
+ *  until the timer is cancelled, unless the period is 0. Workers check for due timers between 
+ *  dequeues, the timer wheel has a resolution of about a millisecond. The work never runs 
+ *  early, but it may run a tick late, or later if every worker is busy with long jobs.
+ *  Periodic work keeps a fixed rate, periods missed while the workers were busy are 
+ *  skipped instead of submitted in a burst. The work can't be chained, synchronize with it
+ *  using a semaphore if needed. Returns 0 if every timer is in use (see `timer_count` hint). */
+LAKEAPI LAKE_NONNULL(1)
+lake_work_timer LAKECALL lake_submit_work_after(
+    lake_work_details const *work,
+    u64                      delay_ns,
+    u64                      period_ns);
+
+/** Cancels a timer, so it's work won't be submitted again. Work that was submitted by the 
+ *  timer already is not affected. Returns false if the timer has fired already and was not 
+ *  periodic, or if it was cancelled before. */
+LAKEAPI
+bool LAKECALL lake_cancel_work_timer(lake_work_timer timer);
+
+/** Fibers parked on a synchronization primitive. While parked, a fiber does not occupy
+ *  it's worker thread, the worker runs other work instead. Zero initialized is valid. */
+typedef struct lake_fiber_wait_list {
+    lake_spinlock   lock;
+    /** Fibers that are switching out to park on this list, but are not in it yet. */
+    atomic_u32      pending;
+    u32             head;
+    u32             tail;
+} lake_fiber_wait_list;
+
+/** A mutex that parks the calling fiber, instead of spinning, while it's contended.
+ *  Use it in place of `lake_spinlock` for critical sections that may take long, e.g.
+ *  when they allocate memory or call into the driver. The mutex is not recursive. */
+typedef struct lake_fiber_mutex {
+    /** 0 if unlocked, 1 if locked, 2 if locked and fibers may be waiting. */
+    atomic_u32              state;
+    lake_fiber_wait_list    waiters;
+} lake_fiber_mutex;
+#define lake_fiber_mutex_init {0}
+
+/** A counting semaphore, fibers acquiring it while the count is 0 are parked. */
+typedef struct lake_fiber_semaphore {
+    atomic_u32              count;
+    lake_fiber_wait_list    waiters;
+} lake_fiber_semaphore;
+#define lake_fiber_semaphore_init(n) {.count = (n)}
+
+/** A condition variable, used together with a `lake_fiber_mutex`. */
+typedef struct lake_fiber_condvar {
+    /** Incremented by every signal, so a waiter can tell if it was signaled. */
+    atomic_u32              sequence;
+    lake_fiber_wait_list    waiters;
+} lake_fiber_condvar;
+#define lake_fiber_condvar_init {0}
+
+/** Returns true if the mutex was locked by this call, never parks the fiber. */
+LAKEAPI LAKE_NONNULL_ALL
+bool LAKECALL lake_fiber_mutex_try_lock(lake_fiber_mutex *mutex);
+
+/** Locks the mutex. If it's locked by another fiber, spins for a short while and then
+ *  parks the calling fiber until the mutex is unlocked. */
+LAKEAPI LAKE_NONNULL_ALL
+void LAKECALL lake_fiber_mutex_lock(lake_fiber_mutex *mutex);
+
+/** Unlocks the mutex and resumes one of the parked fibers, if there are any. */
+LAKEAPI LAKE_NONNULL_ALL
+void LAKECALL lake_fiber_mutex_unlock(lake_fiber_mutex *mutex);
+
+/** Decrements the count of the semaphore, parks the calling fiber while it's 0. */
+LAKEAPI LAKE_NONNULL_ALL
+void LAKECALL lake_fiber_semaphore_acquire(lake_fiber_semaphore *semaphore);
+
+/** Returns true if the count was decremented, never parks the fiber. */
+LAKEAPI LAKE_NONNULL_ALL
+bool LAKECALL lake_fiber_semaphore_try_acquire(lake_fiber_semaphore *semaphore);
+
+/** Increments the count of the semaphore by `count`, resumes up to `count` parked fibers. */
+LAKEAPI LAKE_NONNULL_ALL
+void LAKECALL lake_fiber_semaphore_release(lake_fiber_semaphore *semaphore, u32 count);
+
+/** Unlocks the mutex and parks the calling fiber until the condition variable is signaled,
+ *  then locks the mutex again before returning. The mutex must be locked by the caller.
+ *  As with any condition variable, the condition must be checked again in a loop. */
+LAKEAPI LAKE_NONNULL_ALL
+void LAKECALL lake_fiber_condvar_wait(lake_fiber_condvar *condvar, lake_fiber_mutex *mutex);
+
+/** Resumes one fiber waiting on the condition variable, if there is any. */
+LAKEAPI LAKE_NONNULL_ALL
+void LAKECALL lake_fiber_condvar_signal(lake_fiber_condvar *condvar);
+
+/** Resumes every fiber waiting on the condition variable. */
+LAKEAPI LAKE_NONNULL_ALL
+void LAKECALL lake_fiber_condvar_broadcast(lake_fiber_condvar *condvar);
+
 /** Allocate transient resources with an automatic release. Their lifetime is tighly 
  *  tied with a fiber (or an explicit scope from usercode), will be preserved at yield, 
  *  and then released after the fiber is done with it's work. Because of the nature of 
@@ -198,6 +198,11 @@ static FN_LAKE_FRAMEWORK(a_moonlit_walk__main)
     stages[RENDERING_STAGE_INDEX].name = "main/rendering";
     stages[GPUEXEC_STAGE_INDEX].procedure = (PFN_lake_work)a_moonlit_walk__gpuexec;
     stages[GPUEXEC_STAGE_INDEX].name = "main/gpuexec";
+    /* the pipeline stages are on the critical path of every frame */
+    for (u32 i = 0; i < lake_arraysize(stages); i++) {
+        stages[i].priority = lake_work_priority_critical;
+        stages[i].stack = lake_fiber_stack_default;
+    }
     amw.framework = framework;
     amw.frames_in_flight = 3;
 
@@ -254,6 +259,8 @@ static FN_LAKE_FRAMEWORK(a_moonlit_walk__main)
 
                 lake_frame_time_record(framework->timer_start, time_now, dt_freq_reciprocal);
                 lake_frame_time_print(1000.f);
+                /* destroy objects released during the last frame */
+                lake_zero_refcnt_flush(nullptr);
 
                 lake_darray_clear(&gameplay->swapchains.da);
                 lake_darray_clear(&gameplay->cmd_lists.da);
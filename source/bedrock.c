@@ -1,5 +1,7 @@
 #include "internal.h"
 
+#include <stdlib.h>
+
 struct bedrock *g_bedrock = nullptr;
 
 static LAKE_NORETURN void LAKECALL d4c_love_train(void *stub)
@@ -21,21 +23,100 @@ struct application {
     lake_framework     *framework;
 };
 
+static char const *g_page_policy_names[] = { "standard", "transparent huge", "hugetlbfs" };
+
 static LAKE_NORETURN void LAKECALL funny_valentine(void *raw_app)
 {
     struct application *app = (struct application *)raw_app;
+    lake_thpage_report const pages = g_bedrock->pages;
+    lake_dbg_1("Memory is backed by %s pages for the roots, %s pages for the fiber stacks, %s pages for the tagged heap blocks "
+            "(%lu blocks of hugetlbfs, huge pages of %lu KiB).", g_page_policy_names[pages.roots], g_page_policy_names[pages.fiber_stacks], 
+            g_page_policy_names[pages.blocks], pages.hugetlb_blocks, pages.huge_page_size >> 10);
     app->main(app->framework);
 
+    /* destroy what the application released, destructors may release more objects */
+    lake_work_chain chain = nullptr;
+    while (lake_zero_refcnt_flush(&chain))
+        lake_yield(chain);
+
+    /* Every worker must pick up it's end, none can stay retired. The schedule is no longer 
+     * recorded or replayed, the arrays may be gone with the application. Only this worker 
+     * runs in the deterministic mode, the flag is published before the others wake up. */
+    g_bedrock->schedule.record = nullptr;
+    g_bedrock->schedule.replay_count = 0;
+    lake_atomic_write_explicit(&g_bedrock->schedule.deterministic, 0u, lake_memory_model_release);
+    lake_work_adaptive_workers(false);
+
     /* tell all threads to die, type shit */
     for (s32 i = 0; i < g_bedrock->thread_count; i++) {
         g_bedrock->ends[i].procedure = d4c_love_train;
         g_bedrock->ends[i].argument = nullptr;
         g_bedrock->ends[i].name = "bedrock/ends";
+        g_bedrock->ends[i].priority = lake_work_priority_normal;
+        g_bedrock->ends[i].stack = lake_fiber_stack_default;
     }
     lake_submit_work_and_yield(g_bedrock->thread_count, g_bedrock->ends);
     LAKE_UNREACHABLE;
 }
 
+/** Orders CPUs by SMT sibling index first, then keeps workers that share a NUMA node 
+ *  and a last level cache next to each other. */
+static s32 compare_worker_placement(void const *a, void const *b)
+{
+    struct sys_cpu const *x = (struct sys_cpu const *)a;
+    struct sys_cpu const *y = (struct sys_cpu const *)b;
+    u32 const keys_x[] = { x->smt, x->numa_node, x->package, x->llc, x->core, x->id };
+    u32 const keys_y[] = { y->smt, y->numa_node, y->package, y->llc, y->core, y->id };
+
+    for (u32 i = 0; i < lake_arraysize(keys_x); i++)
+        if (keys_x[i] != keys_y[i]) return keys_x[i] < keys_y[i] ? -1 : 1;
+    return 0;
+}
+
+/** Picks what backs the parts of the mapping, before any of it is committed. Only the blocks
+ *  expected to stay resident take hugetlbfs pages, as they're taken from the host's pool up
+ *  front, and only if a block is made of whole huge pages. Blocks are acquired from the lowest
+ *  address, so these are the first blocks after the roots. Every block is mapped on it's own, 
+ *  once the pool runs dry the rest of the blocks fall back. The fiber stacks are small and 
+ *  split by guard pages, huge pages would only waste memory there. */
+static lake_thpage_report apply_page_policies(
+        usize roots_block_aligned, 
+        usize stack_offset, 
+        usize stack_bytes, 
+        usize budget, 
+        usize huge_page_size,
+        usize resident_blocks)
+{
+    usize hugetlb_free = 0;
+    bool transparent = false;
+    sys_hugepageinfo(huge_page_size, &hugetlb_free, &transparent);
+    lake_page_policy const fallback = transparent ? lake_page_policy_transparent : lake_page_policy_standard;
+
+    lake_thpage_report pages = { .huge_page_size = huge_page_size };
+    pages.roots = sys_mpolicy(g_bedrock, 0, roots_block_aligned, huge_page_size, fallback);
+    pages.fiber_stacks = sys_mpolicy(g_bedrock, stack_offset, stack_bytes, huge_page_size, lake_page_policy_standard);
+    pages.blocks = pages.roots;
+    if (roots_block_aligned >= budget) return pages;
+
+    usize const block_count = (budget - roots_block_aligned) / LAKE_TAGGED_HEAP_BLOCK_SIZE;
+    usize hugetlb_blocks = 0;
+    if ((LAKE_TAGGED_HEAP_BLOCK_SIZE % huge_page_size) == 0)
+        hugetlb_blocks = lake_min(lake_min(resident_blocks, block_count), 
+                hugetlb_free * huge_page_size / LAKE_TAGGED_HEAP_BLOCK_SIZE);
+
+    usize offset = roots_block_aligned;
+    for (; pages.hugetlb_blocks < hugetlb_blocks; pages.hugetlb_blocks++) {
+        if (sys_mpolicy(g_bedrock, offset, LAKE_TAGGED_HEAP_BLOCK_SIZE, 
+                    huge_page_size, lake_page_policy_hugetlb) != lake_page_policy_hugetlb)
+            break;
+        offset += LAKE_TAGGED_HEAP_BLOCK_SIZE;
+    }
+    lake_page_policy const rest = offset < budget 
+        ? sys_mpolicy(g_bedrock, offset, budget - offset, huge_page_size, fallback) : fallback;
+    pages.blocks = pages.hugetlb_blocks ? lake_page_policy_hugetlb : rest;
+    return pages;
+}
+
 static void bedrock_init(lake_framework *framework)
 {
     usize ram_budget, page_size, huge_page_size = 0;
@@ -45,87 +126,158 @@ static void bedrock_init(lake_framework *framework)
 
     s32 cpu_count = 0;
     sys_cpuinfo(&cpu_count, nullptr, nullptr);
+    u32 const topology_count = sys_cpu_topology(0, nullptr);
     if (framework->hints.worker_thread_count == 0 || framework->hints.worker_thread_count > (u32)cpu_count)
         framework->hints.worker_thread_count = cpu_count;
 
     if (framework->hints.huge_page_size == 0)
         framework->hints.huge_page_size = 4lu*1024*1024;
     sys_hugetlbinfo(&huge_page_size, framework->hints.huge_page_size);
-    framework->hints.huge_page_size = huge_page_size;
+    framework->hints.huge_page_size = huge_page_size ? huge_page_size : page_size;
 
     if (framework->hints.tagged_heap_count == 0)
         framework->hints.tagged_heap_count = 32;
+    if (framework->hints.tagged_heap_resident_blocks == 0)
+        framework->hints.tagged_heap_resident_blocks = 64;
     if (framework->hints.fiber_stack_size == 0)
         framework->hints.fiber_stack_size = 64lu * 1024;
     if (framework->hints.fiber_count == 0)
         framework->hints.fiber_count = 96 + 4 * framework->hints.worker_thread_count;
+    if (framework->hints.large_fiber_stack_size == 0)
+        framework->hints.large_fiber_stack_size = 512lu * 1024;
+    if (framework->hints.large_fiber_count == 0)
+        framework->hints.large_fiber_count = framework->hints.worker_thread_count;
+    if (framework->hints.huge_fiber_stack_size == 0)
+        framework->hints.huge_fiber_stack_size = 4lu * 1024 * 1024;
+    if (framework->hints.huge_fiber_count == 0)
+        framework->hints.huge_fiber_count = 2;
     if (framework->hints.log2_work_count == 0)
         framework->hints.log2_work_count = 11; /* 2048 */
+    if (framework->hints.log2_foreign_work_count == 0)
+        framework->hints.log2_foreign_work_count = 10; /* 1024 */
+    if (framework->hints.log2_zero_refcnt_count == 0)
+        framework->hints.log2_zero_refcnt_count = 12; /* 4096 */
+    if (framework->hints.timer_count == 0)
+        framework->hints.timer_count = 256;
     if (framework->hints.frames_in_flight < 2)
         framework->hints.frames_in_flight = 2;
     framework->timer_start = lake_rtc_counter();
 
-    work_queue_node *work_nodes = nullptr;
+    struct work *work_buffers = nullptr;
     struct region *roots_pages = nullptr;
     usize const roots_page_count = 8;
 
+    /* every fiber stack is page aligned and preceded by a guard page */
+    u32 const fiber_counts[lake_fiber_stack_class_count] = {
+        framework->hints.fiber_count,
+        framework->hints.large_fiber_count,
+        framework->hints.huge_fiber_count,
+    };
+    usize const stack_sizes[lake_fiber_stack_class_count] = {
+        lake_align(framework->hints.fiber_stack_size, page_size),
+        lake_align(framework->hints.large_fiber_stack_size, page_size),
+        lake_align(framework->hints.huge_fiber_stack_size, page_size),
+    };
+    u32 total_fiber_count = 0;
+    usize stack_heap_bytes = page_size; /* slack to page align the stacks */
+    for (u32 i = 0; i < lake_fiber_stack_class_count; i++) {
+        total_fiber_count += fiber_counts[i];
+        stack_heap_bytes += fiber_counts[i] * (page_size + stack_sizes[i]);
+    }
+
     usize const bedrock_bytes           = lake_align(sizeof(struct bedrock), LAKE_CACHELINE_SIZE);
+    usize const trace_bytes             = lake_align(sizeof(struct trace_event) * TRACE_EVENT_COUNT * framework->hints.worker_thread_count, 16);
     usize const work_count              = 1lu << framework->hints.log2_work_count;
-    usize const work_nodes_bytes        = lake_align(sizeof(work_queue_node) * work_count, 16);
+    usize const deque_count             = WORK_LANE_COUNT * framework->hints.worker_thread_count;
+    usize const deques_bytes            = lake_align(sizeof(struct work_deque) * deque_count, LAKE_CACHELINE_SIZE);
+    usize const work_buffers_bytes      = lake_align(sizeof(struct work) * work_count * deque_count, 16);
     usize const roots_pages_bytes       = lake_align(sizeof(struct region) * roots_page_count, 16);
     usize const tls_bytes               = lake_align(sizeof(struct tls) * framework->hints.worker_thread_count, 16);
     usize const ends_bytes              = lake_align(sizeof(lake_work_details) * framework->hints.worker_thread_count, 16);
     usize const threads_bytes           = lake_align(sizeof(sys_thread_id) * framework->hints.worker_thread_count, 16);
-    usize const fibers_bytes            = lake_align(sizeof(struct fiber) * framework->hints.fiber_count, 16);
-    usize const waiting_bytes           = lake_align(sizeof(atomic_usize) * framework->hints.fiber_count, 16);
-    usize const free_bytes              = lake_align(sizeof(atomic_usize) * framework->hints.fiber_count, 16);
-    usize const locks_bytes             = lake_align(sizeof(atomic_usize) * framework->hints.fiber_count, 16);
-    usize const heap_bytes              = lake_align(sizeof(struct tagged_heap), 16);
-    usize const tagged_heap_bytes       = heap_bytes * framework->hints.tagged_heap_count;
-    usize const tagged_heap_array_bytes = lake_align(sizeof(struct tagged_heap *) * framework->hints.tagged_heap_count, 16);
+    usize const cpus_bytes              = lake_align(sizeof(struct sys_cpu) * topology_count, 16);
+    usize const fibers_bytes            = lake_align(sizeof(struct fiber) * total_fiber_count, 16);
+    usize const ready_count             = lake_bits_next_pow2(total_fiber_count);
+    usize const ready_bytes             = lake_align(sizeof(ready_fiber_node) * ready_count, 16);
+    usize const foreign_count           = 1lu << framework->hints.log2_foreign_work_count;
+    usize const foreign_bytes           = lake_align(sizeof(foreign_work_node) * foreign_count, 16);
+    usize const zero_refcnt_count       = 1lu << framework->hints.log2_zero_refcnt_count;
+    usize const zero_refcnt_bytes       = lake_align(sizeof(zero_refcnt_node) * zero_refcnt_count, 16);
+    usize const schedule_bytes          = lake_align(sizeof(u32) * total_fiber_count, 16);
+    usize const waiters_bytes           = lake_align(sizeof(atomic_u32) * total_fiber_count, 16);
+    usize const timers_bytes            = lake_align(sizeof(struct work_timer) * framework->hints.timer_count, 16);
+    usize const accounts_bytes          = lake_align(sizeof(struct work_account) * (WORK_ACCOUNT_COUNT + 1) * framework->hints.worker_thread_count, 16);
+    usize const locks_bytes             = lake_align(sizeof(atomic_usize) * total_fiber_count, 16);
+    usize const tagged_heap_slots       = lake_bits_next_pow2(2 * framework->hints.tagged_heap_count);
+    usize const tagged_heap_bytes       = lake_align(sizeof(struct tagged_heap) * tagged_heap_slots, 16);
     usize const block_count             = __position_from_block(framework->hints.memory_budget); 
     usize const heap_bitmap_bytes       = lake_align(__index_from_position(block_count), 16);
-    usize const stack_bytes             = lake_align(framework->hints.fiber_stack_size, 16);
-    usize const stack_heap_bytes        = stack_bytes * framework->hints.fiber_count;
+    usize const summary_count           = (heap_bitmap_bytes + 63) / 64;
+    usize const summary_bytes           = lake_align(sizeof(atomic_u64) * summary_count, 16);
+    usize const summary_top_bytes       = lake_align(sizeof(atomic_u64) * ((summary_count + 63) / 64), 16);
 
     usize const roots_bytes = 
         bedrock_bytes +
-        work_nodes_bytes +
+        deques_bytes +
+        work_buffers_bytes +
         roots_pages_bytes +
         tls_bytes +
         ends_bytes +
         threads_bytes +
+        cpus_bytes +
         fibers_bytes +
-        waiting_bytes +
-        free_bytes +
+        ready_bytes +
+        foreign_bytes +
+        zero_refcnt_bytes +
+        waiters_bytes +
+        schedule_bytes +
+        timers_bytes +
+        accounts_bytes +
         locks_bytes +
         tagged_heap_bytes +
-        tagged_heap_array_bytes +
         heap_bitmap_bytes +
-        stack_heap_bytes;
+        summary_bytes +
+        summary_top_bytes +
+        heap_bitmap_bytes +
+        stack_heap_bytes +
+        trace_bytes;
     usize const roots_block_aligned = lake_align(roots_bytes, LAKE_TAGGED_HEAP_BLOCK_SIZE);
     usize commitment = lake_min(lake_align(roots_block_aligned, 8lu*LAKE_TAGGED_HEAP_BLOCK_SIZE), framework->hints.memory_budget);
 
-    g_bedrock = sys_mmap(framework->hints.memory_budget, framework->hints.huge_page_size);
-    if (g_bedrock == nullptr || !sys_madvise(g_bedrock, 0u, commitment, true)) {
+    /* the stacks are carved right after the internal structures, below */
+    usize const stack_offset = lake_align(roots_bytes - stack_heap_bytes - trace_bytes, page_size);
+
+    /* blocks of the tagged heap must start at a huge page boundary to be backed by huge pages */
+    g_bedrock = sys_mmap(framework->hints.memory_budget, lake_max(framework->hints.huge_page_size, LAKE_TAGGED_HEAP_BLOCK_SIZE));
+    lake_thpage_report pages = {0};
+    if (g_bedrock != nullptr)
+        pages = apply_page_policies(roots_block_aligned, stack_offset, stack_heap_bytes, 
+                framework->hints.memory_budget, framework->hints.huge_page_size, 
+                framework->hints.tagged_heap_resident_blocks);
+    if (g_bedrock == nullptr || !sys_madvise(g_bedrock, 0u, commitment, sys_madvise_mode_commit)) {
         lake_fatal("Can't map internal framework memory.");
         lake_abort(LAKE_ERROR_MEMORY_MAP_FAILED);
     }
-    lake_memset(g_bedrock, 0u, commitment);
+    /* fresh anonymous pages are zeroed, the stacks and trace rings are left untouched until they are used */
+    lake_memset(g_bedrock, 0u, roots_bytes - stack_heap_bytes - trace_bytes);
 
     g_bedrock->thread_count = framework->hints.worker_thread_count;
-    g_bedrock->fiber_count = framework->hints.fiber_count;
+    g_bedrock->fiber_count = (s32)total_fiber_count;
     g_bedrock->tagged_heap_count = framework->hints.tagged_heap_count;
+    g_bedrock->tagged_heap_mask = (u32)tagged_heap_slots - 1;
     g_bedrock->budget = framework->hints.memory_budget;
     g_bedrock->page_size = framework->hints.huge_page_size;
+    g_bedrock->resident_block_limit = framework->hints.tagged_heap_resident_blocks;
+    g_bedrock->pages = pages;
     lake_atomic_init(&g_bedrock->commitment, commitment);
-    g_bedrock->stack_size = stack_bytes;
 
     u8 *raw = (u8 *)g_bedrock;
     usize o = bedrock_bytes;
 
-    work_nodes = (work_queue_node *)&raw[o]; 
-    o += work_nodes_bytes;
+    g_bedrock->deques = (struct work_deque *)&raw[o];
+    o += deques_bytes;
+    work_buffers = (struct work *)&raw[o]; 
+    o += work_buffers_bytes;
     roots_pages = (struct region *)&raw[o]; 
     o += roots_pages_bytes;
     g_bedrock->tls = (struct tls *)&raw[o]; 
@@ -134,24 +286,40 @@ static void bedrock_init(lake_framework *framework)
     o += ends_bytes;
     g_bedrock->threads = (sys_thread_id *)&raw[o]; 
     o += threads_bytes;
+    g_bedrock->cpus = (struct sys_cpu *)&raw[o];
+    o += cpus_bytes;
     g_bedrock->fibers = (struct fiber *)&raw[o]; 
     o += fibers_bytes;
-    g_bedrock->waiting = (atomic_usize *)&raw[o]; 
-    o += waiting_bytes;
-    g_bedrock->free = (atomic_usize *)&raw[o]; 
-    o += free_bytes;
+    ready_fiber_node *ready_nodes = (ready_fiber_node *)&raw[o];
+    o += ready_bytes;
+    foreign_work_node *foreign_nodes = (foreign_work_node *)&raw[o];
+    o += foreign_bytes;
+    zero_refcnt_node *zero_refcnt_nodes = (zero_refcnt_node *)&raw[o];
+    o += zero_refcnt_bytes;
+    g_bedrock->waiters = (atomic_u32 *)&raw[o]; 
+    o += waiters_bytes;
+    g_bedrock->schedule.ready = (u32 *)&raw[o];
+    o += schedule_bytes;
+    struct work_timer *timers = (struct work_timer *)&raw[o];
+    o += timers_bytes;
+    struct work_account *accounts = (struct work_account *)&raw[o];
+    o += accounts_bytes;
     g_bedrock->locks = (atomic_usize *)&raw[o]; 
     o += locks_bytes;
-    g_bedrock->tagged_heaps = (struct tagged_heap **)&raw[o];
-    o += tagged_heap_array_bytes;
-    for (s32 i = 0; i < g_bedrock->tagged_heap_count; i++) {
-        g_bedrock->tagged_heaps[i] = (struct tagged_heap *)&raw[o];
-        o += heap_bytes;
-    }
+    g_bedrock->tagged_heaps = (struct tagged_heap *)&raw[o];
+    o += tagged_heap_bytes;
     g_bedrock->bitmap = (atomic_u8 *)&raw[o];
     o += heap_bitmap_bytes;
-    g_bedrock->stack = (u8 *)&raw[o];
+    g_bedrock->bitmap_summary = (atomic_u64 *)&raw[o];
+    o += summary_bytes;
+    g_bedrock->bitmap_summary_top = (atomic_u64 *)&raw[o];
+    o += summary_top_bytes;
+    g_bedrock->decommitted = (atomic_u8 *)&raw[o];
+    o += heap_bitmap_bytes;
+    g_bedrock->stack = (u8 *)&raw[lake_align(o, page_size)];
     o += stack_heap_bytes;
+    struct trace_event *trace_events = (struct trace_event *)&raw[o];
+    o += trace_bytes;
 
     g_bedrock->roots.tail = &g_bedrock->roots.head;
     for (u32 i = 0; i < roots_page_count; i++)
@@ -161,32 +329,90 @@ static void bedrock_init(lake_framework *framework)
     g_bedrock->roots.head.alloc = roots_block_aligned;
     g_bedrock->roots.tail = &g_bedrock->roots.head;
 
-    /* bits set to 1 means free blocks */
+    /* bits set to 1 means free blocks, none of them was decommitted yet (zeroed above) */
     lake_memset(g_bedrock->bitmap, 0xff, heap_bitmap_bytes);
+    lake_memset(g_bedrock->bitmap_summary, 0xff, summary_bytes);
+    lake_memset(g_bedrock->bitmap_summary_top, 0xff, summary_top_bytes);
     acquire_heap_bitmap(g_bedrock->bitmap, 0, roots_block_aligned);
+    lake_atomic_init(&g_bedrock->roots.blocks, (u32)__position_from_block(roots_block_aligned));
+    lake_atomic_init(&g_bedrock->roots.blocks_high_water, (u32)__position_from_block(roots_block_aligned));
     //release_heap_bitmap(g_bedrock->bitmap, roots_block_aligned, g_bedrock->budget-roots_block_aligned);
 
-    lake_dbg_assert(!(((sptr)work_nodes)                & 15), LAKE_PANIC, nullptr);
+    lake_dbg_assert(!(((sptr)g_bedrock->deques)         & (LAKE_CACHELINE_SIZE-1)), LAKE_PANIC, nullptr);
+    lake_dbg_assert(!(((sptr)work_buffers)              & 15), LAKE_PANIC, nullptr);
     lake_dbg_assert(!(((sptr)roots_pages)               & 15), LAKE_PANIC, nullptr);
     lake_dbg_assert(!(((sptr)g_bedrock->tls)            & 15), LAKE_PANIC, nullptr);
     lake_dbg_assert(!(((sptr)g_bedrock->ends)           & 15), LAKE_PANIC, nullptr);
     lake_dbg_assert(!(((sptr)g_bedrock->threads)        & 15), LAKE_PANIC, nullptr);
+    lake_dbg_assert(!(((sptr)g_bedrock->cpus)           & 15), LAKE_PANIC, nullptr);
     lake_dbg_assert(!(((sptr)g_bedrock->fibers)         & 15), LAKE_PANIC, nullptr);
-    lake_dbg_assert(!(((sptr)g_bedrock->waiting)        & 15), LAKE_PANIC, nullptr);
-    lake_dbg_assert(!(((sptr)g_bedrock->free)           & 15), LAKE_PANIC, nullptr);
+    lake_dbg_assert(!(((sptr)ready_nodes)               & 15), LAKE_PANIC, nullptr);
+    lake_dbg_assert(!(((sptr)foreign_nodes)             & 15), LAKE_PANIC, nullptr);
+    lake_dbg_assert(!(((sptr)zero_refcnt_nodes)         & 15), LAKE_PANIC, nullptr);
+    lake_dbg_assert(!(((sptr)g_bedrock->waiters)        & 15), LAKE_PANIC, nullptr);
+    lake_dbg_assert(!(((sptr)g_bedrock->schedule.ready) & 15), LAKE_PANIC, nullptr);
+    lake_dbg_assert(!(((sptr)timers)                    & 15), LAKE_PANIC, nullptr);
+    lake_dbg_assert(!(((sptr)accounts)                  & 15), LAKE_PANIC, nullptr);
     lake_dbg_assert(!(((sptr)g_bedrock->locks)          & 15), LAKE_PANIC, nullptr);
     lake_dbg_assert(!(((sptr)g_bedrock->tagged_heaps)   & 15), LAKE_PANIC, nullptr);
     lake_dbg_assert(!(((sptr)g_bedrock->bitmap)         & 15), LAKE_PANIC, nullptr);
-    lake_dbg_assert(!(((sptr)g_bedrock->stack)          & 15), LAKE_PANIC, nullptr);
+    lake_dbg_assert(!(((sptr)g_bedrock->bitmap_summary) & 15), LAKE_PANIC, nullptr);
+    lake_dbg_assert(!(((sptr)g_bedrock->decommitted)    & 15), LAKE_PANIC, nullptr);
+    lake_dbg_assert(!(((sptr)g_bedrock->stack)          & (page_size-1)), LAKE_PANIC, nullptr);
+    lake_dbg_assert(g_bedrock->stack == &raw[stack_offset], LAKE_PANIC, nullptr);
+    lake_dbg_assert(!(((sptr)trace_events)              & 15), LAKE_PANIC, nullptr);
 
-    lake_mpmc_init_t(&g_bedrock->work_queue.ring, work_queue_node, work_count, work_nodes);
+    /* every worker thread owns a work-stealing deque per priority lane */
+    for (usize i = 0; i < deque_count; i++) {
+        struct work_deque *deq = &g_bedrock->deques[i];
+        deq->buffer = &work_buffers[i * work_count];
+        deq->buffer_mask = (ssize)work_count - 1;
+        lake_atomic_init(&deq->top, 0l);
+        lake_atomic_init(&deq->bottom, 0l);
+    }
+    for (s32 i = 0; i < g_bedrock->thread_count; i++) {
+        g_bedrock->tls[i].steal_seed = 0x9e3779b9u * (u32)(i + 1);
+        g_bedrock->tls[i].trace_events = &trace_events[i * TRACE_EVENT_COUNT];
+        g_bedrock->tls[i].accounts = &accounts[i * (WORK_ACCOUNT_COUNT + 1)];
+    }
 
+    /* workers fill the physical cores of one NUMA node before moving on to the next,
+     * the SMT siblings are only used once every physical core has a worker */
+    g_bedrock->cpu_count = sys_cpu_topology(topology_count, g_bedrock->cpus);
+    qsort(g_bedrock->cpus, g_bedrock->cpu_count, sizeof(struct sys_cpu), compare_worker_placement);
+
+    lake_mpmc_init_t(&g_bedrock->ready.ring, ready_fiber_node, (s32)ready_count, ready_nodes);
+    lake_mpmc_init_t(&g_bedrock->foreign.ring, foreign_work_node, (s32)foreign_count, foreign_nodes);
+    lake_mpmc_init_t(&g_bedrock->zero_refcnt.ring, zero_refcnt_node, (s32)zero_refcnt_count, zero_refcnt_nodes);
+    init_work_timers(timers, framework->hints.timer_count);
+    /* in the deterministic mode only the main thread runs work, the rest stays retired */
+    bool const deterministic = framework->hints.deterministic_seed != 0;
+    lake_atomic_init(&g_bedrock->schedule.deterministic, deterministic ? 1u : 0u);
+    g_bedrock->schedule.rng = 0x9e3779b97f4a7c15lu * framework->hints.deterministic_seed;
+    lake_atomic_init(&g_bedrock->scaling.active_limit, deterministic ? 1u : (u32)g_bedrock->thread_count);
+    lake_atomic_init(&g_bedrock->scaling.next_due, UINT64_MAX);
+    /* carve the stacks for every size class, with a guard page below every stack */
+    u8 *stack = g_bedrock->stack;
+    for (u32 c = 0, f = 0; c < lake_fiber_stack_class_count; c++) {
+        lake_atomic_init(&g_bedrock->free_head[c], (u64)FREE_FIBER_END);
+        for (u32 i = 0; i < fiber_counts[c]; i++, f++) {
+            if (!sys_madvise(g_bedrock, (usize)(stack - raw), page_size, sys_madvise_mode_guard))
+                lake_error("Failed to protect the guard page of fiber %u.", f);
+            stack += page_size + stack_sizes[c];
+
+            struct fiber *fiber = &g_bedrock->fibers[f];
+            fiber->stack_class = (lake_fiber_stack)c;
+            fiber->stack = stack;
+            fiber->stack_size = stack_sizes[c];
+        }
+    }
+    for (s32 i = g_bedrock->fiber_count - 1; i >= 0; i--)
+        release_free_fiber((u32)i);
     for (s32 i = 0; i < g_bedrock->fiber_count; i++) {
-        lake_atomic_init(&g_bedrock->free[i], i);
         lake_atomic_init(&g_bedrock->locks[i], FIBER_INVALID);
-        lake_atomic_init(&g_bedrock->waiting[i], FIBER_INVALID);
+        lake_atomic_init(&g_bedrock->waiters[i], FREE_FIBER_END);
     }
-    g_bedrock->tls[0].fiber_in_use = (u32)get_free_fiber();
+    g_bedrock->tls[0].fiber_in_use = (u32)get_free_fiber(lake_fiber_stack_default);
 #if defined(LAKE_PLATFORM_UNIX)
     g_bedrock->threads[0] = (sys_thread_id)pthread_self();
 #elif defined(LAKE_PLATFORM_WINDOWS)
@@ -199,7 +425,7 @@ static void bedrock_init(lake_framework *framework)
         tls->fiber_in_use = (u32)FIBER_INVALID;
         sys_thread_create(&g_bedrock->threads[i], dirty_deeds_done_dirt_cheap, (void *)tls);
     }
-    sys_thread_affinity(g_bedrock->thread_count, g_bedrock->threads, cpu_count, 0);
+    sys_thread_affinity(g_bedrock->thread_count, g_bedrock->threads, g_bedrock->cpus, g_bedrock->cpu_count);
     lake_atomic_write_explicit(&g_bedrock->tls_sync, 1lu, lake_memory_model_release);
 }
 
@@ -219,7 +445,8 @@ s32 lake_in_the_lungs(
         .name = "lake/in_the_lungs",
     };
 
-    lake_submit_work(1, &work, nullptr);
+    /* the main thread enters the job system only below */
+    lake_submit_foreign_work(1, &work);
     dirty_deeds_done_dirt_cheap((void *)&g_bedrock->tls[0]);
     /* won't resume until the application returns */
 
@@ -54,3 +54,46 @@ bool lake_mpmc_rotate(
     }
     LAKE_UNREACHABLE;
 }
+
+s32 lake_mpmc_rotate_n(
+    lake_mpmc_ring     *ring,
+    atomic_ssize       *in_or_out,
+    s32 const           stride,
+    s32 const           pos_delta,
+    s32 const           count,
+    lake_mpmc_result   *out_result)
+{
+    ssize pos = lake_atomic_read_explicit(in_or_out, lake_memory_model_relaxed);
+
+    for (;;) {
+        s32 claim = 0;
+        sptr diff = 0;
+
+        /* count the cells that are ready, the claim can only be lost to another thread moving the position */
+        for (; claim < count; claim++) {
+            atomic_ssize *sequence = (atomic_ssize *)lake_elem(ring->buffer, stride, (pos + claim) & ring->buffer_mask);
+            ssize seq = lake_atomic_read_explicit(sequence, lake_memory_model_acquire);
+            diff = (sptr)seq - (sptr)(pos + claim + pos_delta);
+            if (diff != 0) break;
+        }
+
+        if (claim > 0) {
+            if (lake_atomic_compare_exchange_weak_explicit(in_or_out, &pos, pos + claim,
+                    lake_memory_model_relaxed, lake_memory_model_relaxed))
+            {
+                *out_result = (lake_mpmc_result){ 
+                    .node = lake_elem(ring->buffer, stride, pos & ring->buffer_mask), 
+                    .pos = pos,
+                };
+                return claim;
+            }
+        } else if (diff < 0) {
+            /* it's empty */
+            *out_result = (lake_mpmc_result){ .node = nullptr, .pos = 0 };
+            return 0;
+        } else {
+            pos = lake_atomic_read_explicit(in_or_out, lake_memory_model_relaxed);
+        }
+    }
+    LAKE_UNREACHABLE;
+}
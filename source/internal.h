@@ -2,9 +2,14 @@
 
 #include <lake/bedrock.h>
 #include <lake/data_structures/mpmc_ring.h>
+#include <lake/math/bits.h>
 #include <lake/data_structures/strbuf.h>
 
 #define FIBER_INVALID (SIZE_MAX)
+/** Marks the end of the free fiber stack, or of a list of fibers waiting on a chain. */
+#define FREE_FIBER_END (UINT32_MAX)
+/** The chain has reached zero, a fiber can't be added to it's wait list anymore. */
+#define CHAIN_CLOSED (UINT32_MAX - 1)
 
 /** Thread-local storage. */
 struct tls;
@@ -40,7 +45,35 @@ struct work {
     lake_work_details       details;
     atomic_usize           *work_left;
 };
-typedef lake_mpmc_node_t(struct work) work_queue_node;
+
+/** Fibers that were waiting on a chain, and can now be resumed. */
+typedef lake_mpmc_node_t(u32) ready_fiber_node;
+
+/** Work submitted from threads that are not worker threads of the job system. */
+typedef lake_mpmc_node_t(struct work) foreign_work_node;
+
+/** An object released with `lake_dec_refcnt_deferred()`, waiting to be destroyed. */
+struct zero_refcnt {
+    PFN_lake_work           procedure;
+    void                   *self;
+};
+typedef lake_mpmc_node_t(struct zero_refcnt) zero_refcnt_node;
+
+/** A bounded work-stealing deque, as described by Chase and Lev, with memory ordering 
+ *  from the paper "Correct and Efficient Work-Stealing for Weak Memory Models" by Lê, 
+ *  Pop, Cohen and Zappa Nardelli. Every worker thread owns one deque, the owner pushes 
+ *  and pops work at the bottom (LIFO), while other workers steal from the top (FIFO).
+ *  The top and bottom indices are kept on separate cachelines to avoid false sharing. */
+struct LAKE_CACHELINE_ALIGNMENT work_deque {
+    atomic_ssize            top;
+    u8                  pad0[LAKE_CACHELINE_SIZE - sizeof(atomic_ssize)];
+
+    atomic_ssize            bottom;
+    u8                  pad1[LAKE_CACHELINE_SIZE - sizeof(atomic_ssize)];
+
+    struct work            *buffer;
+    ssize                   buffer_mask;
+};
 
 struct region {
     usize           v;
@@ -49,11 +82,42 @@ struct region {
     usize           alloc;
 };
 
+/** Size classes of the slab allocator, see `tagged_heap.c`. */
+#define SLAB_CLASS_COUNT 24
+/** Size of a slab, carved from a block of the heap and aligned to it's size. */
+#define SLAB_SIZE (64lu*1024lu)
+
+/** Objects of a size class, freed objects are reused before a slab is carved further. */
+struct slab_class {
+    lake_spinlock               lock;
+    /** A list of freed objects, linked through their first bytes. */
+    void                       *free;
+    /** The slab that objects are carved from. */
+    u8                         *cursor;
+    u8                         *end;
+};
+
 struct tagged_heap {
     LAKE_ATOMIC(lake_heap_tag)  tag;
-    lake_spinlock               spinlock;
+    /** Bumped whenever the heap is freed, blocks cached by worker threads become stale. */
+    atomic_u32                  generation;
+    /** Set on a freed slot of the tag table, lookups must probe past it. */
+    atomic_u32                  deleted;
+    /** The tag the high-water marks were measured for, they're kept if it's used again. */
+    lake_heap_tag               stats_tag;
+    /** Telemetry, see `lake_thstats_snapshot()`. The blocks are counted under the lock. */
+    atomic_u32                  blocks;
+    atomic_u32                  blocks_high_water;
+    atomic_u64                  requested;
+    atomic_u64                  requested_high_water;
+    atomic_u64                  allocations;
+    atomic_u64                  contentions;
+    /** Growing a heap may commit memory, contended allocations park instead of spinning. */
+    lake_fiber_mutex            lock;
     struct region               head;
     struct region              *tail;
+    /** Small objects freed individually, see `lake_thslab_alloc()`. */
+    struct slab_class           slabs[SLAB_CLASS_COUNT];
 };
 
 struct drifter_cursor {
@@ -68,10 +132,189 @@ struct drifter {
     struct drifter_cursor      *tail_cursor;
 };
 
+/** Events recorded by the job system tracer, see `work_trace.c`. */
+enum trace_event_type : u8 {
+    trace_event_work_begin = 0,     /**< A fiber starts running a job, arg is the fiber index. */
+    trace_event_work_end,           /**< A job returned, arg is the fiber index. */
+    trace_event_yield,              /**< A job waits on a chain, arg is the chain index. */
+    trace_event_resume,             /**< A job resumes after a wait, arg is the fiber index. */
+    trace_event_pop,                /**< Work was taken from our own deque, arg is the lane. */
+    trace_event_steal,              /**< Work was stolen, arg is the victim thread index. */
+    trace_event_chain_done,         /**< A chain reached zero, arg is the chain index. */
+};
+
+struct trace_event {
+    u64                         timestamp;
+    char const                 *name;
+    u32                         arg;
+    enum trace_event_type       type;
+};
+
+/** Capacity of the trace event ring of every worker thread, older events are overwritten. */
+#define TRACE_EVENT_COUNT (1u << 14)
+
+/** Time accounted to the job that a fiber runs, in RTC counter ticks. If the accounting 
+ *  was disabled when the job started, `begin` is 0 and the job is not accounted. */
+struct work_clock {
+    u64                         begin;
+    /** When the job was last resumed, or when it was suspended while it waits. */
+    u64                         mark;
+    u64                         cpu;
+    u64                         wait;
+};
+
+/** Time spent by the jobs of a single name on a worker thread. Only the owning thread adds 
+ *  to the counters, they are exchanged with zero when collected. */
+struct work_account {
+    /** Hash of the name, or 0 while the entry is unused. It's published after the name. */
+    atomic_u64                  hash;
+    char                        name[LAKE_WORK_ACCOUNT_NAME_SIZE];
+    atomic_u64                  count;
+    atomic_u64                  wall;
+    atomic_u64                  cpu;
+    atomic_u64                  wait;
+};
+
+/** Capacity of the accounting table of every worker thread, it's followed by one more entry 
+ *  for the jobs that didn't fit. */
+#define WORK_ACCOUNT_COUNT (1u << 8)
+
+/** Length of a tick of the timer wheel is 2^TIMER_TICK_SHIFT nanoseconds, about a millisecond. */
+#define TIMER_TICK_SHIFT 20
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1u << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+/** Four levels cover 2^24 ticks (about 4.9 hours), later deadlines wait in the last level. */
+#define TIMER_WHEEL_LEVELS 4
+/** Ends a list of timers, and marks a timer that is not linked into the wheel. */
+#define TIMER_NONE (UINT32_MAX)
+
+/** Delayed or periodic work, linked into a slot of the timer wheel or into the free list. */
+struct work_timer {
+    lake_work_details           details;
+    /** Both are in ticks of the timer wheel, the period is 0 for a one-shot timer. */
+    u64                         deadline;
+    u64                         period;
+    u32                         next;
+    u32                         prev;
+    /** The slot the timer is linked into, or TIMER_NONE while it's free. */
+    u32                         slot;
+    /** Bumped whenever the timer is released, so a stale handle can't cancel it's next use. */
+    u32                         generation;
+};
+
+/** A hierarchical timing wheel, as described by Varghese and Lauck in "Hashed and Hierarchical 
+ *  Timing Wheels". Level 0 has a slot for every tick, a slot of every next level spans a whole 
+ *  revolution of the level below it. Timers cascade down a level, once the level below wraps 
+ *  around to their slot. Workers advance the wheel between dequeues, see `work_timer.c`. */
+struct timer_wheel {
+    lake_spinlock               lock;
+    /** The last tick that was processed. */
+    u64                         now;
+    /** The RTC counter at which the wheel must be advanced, UINT64_MAX if there are no timers. */
+    atomic_u64                  next_due;
+    /** Index of the parked worker that sleeps only until `next_due` plus one, or 0 if none. 
+     *  Other parked workers sleep without a timeout. */
+    atomic_u32                  keeper;
+    u32                         free_head;
+    u32                         active_count;
+    u32                         timer_count;
+    u64                         rtc_frequency;
+    struct work_timer          *timers;
+    /** Heads of the timer lists, indexed by `level * TIMER_WHEEL_SLOTS + slot`. */
+    u32                         slots[TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS];
+};
+
+/** Adapts the number of active worker threads to the load, see `work_scaling.c`. Workers 
+ *  at or above the limit retire, they park until it grows again but keep their placement. */
+struct worker_scaling {
+    lake_spinlock               lock;
+    /** Workers with an index below the limit are active, worker 0 is always active. */
+    atomic_u32                  active_limit;
+    /** Retired workers park on this futex, it's bumped whenever the limit grows. */
+    atomic_u32                  epoch;
+    /** The RTC counter at which the load is measured again, UINT64_MAX while disabled. */
+    atomic_u64                  next_due;
+    /** Length of a measurement window, in RTC counter units. */
+    u64                         period;
+    /** When the current window started, and the idle time of all workers at that point. */
+    u64                         window_start;
+    u64                         window_idle;
+};
+
+/** The deterministic mode runs all work on worker 0, other workers stay retired. Whenever
+ *  the scheduler picks what to run next, it chooses one of the ready fibers and queued work
+ *  by a seeded generator, or by a decision replayed from an earlier run. */
+struct work_schedule {
+    /** Set once at startup, it's cleared only to shut down, while other workers may read it. */
+    atomic_u32                  deterministic;
+    /** State of the xorshift64* generator. */
+    u64                         rng;
+    /** Fibers taken from the ready ring, in the order they were made ready. */
+    u32                        *ready;
+    u32                         ready_count;
+    /** Decisions are written here while recording, the count goes on past the capacity. */
+    u32                        *record;
+    u32                         record_capacity;
+    u32                         record_count;
+    /** Decisions taken from here first, then from the generator. */
+    u32 const                  *replay;
+    u32                         replay_count;
+    u32                         replay_cursor;
+};
+
+/** How many free blocks a worker thread keeps for itself, see `tagged_heap.c`. */
+#define BLOCK_CACHE_COUNT 4
+/** How many tagged heaps a worker thread allocates from without taking their locks. */
+#define HEAP_CACHE_COUNT 4
+
+/** Free blocks owned by a worker thread, they're taken and returned without touching the bitmap. */
+struct block_cache {
+    u32                         count;
+    usize                       blocks[BLOCK_CACHE_COUNT];
+};
+
+/** A block of a tagged heap that a single worker thread allocates from linearly. The block
+ *  is already linked into the heap, it's released with the rest of the heap. */
+struct heap_cache {
+    struct tagged_heap         *heap;
+    lake_heap_tag               tag;
+    u32                         generation;
+    usize                       v;
+    usize                       offset;
+    /** Allocations from the block not yet added to the telemetry of the heap. */
+    u32                         pending_allocations;
+    usize                       pending_requested;
+};
+
 struct tls {
     fcontext                    home_context;
     u32                         fiber_in_use;
     u32                         fiber_old;
+    /** Xorshift state used to pick a victim to steal work from. */
+    u32                         steal_seed;
+    /** Counts work acquisitions, drives the starvation protection of priority lanes. */
+    u32                         lane_tick;
+    /** Set when the worker jumps to it's home context to retire, instead of to exit. */
+    bool                        retiring;
+    /** A ring of trace events, only this worker thread writes into it. */
+    struct trace_event         *trace_events;
+    atomic_u64                  trace_head;
+    /** Time spent by jobs on this worker thread, by name, see `work_account.c`. */
+    struct work_account        *accounts;
+    /** Time this worker spent parked without work, in RTC counter units. */
+    atomic_u64                  idle_ticks;
+    /** When this worker parked, 0 if it's not parked. */
+    atomic_u64                  idle_since;
+    /** The futex this worker parks on, non-zero while it's parked or about to park. 
+     *  Whoever wakes the worker clears it, so every parked worker is woken only once. */
+    atomic_u32                  parked;
+    /** The chain or wait list of the fiber this worker is switching out from, while it 
+     *  parks holding it. The fiber is not in the wait list yet, it can't be found there. */
+    atomic_usize                parked_holding;
+    /** Blocks of the tagged heap, kept to avoid contention on the bitmap and the heap locks. */
+    struct block_cache          block_cache;
+    struct heap_cache           heap_cache[HEAP_CACHE_COUNT];
 };
 
 struct logger {
@@ -82,40 +325,116 @@ struct logger {
     lake_spinlock               flush_lock;
 };
 
+/** A fiber parking on a wait list of a synchronization primitive. It lives on the stack 
+ *  of the parked fiber, so it stays valid until the fiber is resumed. */
+struct fiber_park {
+    lake_fiber_wait_list       *list;
+    /** Evaluated under the lock of the wait list. The fiber is parked only if it returns 
+     *  true, otherwise it's made ready to run right away. */
+    bool                      (*should_park)(void const *context);
+    void const                 *context;
+};
+
 struct fiber {
     struct work                 work;
     fcontext                    context;
     lake_work_chain             wait_counter;
+    /** Set instead of `wait_counter`, if the fiber is parking on a wait list. */
+    struct fiber_park          *park;
+    /** Index of the next fiber in the free stack, valid only while this fiber is free. */
+    atomic_u32                  free_next;
+    /** The stack size class, the fiber is returned into the free stack of this class. */
+    lake_fiber_stack            stack_class;
+    /** The top of the stack, it grows downwards. A guard page sits below it's bottom. */
+    u8                         *stack;
+    usize                       stack_size;
+    /** Index of the next fiber waiting on the same chain or wait list, valid only while waiting. */
+    u32                         wait_next;
+    struct work_clock           clock;
     struct drifter_cursor       cursor;
     struct drifter              drifter;
     struct logger               logger;
 };
 
+/** Every worker thread owns a deque for every priority lane. */
+#define WORK_LANE_COUNT lake_work_priority_count
+
 struct bedrock {
-    lake_mpmc_ring_t(work_queue_node) work_queue;
+    /** Indexed by `thread_idx * WORK_LANE_COUNT + priority`. */
+    struct work_deque          *deques;
     struct tls                 *tls;
     atomic_usize                tls_sync;
     lake_work_details          *ends;
     
-    /* TODO a hashmap to acquire worker thread index */
     sys_thread_id              *threads;
     struct fiber               *fibers;
-    atomic_usize               *waiting;
-    atomic_usize               *free;
+    /** Fibers waiting on a chain, the chain has reached zero and they can be resumed. */
+    lake_mpmc_ring_t(ready_fiber_node) ready;
+    /** Work submitted from foreign threads, workers move it into their own deques. */
+    lake_mpmc_ring_t(foreign_work_node) foreign;
+    /** Objects whose reference count has reached zero, they're destroyed in batches. */
+    lake_mpmc_ring_t(zero_refcnt_node) zero_refcnt;
+    /** How many objects were ever deferred, a batch is submitted every time it crosses it's size. */
+    atomic_u32                  zero_refcnt_deferred;
+    /** Objects taken from the ring, whose destructors did not return yet. */
+    atomic_u32                  zero_refcnt_running;
+    /** Fibers waiting for the running destructors, see `lake_zero_refcnt_flush()`. */
+    lake_fiber_wait_list        zero_refcnt_waiters;
+    /** A list of fibers waiting on a chain, indexed the same as `locks`. The head is either
+     *  the index of the last fiber to wait, FREE_FIBER_END if empty, or CHAIN_CLOSED. */
+    atomic_u32                 *waiters;
+    /** Top of the free fiber stack for every stack size class. The low 32 bits hold the fiber 
+     *  index, the high 32 bits a tag incremented on every modification, it prevents ABA. */
+    atomic_u64                  free_head[lake_fiber_stack_class_count];
     atomic_usize               *locks;
     s32                         thread_count;
     s32                         fiber_count;
+    /** Available CPUs, ordered the way worker threads are placed onto them. */
+    struct sys_cpu             *cpus;
+    u32                         cpu_count;
+    /** How many worker threads are parked or about to park. */
+    atomic_u32                  sleepers;
+    /** Non-zero while the job system tracer is recording. */
+    atomic_u32                  trace_enabled;
+    /** Events recorded before the tracer was last enabled are not dumped. */
+    atomic_u64                  trace_start;
+    /** Non-zero while the time spent by jobs is accounted. */
+    atomic_u32                  account_enabled;
+    /** Delayed and periodic work. */
+    struct timer_wheel          timers;
+    /** How many worker threads are active. */
+    struct worker_scaling       scaling;
+    /** The deterministic mode, for reproducible runs. */
+    struct work_schedule        schedule;
 
     atomic_u8                  *bitmap;
+    /** A bit for every byte of the bitmap, set if the byte may have a free block. A block 
+     *  search skips over a word of full bytes at once, see `tagged_heap.c`. */
+    atomic_u64                 *bitmap_summary;
+    /** A bit for every word of the summary, set if the word may have a bit set. */
+    atomic_u64                 *bitmap_summary_top;
+    /** A bit for every block, set if a free block has no physical memory. Blocks below the 
+     *  commitment are decommitted by `lake_thfree()` and `lake_thadvise()`, and committed 
+     *  again by whoever takes them from the bitmap. */
+    atomic_u8                  *decommitted;
+    /** Free blocks that may keep their physical memory, freed blocks beyond it are decommitted. */
+    u32                         resident_block_limit;
     atomic_usize                growth_sync;
 
     struct tagged_heap          roots;
-    struct tagged_heap        **tagged_heaps;
-    atomic_usize                tagged_heap_tail;
+    /** An open addressing table of heaps, indexed by a hash of the tag. It's at least twice 
+     *  as large as `tagged_heap_count`, the number of heaps that can be in use at once. */
+    struct tagged_heap         *tagged_heaps;
+    /** How many tags are in use, written under the lock. */
+    atomic_usize                tagged_heap_used;
     s32                         tagged_heap_count;
+    u32                         tagged_heap_mask;
+    /** Serializes insertion and removal of tags, lookups don't take it. */
+    lake_spinlock               tagged_heap_lock;
 
     u8                         *stack;
-    usize                       stack_size;
+    /** What backs the mapping, picked at initialization. */
+    lake_thpage_report          pages;
     usize                       budget;
     usize                       page_size;
     atomic_usize                commitment;
@@ -155,12 +474,35 @@ extern void LAKECALL acquire_heap_bitmap(atomic_u8 *bitmap, usize const offset,
 LAKE_HOT_FN LAKE_NONNULL_ALL
 extern void LAKECALL release_heap_bitmap(atomic_u8 *bitmap, usize const offset, usize const size);
 
-LAKE_HOT_FN LAKE_PURE_FN
+/** Marks a range of free blocks as decommitted, before they're released into the bitmap. */
+LAKE_NONNULL_ALL
+extern void LAKECALL decommit_heap_bitmap(atomic_u8 *bitmap, usize const offset, usize const size);
+
+/** Marks a range of blocks as backed by physical memory again. */
+LAKE_NONNULL_ALL
+extern void LAKECALL recommit_heap_bitmap(atomic_u8 *bitmap, usize const offset, usize const size);
+
+/** Blocks are taken from the bitmap, decommitted blocks among them are committed again. */
+LAKE_HOT_FN
 extern usize LAKECALL acquire_blocks(usize const block_aligned);
 
-/** Returns an index to a free fiber and grabs it's lock. */
-LAKE_HOT_FN LAKE_PURE_FN
-extern usize LAKECALL get_free_fiber(void);
+/** Same as `acquire_blocks()`, but a single block is taken from the cache of the worker thread. */
+LAKE_HOT_FN
+extern usize LAKECALL acquire_cached_blocks(usize const block_aligned);
+
+/** Returns a single block into the cache of the worker thread if there is room, 
+ *  otherwise the blocks are released into the bitmap. */
+LAKE_HOT_FN
+extern void LAKECALL release_cached_blocks(usize const offset, usize const size);
+
+/** Pops a free fiber with a stack of at least the requested size class, 
+ *  or returns FIBER_INVALID if there is none. */
+LAKE_HOT_FN
+extern usize LAKECALL get_free_fiber(lake_fiber_stack stack_class);
+
+LAKE_FORCE_INLINE
+struct work_deque *get_work_deque(u32 thread_idx, u32 priority)
+{ return &g_bedrock->deques[thread_idx * WORK_LANE_COUNT + priority]; }
 
 LAKE_FORCE_INLINE
 struct tls *get_thread_local_storage(void)
@@ -169,28 +511,173 @@ struct tls *get_thread_local_storage(void)
 LAKE_HOT_FN LAKE_NONNULL_ALL
 void LAKECALL flush_logger(struct logger *l);
 
+/** Writes an event into the trace ring of this worker thread, defined at `work_trace.c`. */
+LAKE_HOT_FN
+void LAKECALL record_trace_event(enum trace_event_type type, char const *name, u32 arg);
+
+/** Records a job system event, if the tracer is enabled. */
+LAKE_FORCE_INLINE void trace_work_event(enum trace_event_type type, char const *name, u32 arg)
+{
+    if (lake_likely(!lake_atomic_read_explicit(&g_bedrock->trace_enabled, lake_memory_model_relaxed))) return;
+    record_trace_event(type, name, arg);
+}
+
+/** Starts the clock of a job, if the accounting is enabled. */
+LAKE_FORCE_INLINE void account_work_begin(struct work_clock *clock)
+{
+    clock->begin = 0;
+    if (lake_likely(!lake_atomic_read_explicit(&g_bedrock->account_enabled, lake_memory_model_relaxed))) return;
+    clock->begin = clock->mark = lake_rtc_counter();
+    clock->cpu = clock->wait = 0;
+}
+
+/** The job stops running, it waits on a chain or a wait list. */
+LAKE_FORCE_INLINE void account_work_suspend(struct work_clock *clock)
+{
+    if (lake_likely(!clock->begin)) return;
+    u64 const now = lake_rtc_counter();
+    clock->cpu += now - clock->mark;
+    clock->mark = now;
+}
+
+/** The job runs again, after it was suspended. */
+LAKE_FORCE_INLINE void account_work_resume(struct work_clock *clock)
+{
+    if (lake_likely(!clock->begin)) return;
+    u64 const now = lake_rtc_counter();
+    clock->wait += now - clock->mark;
+    clock->mark = now;
+}
+
+/** Adds the time spent by a finished job to the table of this worker thread, defined at `work_account.c`. */
+extern void LAKECALL account_work_end(struct work_clock *clock, char const *name);
+
+/** Returns a fiber to the free stack, defined at `work.c`. */
+extern void LAKECALL release_free_fiber(u32 fiber_idx);
+
+/** Parks the calling fiber on the wait list, as long as `should_park` returns true. The 
+ *  condition is evaluated again under the lock of the wait list, after the fiber was 
+ *  switched out. Returns once the fiber was resumed, defined at `work.c`. */
+extern void LAKECALL park_fiber(lake_fiber_wait_list *list, bool (*should_park)(void const *), void const *context);
+
+/** Resumes up to `count` fibers parked on the wait list, defined at `work.c`. */
+extern void LAKECALL unpark_fibers(lake_fiber_wait_list *list, u32 count);
+
+/** Makes work available to the job system from the scheduler itself, it's pushed into the 
+ *  deque of this worker thread. Returns false if the deque is full, defined at `work.c`. */
+extern bool LAKECALL push_local_work(lake_work_details const *details);
+
+/** Wakes up to `count` parked worker threads, if there are any, defined at `work.c`. */
+extern void LAKECALL wake_idle_workers(u32 count);
+
+/** Wakes the worker if it's parked, returns false if it was not or someone else woke it. 
+ *  Defined at `work.c`. */
+extern bool LAKECALL wake_parked_worker(struct tls *tls);
+
+/** Prepares the timer wheel, the timers are carved from the roots, defined at `work_timer.c`. */
+extern void LAKECALL init_work_timers(struct work_timer *timers, u32 timer_count);
+
+/** Advances the timer wheel to the current time and submits the due work. Only one worker 
+ *  does it at a time, others return right away, defined at `work_timer.c`. */
+extern void LAKECALL advance_work_timers(void);
+
+/** True if all work is picked by the seeded scheduler, see `struct work_schedule`. */
+LAKE_FORCE_INLINE bool work_schedule_is_deterministic(void)
+{ return lake_atomic_read_explicit(&g_bedrock->schedule.deterministic, lake_memory_model_acquire) != 0; }
+
+/** Checks the timer wheel between dequeues, cheap unless some timer is due. */
+LAKE_FORCE_INLINE void poll_work_timers(void)
+{
+    u64 const due = lake_atomic_read_explicit(&g_bedrock->timers.next_due, lake_memory_model_relaxed);
+    if (lake_likely(due == UINT64_MAX) || lake_rtc_counter() < due) return;
+    advance_work_timers();
+}
+
+/** A parked worker keeps time for the timer wheel, if no other does. Returns true if the 
+ *  caller became the keeper, it must sleep for at most `out_timeout_ns` and then call 
+ *  `release_timer_keeper()`, defined at `work_timer.c`. */
+extern bool LAKECALL acquire_timer_keeper(u64 *out_timeout_ns);
+
+LAKE_FORCE_INLINE void release_timer_keeper(void)
+{ lake_atomic_write_explicit(&g_bedrock->timers.keeper, 0u, lake_memory_model_release); }
+
+/** Measures the load and retires or wakes up worker threads, the window must be over.
+ *  Only one worker does it at a time, others return right away, defined at `work_scaling.c`. */
+extern void LAKECALL adapt_active_workers(void);
+
+/** Checks if the load should be measured again, cheap while the scaling is disabled. */
+LAKE_FORCE_INLINE void poll_worker_scaling(void)
+{
+    u64 const due = lake_atomic_read_explicit(&g_bedrock->scaling.next_due, lake_memory_model_relaxed);
+    if (lake_likely(due == UINT64_MAX) || lake_rtc_counter() < due) return;
+    adapt_active_workers();
+}
+
+/** Parks a worker thread that is not active, until the active limit grows to include it.
+ *  Returns right away if it's active, defined at `work_scaling.c`. */
+extern void LAKECALL retire_worker(u32 thread_idx);
+
 /** Entry point for the worker threads, defined at `work.c`. */
 extern void *LAKECALL dirty_deeds_done_dirt_cheap(void *raw_tls);
 
-/** Map virtual memory space without physical memory commitment.
+/** Map virtual memory space without physical memory commitment. The start is aligned to
+ *  the huge page size, so huge pages can back the mapping from it's first byte.
  *  Before memory is used, must be commited with `sys_madvise()`. */
 extern void *LAKECALL sys_mmap(usize page_aligned, usize hugepage_size);
 
 /** Unmap virtual memory space and release physical resources. */
 extern void LAKECALL sys_munmap(void *mapped, usize size_page_aligned);
 
+enum sys_madvise_mode : s32 {
+    /** Release physical memory, the range can't be accessed until commited again. */
+    sys_madvise_mode_release = 0,
+    /** Commit physical memory for read and write access. */
+    sys_madvise_mode_commit,
+    /** Make the range inaccessible, any access will fault. Used for stack guard pages. */
+    sys_madvise_mode_guard,
+};
+
 /** Control state and commitment of physical resources. Offset and size must be page aligned. */
-extern bool LAKECALL sys_madvise(void *mapped, usize offset, usize size, bool commit_or_release);
+extern bool LAKECALL sys_madvise(void *mapped, usize offset, usize size, enum sys_madvise_mode mode);
+
+/** Picks the pages backing a range of the mapping, before any of it is committed. Offset and size
+ *  must be page aligned, and huge page aligned for hugetlbfs pages. If the policy can't be applied, the next smaller one is tried. 
+ *  Returns the policy that was applied. */
+extern lake_page_policy LAKECALL sys_mpolicy(void *mapped, usize offset, usize size, usize hugepage_size, lake_page_policy policy);
 
-/** Read system info about the CPU. */
+/** Read system info about the CPU. Threads are the logical CPUs we may run on, 
+ *  cores count physical cores and packages count the sockets. */
 extern void LAKECALL sys_cpuinfo(s32 *out_threads, s32 *out_cores, s32 *out_packages);
 
+/** Where a logical CPU sits in the machine topology. */
+struct sys_cpu {
+    /** Index of the logical CPU, as used for thread affinity. */
+    u32 id;
+    u32 package;
+    u32 numa_node;
+    /** The last level cache domain, CPUs with an equal value share an L3. */
+    u32 llc;
+    /** The physical core, unique within a package. */
+    u32 core;
+    /** Zero for the first hardware thread of a core, SMT siblings count up from there. */
+    u32 smt;
+};
+
+/** Read the topology of logical CPUs available to the process. If `out_cpus` is null,
+ *  returns the CPU count, otherwise writes up to `capacity` CPUs and returns how many. */
+extern u32 LAKECALL sys_cpu_topology(u32 capacity, struct sys_cpu *out_cpus);
+
 /** Read system info about RAM. */
 extern void LAKECALL sys_meminfo(usize *out_total_ram, usize *out_page_size);
 
-/** Read system info about support of huge pages. */
+/** Read system info about support of huge pages. Picks the largest huge page size up to
+ *  the ceiling, or zero if there are none. */
 extern void LAKECALL sys_hugetlbinfo(usize *out_hugepage_size, usize ceiling);
 
+/** Read how many hugetlbfs pages of the given size are free in the host's pool, 
+ *  and if transparent huge pages can be enabled with `sys_mpolicy()`. */
+extern void LAKECALL sys_hugepageinfo(usize hugepage_size, usize *out_hugetlb_free, bool *out_transparent);
+
 /** Dump the stack trace into an output string buffer. */
 extern void LAKECALL sys_dump_stack_trace(lake_strbuf *buf);
 
@@ -203,5 +690,14 @@ extern void LAKECALL sys_thread_destroy(sys_thread_id thread);
 /** Joins a thread. It will wait for the thread to finish it's work before continuing. */
 extern void LAKECALL sys_thread_join(sys_thread_id thread);
 
-/** Set thread affinity for an array of worker threads. */
-extern void LAKECALL sys_thread_affinity(u32 thread_count, sys_thread_id const *threads, u32 cpu_count, u32 begin_cpu_idx);
+/** Set thread affinity for an array of worker threads, thread `i` is pinned to `cpus[i].id`. 
+ *  Threads past `cpu_count` are left unpinned. */
+extern void LAKECALL sys_thread_affinity(u32 thread_count, sys_thread_id const *threads, struct sys_cpu const *cpus, u32 cpu_count);
+
+/** Puts the calling thread to sleep, as long as the value at address equals `expected`, for 
+ *  at most `timeout_ns` nanoseconds or without a timeout if it's UINT64_MAX. May return 
+ *  spuriously, the caller is expected to check it's condition in a loop. */
+extern void LAKECALL sys_futex_wait(atomic_u32 *address, u32 expected, u64 timeout_ns);
+
+/** Wakes up to `count` threads sleeping on the address. */
+extern void LAKECALL sys_futex_wake(atomic_u32 *address, u32 count);
@@ -1,3 +1,7 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "../internal.h"
 
 #ifdef LAKE_PLATFORM_LINUX
@@ -7,6 +11,120 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+
+/** Reads a small sysfs file into the buffer, returns false if it doesn't exist. */
+static bool read_sysfs(char const *path, char *buf, s32 size)
+{
+    s32 fd = open(path, O_RDONLY);
+    if (fd == -1) return false;
+    ssize len = read(fd, buf, size - 1);
+    close(fd);
+    if (len <= 0) return false;
+    buf[len] = '\0';
+    return true;
+}
+
+static u32 read_sysfs_u32(char const *path, u32 fallback)
+{
+    char buf[32];
+    if (!read_sysfs(path, buf, sizeof(buf))) return fallback;
+    return (u32)strtoul(buf, nullptr, 10);
+}
+
+/** Parses a cpu list like "0-3,8-11", returns the first CPU in it and how many CPUs precede `cpu`. */
+static u32 parse_cpu_list(char const *list, u32 cpu, u32 *out_below)
+{
+    u32 first = UINT32_MAX, below = 0;
+    char *end;
+
+    while (*list >= '0' && *list <= '9') {
+        u32 lo = (u32)strtoul(list, &end, 10);
+        u32 hi = lo;
+        if (*end == '-') hi = (u32)strtoul(end + 1, &end, 10);
+        if (first == UINT32_MAX) first = lo;
+        if (lo < cpu) below += lake_min(hi + 1, cpu) - lo;
+        list = (*end == ',') ? end + 1 : end;
+    }
+    if (out_below) *out_below = below;
+    return first;
+}
+
+/** The NUMA node is only exposed as a `nodeN` link in the cpu directory. */
+static u32 read_numa_node(u32 cpu)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u", cpu);
+
+    DIR *dir = opendir(path);
+    if (!dir) return 0;
+    struct dirent *entry;
+    u32 node = 0;
+    while ((entry = readdir(dir))) {
+        char const *name = entry->d_name;
+        if (!lake_strncmp(name, "node", 4) && name[4] >= '0' && name[4] <= '9') {
+            node = (u32)strtoul(name + 4, nullptr, 10);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+/** CPUs we may run on, read once from sysfs. Capped at CPU_SETSIZE, as we can't pin beyond that anyway. */
+static struct sys_cpu g_cpus[CPU_SETSIZE];
+static u32 g_cpu_count = 0;
+
+static void read_cpu_topology(void)
+{
+    cpu_set_t allowed;
+    bool const has_mask = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+    s32 const configured = lake_min((s32)sysconf(_SC_NPROCESSORS_CONF), CPU_SETSIZE);
+    char path[128];
+    char list[256];
+
+    for (s32 i = 0; i < configured; i++) {
+        u32 const cpu = (u32)i;
+        if (has_mask && !CPU_ISSET(cpu, &allowed))
+            continue;
+        /* cpu0 usually has no `online` file, as it can't be taken offline */
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/online", cpu);
+        if (!read_sysfs_u32(path, 1u))
+            continue;
+
+        struct sys_cpu *c = &g_cpus[g_cpu_count++];
+        c->id = cpu;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/topology/physical_package_id", cpu);
+        c->package = read_sysfs_u32(path, 0u);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/topology/core_id", cpu);
+        c->core = read_sysfs_u32(path, cpu);
+        c->numa_node = read_numa_node(cpu);
+
+        c->smt = 0;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/topology/thread_siblings_list", cpu);
+        if (read_sysfs(path, list, sizeof(list)))
+            parse_cpu_list(list, cpu, &c->smt);
+
+        /* the last level cache domain is named after the first CPU sharing it, usually index3 is the L3 */
+        c->llc = UINT32_MAX;
+        for (s32 index = 3; index >= 2 && c->llc == UINT32_MAX; index--) {
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/cache/index%d/shared_cpu_list", cpu, index);
+            if (read_sysfs(path, list, sizeof(list)))
+                c->llc = parse_cpu_list(list, cpu, nullptr);
+        }
+        if (c->llc == UINT32_MAX)
+            c->llc = c->package;
+    }
+
+    if (g_cpu_count == 0) {
+        lake_error("Failed reading the CPU topology from sysfs.");
+        s32 const online = lake_clamp((s32)sysconf(_SC_NPROCESSORS_ONLN), 1, CPU_SETSIZE);
+        for (s32 i = 0; i < online; i++)
+            g_cpus[g_cpu_count++] = (struct sys_cpu){ .id = (u32)i, .core = (u32)i };
+    }
+}
 
 void sys_cpuinfo(s32 *out_threads, s32 *out_cores, s32 *out_packages)
 {
@@ -14,70 +132,38 @@ void sys_cpuinfo(s32 *out_threads, s32 *out_cores, s32 *out_packages)
 
     if (packages != 0)
         goto output;
-    threads = 1; cores = 1; packages = 1;
-
-    s32 fd, len, pos, end;
-    char buf[4096];
-    char num[100];
-    s32 numsize = sizeof(num);
-    char const *err = "Failed parsing /proc/cpuinfo.";
-
-    fd = open("/proc/cpuinfo", O_RDONLY);
-    if (fd != -1) {
-        len = read(fd, buf, 4096);
-        close(fd);
-        pos = 0;
-        while (pos < len) {
-            if (!lake_strncmp(buf + pos, "cpu cores", 9)) {
-                pos = lake_strchr(buf + pos, ':') - buf + 2;
-                end = lake_strchr(buf + pos, '\n') - buf;
-
-                if (pos < len && end < len) {
-                    lake_strncpy(num, buf + pos, numsize);
-
-                    num[numsize - 1] = 0; /* [-Wstringop-truncation] */
-                    lake_assert((end - pos) > 0 && (end - pos) < numsize, LAKE_ERROR_OUT_OF_RANGE, "CPU num buffer too small.");
-                    num[end - pos] = '\0'; /* because the compiler keeps fucking screaming */
-
-                    s32 processor = atoi(num);
-                    if ((processor) > cores)
-                        cores = processor;
-                } else {
-                    lake_error("%s", err);
-                    break;
-                }
-            } else if (!lake_strncmp(buf + pos, "siblings", 8)) {
-                pos = lake_strchr(buf + pos, ':') - buf + 2;
-                end = lake_strchr(buf + pos, '\n') - buf;
-
-                if (pos < len && end < len) {
-                    lake_strncpy(num, buf + pos, numsize);
-
-                    num[numsize - 1] = 0; /* [-Wstringop-truncation] */
-                    lake_assert((end - pos) > 0 && (end - pos) < numsize, LAKE_ERROR_OUT_OF_RANGE, "CPU num buffer too small.");
-                    num[end - pos] = '\0'; /* ... */
-
-                    s32 core_id = atoi(num);
-                    if ((core_id) > threads)
-                        threads = core_id;
-                } else {
-                    lake_error("%s", err);
-                    break;
-                }
-            }
-            pos = lake_strchr(buf + pos, '\n') - buf + 1;
-        }
-    } else {
-        lake_error("%s", err);
-        cores = sysconf(_SC_NPROCESSORS_CONF);
-        threads = 2 * cores;
+    if (g_cpu_count == 0)
+        read_cpu_topology();
+
+    threads = (s32)g_cpu_count; cores = 0; packages = 0;
+    for (u32 i = 0; i < g_cpu_count; i++) {
+        struct sys_cpu const *c = &g_cpus[i];
+        if (c->smt == 0) cores++;
+
+        bool seen = false;
+        for (u32 j = 0; j < i && !seen; j++)
+            seen = g_cpus[j].package == c->package;
+        if (!seen) packages++;
     }
+    cores = lake_max(cores, 1);
 output:
     if (out_threads)  *out_threads = threads;
     if (out_cores)    *out_cores = cores;
     if (out_packages) *out_packages = packages;
 }
 
+u32 sys_cpu_topology(u32 capacity, struct sys_cpu *out_cpus)
+{
+    if (g_cpu_count == 0)
+        read_cpu_topology();
+    if (out_cpus == nullptr)
+        return g_cpu_count;
+
+    u32 const count = lake_min(capacity, g_cpu_count);
+    lake_memcpy(out_cpus, g_cpus, sizeof(struct sys_cpu) * count);
+    return count;
+}
+
 void sys_meminfo(usize *out_total_ram, usize *out_page_size)
 {
     ssize page, bytes;
@@ -96,7 +182,7 @@ void sys_hugetlbinfo(usize *out_hugepage_size, usize ceiling)
 {
     DIR *dir;
     struct dirent *entry;
-    usize count, bytes = -1;
+    usize count, bytes = 0;
     usize ceiling_kb = ceiling >> 10;
 
     if (out_hugepage_size == nullptr)
@@ -114,8 +200,8 @@ void sys_hugetlbinfo(usize *out_hugepage_size, usize ceiling)
 
             count = strtol(name, &end, 10);
             if (*end == 'k' && *(end + 1) == 'B') {
-                /* We will accept huge pages of up to max_target_hugepagesize. */
-                if (count <= ceiling_kb) {
+                /* We will accept the largest huge pages of up to max_target_hugepagesize. */
+                if (count <= ceiling_kb && (count << 10) > bytes) {
                     bytes = count << 10;
                 }
             }
@@ -125,6 +211,23 @@ void sys_hugetlbinfo(usize *out_hugepage_size, usize ceiling)
     *out_hugepage_size = bytes;
 }
 
+void sys_hugepageinfo(usize hugepage_size, usize *out_hugetlb_free, bool *out_transparent)
+{
+    char path[96], buf[64];
+
+    if (out_hugetlb_free) {
+        snprintf(path, sizeof(path), "/sys/kernel/mm/hugepages/hugepages-%lukB/free_hugepages", hugepage_size >> 10);
+        *out_hugetlb_free = hugepage_size ? read_sysfs_u32(path, 0) : 0;
+    }
+    if (out_transparent) {
+        /* the mode in use is in brackets, e.g. "always [madvise] never" */
+        char const *mode = nullptr;
+        if (read_sysfs("/sys/kernel/mm/transparent_hugepage/enabled", buf, sizeof(buf)))
+            for (mode = buf; *mode && *mode != '['; mode++);
+        *out_transparent = mode && *mode == '[' && lake_strncmp(mode, "[never]", 7) != 0;
+    }
+}
+
 #ifdef LAKE_HAS_EXECINFO
 #include <execinfo.h>
 #define STACK_TRACE_BUF_SIZE 100
@@ -1,8 +1,64 @@
 #include "internal.h"
 #include <lake/math/bits.h>
 
+/** A byte of the bitmap has free blocks again. The byte is written before the summary, 
+ *  so a search may miss it only until we return. */
+static void summarize_free_byte(usize const index)
+{
+    atomic_u64 *word = &g_bedrock->bitmap_summary[index >> 6];
+    u64 const prev = lake_atomic_or_explicit(word, 1lu << (index & 63), lake_memory_model_seq_cst);
+    if (prev == 0)
+        lake_atomic_or_explicit(&g_bedrock->bitmap_summary_top[index >> 12], 1lu << ((index >> 6) & 63), lake_memory_model_seq_cst);
+}
+
+/** The last free block of a byte was taken. A block of it may be released concurrently, 
+ *  so after clearing a summary bit we look again, and set it back if we raced. */
+static void summarize_full_byte(atomic_u8 *bitmap, usize const index)
+{
+    atomic_u64 *word = &g_bedrock->bitmap_summary[index >> 6];
+    u64 const bit = 1lu << (index & 63);
+    u64 const prev = lake_atomic_and_explicit(word, ~bit, lake_memory_model_seq_cst);
+
+    if (lake_atomic_read_explicit(&bitmap[index], lake_memory_model_seq_cst) != 0) {
+        summarize_free_byte(index);
+    } else if ((prev & ~bit) == 0) {
+        atomic_u64 *top = &g_bedrock->bitmap_summary_top[index >> 12];
+        u64 const top_bit = 1lu << ((index >> 6) & 63);
+        lake_atomic_and_explicit(top, ~top_bit, lake_memory_model_seq_cst);
+        if (lake_atomic_read_explicit(word, lake_memory_model_seq_cst) != 0)
+            lake_atomic_or_explicit(top, top_bit, lake_memory_model_seq_cst);
+    }
+}
+
+/** Returns the index of the first byte in [index, end) that may have a free block, or `end`.
+ *  Full words of the summary are skipped with the top level, 4096 bytes at a time. */
+LAKE_HOT_FN
+static usize next_free_byte(usize index, usize const end)
+{
+    atomic_u64 const *summary = g_bedrock->bitmap_summary;
+    atomic_u64 const *top = g_bedrock->bitmap_summary_top;
+
+    while (index < end) {
+        usize const w = index >> 6;
+        u64 const bits = lake_atomic_read_explicit(&summary[w], lake_memory_model_acquire) & (~0lu << (index & 63));
+        if (bits) return lake_min((w << 6) + (usize)lake_ctz_u64(bits), end);
+
+        /* find the next word of the summary that has any bit set */
+        if (((w + 1) << 6) >= end) return end;
+        usize t = (w + 1) >> 6;
+        u64 top_bits = lake_atomic_read_explicit(&top[t], lake_memory_model_acquire) & (~0lu << ((w + 1) & 63));
+        while (!top_bits) {
+            if (((++t) << 12) >= end) return end;
+            top_bits = lake_atomic_read_explicit(&top[t], lake_memory_model_acquire);
+        }
+        index = ((t << 6) + (usize)lake_ctz_u64(top_bits)) << 6;
+    }
+    return end;
+}
+
 /** We use a bitmap to represent our blocks of free memory. One bit in the bitmap 
- *  is one block of LAKE_TAGGED_HEAP_BLOCK_SIZE, with one byte we represent 8 blocks. */
+ *  is one block of LAKE_TAGGED_HEAP_BLOCK_SIZE, with one byte we represent 8 blocks. 
+ *  The summary bitmaps are updated after the bytes, see `next_free_byte()`. */
 #define IMPL_HEAP_BITMAP_TEMPLATE(FUNC, OPERATION)                                  \
     LAKE_HOT_FN LAKE_NONNULL_ALL                                                    \
     void LAKECALL FUNC##_heap_bitmap(                                               \
@@ -11,74 +67,215 @@
         usize const size)                                                           \
 {                                                                                   \
     if (size == 0) return;                                                          \
-    usize const position   = __position_from_block(offset);                         \
-    usize const head_index = __index_from_position(position);                       \
-    usize const count      = 1 + __index_from_page(size);                           \
-    usize const tail_index = head_index + count - 1;                                \
+    usize const head = __position_from_block(offset);                               \
+    usize const tail = head + __position_from_block(                                \
+            lake_align(size, LAKE_TAGGED_HEAP_BLOCK_SIZE)) - 1;                     \
+    usize const head_index = __index_from_position(head);                           \
+    usize const tail_index = __index_from_position(tail);                           \
                                                                                     \
-    u8 bitmask = ~((1 << (position & 0x07)) - 1);                                   \
-    for (usize i = 0; i < count; i++) {                                             \
-        usize index = head_index + i;                                               \
-                                                                                    \
-        /* XOR'ing the bitmask will leave blocks beyond the range untouched */      \
+    for (usize index = head_index; index <= tail_index; index++) {                  \
+        /* blocks beyond the range in the edge bytes are left untouched */          \
+        u8 bitmask = 0xFF;                                                          \
+        if (index == head_index)                                                    \
+            bitmask &= (u8)(0xFF << (head & 0x07));                                 \
         if (index == tail_index)                                                    \
-            bitmask ^= ~((1 << ((position + count) & 0x07)) - 1);                   \
+            bitmask &= (u8)(0xFF >> (0x07 - (tail & 0x07)));                        \
                                                                                     \
         /* set the blocks as in use (bits set to 0) or as free (bits set to 1) */   \
         OPERATION;                                                                  \
-        bitmask = 0xFF;                                                             \
     }                                                                               \
 }
 /** Sets a range of blocks in the heap as in use. */
-IMPL_HEAP_BITMAP_TEMPLATE(acquire, lake_atomic_and_explicit(&bitmap[index], ~bitmask, lake_memory_model_acquire))
+IMPL_HEAP_BITMAP_TEMPLATE(acquire, 
+    u8 const prev = lake_atomic_and_explicit(&bitmap[index], ~bitmask, lake_memory_model_seq_cst);
+    if (prev != 0 && (prev & ~bitmask) == 0) summarize_full_byte(bitmap, index))
 
 /** Sets a range of blocks in the heap as free to take. */
-IMPL_HEAP_BITMAP_TEMPLATE(release, lake_atomic_or_explicit(&bitmap[index], bitmask, lake_memory_model_release))
+IMPL_HEAP_BITMAP_TEMPLATE(release, 
+    u8 const prev = lake_atomic_or_explicit(&bitmap[index], bitmask, lake_memory_model_seq_cst);
+    if (prev == 0) summarize_free_byte(index))
+
+/** Sets a range of free blocks as decommitted, the bits are set before the blocks are released. */
+IMPL_HEAP_BITMAP_TEMPLATE(decommit, 
+    lake_atomic_or_explicit(&bitmap[index], bitmask, lake_memory_model_seq_cst))
+
+/** Sets a range of blocks as backed by physical memory. */
+IMPL_HEAP_BITMAP_TEMPLATE(recommit, 
+    lake_atomic_and_explicit(&bitmap[index], ~bitmask, lake_memory_model_seq_cst))
+
+/** Commits physical memory for decommitted blocks among the ones we just took from the bitmap, 
+ *  with one call for every contiguous run. We own the blocks, no one else changes their bits. */
+static bool recommit_blocks(usize const offset, usize const size)
+{
+    atomic_u8 *decommitted = g_bedrock->decommitted;
+    usize const head = __position_from_block(offset);
+    usize const tail = head + __position_from_block(size);
+    usize run = tail;
+
+    for (usize bits = head; bits <= tail; bits++) {
+        bool const taken = bits < tail && (lake_atomic_read_explicit(&decommitted[__index_from_position(bits)], 
+                lake_memory_model_acquire) & (1u << (bits & 0x07)));
+        if (taken) {
+            if (run == tail) run = bits;
+            continue;
+        }
+        if (run == tail) continue;
+
+        usize const run_offset = __block_from_position(run);
+        usize const run_size = __block_from_position((bits - run));
+        if (!sys_madvise((void *)g_bedrock, run_offset, run_size, sys_madvise_mode_commit))
+            return false;
+        recommit_heap_bitmap(decommitted, run_offset, run_size);
+        run = tail;
+    }
+    return true;
+}
+
+/** Blocks taken from the bitmap are handed out committed, or given back if we can't commit them. */
+static usize commit_acquired_blocks(usize const offset, usize const size)
+{
+    if (offset == 0lu || recommit_blocks(offset, size))
+        return offset;
+    lake_error("Can't commit decommitted resources again: out of host memory.");
+    release_heap_bitmap(g_bedrock->bitmap, offset, size);
+    return 0lu;
+}
+
+/** Releases physical memory of a run of blocks we own, and gives them back to the bitmap. */
+static usize decommit_owned_blocks(usize const offset, usize const size)
+{
+    if (size == 0) return 0lu;
+
+    bool const released = sys_madvise((void *)g_bedrock, offset, size, sys_madvise_mode_release);
+    if (released)
+        decommit_heap_bitmap(g_bedrock->decommitted, offset, size);
+    release_heap_bitmap(g_bedrock->bitmap, offset, size);
+    return released ? size : 0lu;
+}
+
+/** Free blocks within [offset, ceiling) that keep their physical memory. 
+ *  It's only an estimate, the bitmap may change while we count. */
+static usize count_resident_free_blocks(usize const offset, usize const ceiling)
+{
+    if (offset >= ceiling) return 0lu;
+
+    atomic_u8 *bitmap = g_bedrock->bitmap;
+    atomic_u8 *decommitted = g_bedrock->decommitted;
+    usize const head = __position_from_block(offset);
+    usize const end = __position_from_block(ceiling);
+    usize const end_index = __index_from_position((end - 1)) + 1;
+    usize count = 0;
+
+    for (usize index = next_free_byte(__index_from_position(head), end_index); index < end_index; 
+            index = next_free_byte(index + 1, end_index)) 
+    {
+        u32 byte = lake_atomic_read_explicit(&bitmap[index], lake_memory_model_relaxed)
+                & ~lake_atomic_read_explicit(&decommitted[index], lake_memory_model_relaxed);
+        if (index == __index_from_position(head))
+            byte &= 0xFFu << (head & 0x07);
+        if (index == end_index - 1 && (end & 0x07))
+            byte &= 0xFFu >> (8 - (end & 0x07));
+        count += lake_popcnt_u32(byte);
+    }
+    return count;
+}
+
+/** Decommits up to `budget` bytes of free blocks from [offset, ceiling), claimed from the 
+ *  bitmap one by one so no one takes them meanwhile. Claimed blocks that follow each other 
+ *  are released with a single call. Returns how many bytes were decommitted. */
+static usize decommit_free_blocks(usize const offset, usize const ceiling, usize const budget)
+{
+    if (offset >= ceiling) return 0lu;
+
+    atomic_u8 *bitmap = g_bedrock->bitmap;
+    atomic_u8 *decommitted = g_bedrock->decommitted;
+    usize const head = __position_from_block(offset);
+    usize const end = __position_from_block(ceiling);
+    usize const end_index = __index_from_position((end - 1)) + 1;
+    usize const wanted = __position_from_block(lake_align(budget, LAKE_TAGGED_HEAP_BLOCK_SIZE));
+    usize released = 0, run = 0, run_end = 0;
+
+    for (usize index = next_free_byte(__index_from_position(head), end_index); index < end_index; 
+            index = next_free_byte(index + 1, end_index)) 
+    {
+        u32 candidates = lake_atomic_read_explicit(&bitmap[index], lake_memory_model_relaxed)
+                & ~lake_atomic_read_explicit(&decommitted[index], lake_memory_model_relaxed);
+        if (index == __index_from_position(head))
+            candidates &= 0xFFu << (head & 0x07);
+        if (index == end_index - 1 && (end & 0x07))
+            candidates &= 0xFFu >> (8 - (end & 0x07));
+
+        for (; candidates != 0; candidates &= candidates - 1) {
+            if (released + (run_end - run) >= wanted) break;
+            usize const bits = __position_from_index(index) + (usize)lake_ctz(candidates);
+            u8 const bitmask = (1u << (bits & 0x07));
+            u8 const prev = lake_atomic_and_explicit(&bitmap[index], ~bitmask, lake_memory_model_seq_cst);
+
+            /* it was taken meanwhile */
+            if ((prev & bitmask) == 0) continue;
+            if ((prev & ~bitmask) == 0) summarize_full_byte(bitmap, index);
+
+            if (bits != run_end) {
+                released += __position_from_block(decommit_owned_blocks(
+                            __block_from_position(run), __block_from_position((run_end - run))));
+                run = bits;
+            }
+            run_end = bits + 1;
+        }
+        if (released + (run_end - run) >= wanted) break;
+    }
+    released += __position_from_block(decommit_owned_blocks(
+                __block_from_position(run), __block_from_position((run_end - run))));
+    return __block_from_position(released);
+}
 
 /** A single block allocation (LAKE_TAGGED_HEAP_BLOCK_SIZE). We don't own the growth 
  *  sync here and NEVER wait on it, instead the sync value is passed in as the ceiling 
  *  for bitmap query. If a free block is found, we commit it to the bitmap immediately. */
-LAKE_HOT_FN LAKE_PURE_FN
+LAKE_HOT_FN
 static usize LAKECALL find_free_block(usize const offset, usize const ceiling)
 {
     if (offset >= ceiling) return 0lu;
 
     atomic_u8 *bitmap = g_bedrock->bitmap;
-    usize const index = __index_from_page(offset);
-    usize const range = 1 + __index_from_page(ceiling) - index;
+    usize const end = __position_from_block(ceiling);
+    usize const end_index = __index_from_position((end - 1)) + 1;
+    usize index = __index_from_page(offset);
 
     /* try until we either succeed or hit the ceiling */
     for (;;) {
-        usize bits = lake_ffsbit((u8 const *)&bitmap[index], range);
-
-        /* `lake_ffsbit()` returns a 1-based value, or 0 if no bits are set.
-         * This is also why later we must decrement the bits value. */
-        if (!bits) return 0lu;
-
-        /* The `__position_from_index` will align the value of `pos`
-         * to a byte boundary (index is: `pos >> 3lu`). */
-        bits += __position_from_index(index) - 1; /* decrement to get a 0-based value */
+        index = next_free_byte(index, end_index);
+        if (index >= end_index) return 0lu;
 
-        /* we may have overshot on edging (!! holy moly) bytes */
-        if (lake_unlikely(bits >= __position_from_block(ceiling)))
+        u8 const byte = lake_atomic_read_explicit(&bitmap[index], lake_memory_model_relaxed);
+        if (byte == 0) {
+            /* the summary is only a hint, the byte was taken meanwhile */
+            index++;
+            continue;
+        }
+        usize const bits = __position_from_index(index) + (usize)lake_ctz(byte);
+        if (lake_unlikely(bits >= end))
             return 0lu;
 
         /* try to acquire the block */
         u8 const bitmask = (1u << (bits & 0x07));
-        u8 const prev = lake_atomic_and_explicit(&bitmap[__index_from_position(bits)], ~bitmask, lake_memory_model_acquire);
+        u8 const prev = lake_atomic_and_explicit(&bitmap[index], ~bitmask, lake_memory_model_seq_cst);
 
-        /* Double check to avoid any possibility of data races. If this is true, 
+        /* Double check to avoid any possibility of data races. If this is false, 
          * then the bitmask wrote to a block already in use. Nothing changed, 
          * and we can't claim this block for ourselves. */
-        if ((prev & bitmask) == bitmask) 
+        if ((prev & bitmask) == bitmask) {
+            if ((prev & ~bitmask) == 0) summarize_full_byte(bitmap, index);
             return __block_from_position(bits);
+        }
     }
     LAKE_UNREACHABLE;
 }
 
 /** Tries to find a range of contiguous memory blocks to fulfill a larger request.
- *  If this function was called, it's assumed we own the sync counter. */
-LAKE_HOT_FN LAKE_PURE_FN LAKE_NONNULL_ALL
+ *  If this function was called, it's assumed we own the sync counter. Regions of full 
+ *  bytes are skipped with the summary bitmaps. */
+LAKE_HOT_FN LAKE_NONNULL_ALL
 static usize LAKECALL find_free_blocks_range(
         usize const   offset,
         usize const   request, 
@@ -87,57 +284,57 @@ static usize LAKECALL find_free_blocks_range(
 {
     atomic_u8 const *bitmap = g_bedrock->bitmap; /* we won't write to it here */
     usize const blocks = __position_from_block(request);
-    usize const head_index = __index_from_page(offset);
-    usize const tail_index = __index_from_page(ceiling);
+    usize const head = __position_from_block(offset);
+    usize const end = __position_from_block(ceiling);
 
     /* early checks to invalidate the request */
-    if (head_index > tail_index || !blocks || blocks < __position_from_block((ceiling - offset)))
+    if (!blocks || head >= end || blocks > end - head)
         return 0lu;
 
+    usize const end_index = __index_from_position((end - 1)) + 1;
     usize candidate = 0lu;
     usize current = 0lu;
 
     /* query the bitmap */
-    for (usize i = head_index; i <= tail_index; i++) {
+    for (usize pos = head; pos < end;) {
+        usize const index = __index_from_position(pos);
         /* a byte represents a range of 8 blocks */
-        u8 const byte = lake_atomic_read(&bitmap[i]);
+        u8 const byte = lake_atomic_read(&bitmap[index]);
 
-        /* a full free byte is convenient */
-        if (byte == 0xff) {
+        if (byte == 0) {
+            /* currently queried free memory range does not satisfy our request */
+            lake_atomic_write(sync, __page_from_index(index));
+            current = 0lu;
+            pos = __position_from_index(next_free_byte(index + 1, end_index));
+            continue;
+        }
+        if (byte == 0xff && (pos & 0x07) == 0) {
+            /* a full free byte is convenient */
             if (current == 0lu)
-                candidate = __position_from_index(i);
+                candidate = pos;
             current += 8;
-            if (current >= blocks) return __block_from_position(candidate);
-        } else if (byte != 0) {
-            u8 bitmask = 0xff;
-            usize bit = 0;
-
+            pos += 8;
+        } else {
             /* check individual blocks */
-            while (bitmask && bit < 8) {
-                if (byte & bitmask) {
-                    if (current == 0lu)
-                        candidate = __position_from_index(i) + bit;
-                    current++;
-                    bitmask >>= 1;
-                    bit++;
-                } else {
-                    lake_atomic_write(sync, __block_from_position(__position_from_index(i)));
-                    current = 0lu;
-                    bitmask = 0lu;
-                }
-                if (current >= blocks) return __block_from_position(candidate);
+            if (byte & (1u << (pos & 0x07))) {
+                if (current == 0lu)
+                    candidate = pos;
+                current++;
+            } else {
+                lake_atomic_write(sync, __block_from_position(pos));
+                current = 0lu;
             }
-        } else {
-            /* currently queried free memory range does not satisfy our request */
-            lake_atomic_write(sync, __page_from_index(i));
-            current = 0lu;
+            pos++;
         }
+        if (current >= blocks)
+            return candidate + blocks <= end ? __block_from_position(candidate) : 0lu;
     }
     /* either out of host memory or the memory is fragmented... */
     return 0lu;
 }
 
-usize acquire_blocks(usize const block_aligned)
+/** Takes blocks from the bitmap, or commits new resources past the commitment. */
+static usize claim_blocks(usize const block_aligned)
 {
     usize const roots_end = g_bedrock->roots.head.alloc;
     usize commitment = lake_atomic_read(&g_bedrock->commitment);
@@ -187,12 +384,12 @@ usize acquire_blocks(usize const block_aligned)
 
         /* we must commit memory for new resources */
         if (lake_unlikely(new_ceiling + commitment > g_bedrock->budget || 
-            !sys_madvise((void *)g_bedrock, commitment, new_ceiling, true)))
+            !sys_madvise((void *)g_bedrock, commitment, new_ceiling, sys_madvise_mode_commit)))
         {
             /* try one last time... */
             new_ceiling = LAKE_TAGGED_HEAP_BLOCK_SIZE - (commitment - offset);
             if (lake_unlikely(new_ceiling + commitment > g_bedrock->budget || 
-                !sys_madvise((void *)g_bedrock, commitment, new_ceiling, true))) 
+                !sys_madvise((void *)g_bedrock, commitment, new_ceiling, sys_madvise_mode_commit))) 
             {
                 lake_error("Can't commit new resources allocation: %s.", 
                         (new_ceiling + commitment > g_bedrock->budget)
@@ -209,6 +406,85 @@ usize acquire_blocks(usize const block_aligned)
     LAKE_UNREACHABLE;
 }
 
+usize acquire_blocks(usize const block_aligned)
+{
+    return commit_acquired_blocks(claim_blocks(block_aligned), block_aligned);
+}
+
+/** How many blocks are taken from the bitmap at once, when the block cache is empty. */
+#define BLOCK_CACHE_REFILL (BLOCK_CACHE_COUNT / 2)
+
+usize acquire_cached_blocks(usize const block_aligned)
+{
+    if (block_aligned != LAKE_TAGGED_HEAP_BLOCK_SIZE || !lake_is_worker_thread())
+        return acquire_blocks(block_aligned);
+
+    /* nothing here yields, we stay on this worker thread */
+    struct block_cache *cache = &get_thread_local_storage()->block_cache;
+    if (cache->count == 0) {
+        /* take a few free blocks at once, without owning the growth sync */
+        usize const roots_end = g_bedrock->roots.head.alloc;
+        usize const commitment = lake_atomic_read_explicit(&g_bedrock->commitment, lake_memory_model_acquire);
+        usize const sync_value = lake_atomic_read_explicit(&g_bedrock->growth_sync, lake_memory_model_acquire);
+        usize const ceiling = sync_value ? lake_min(sync_value, commitment) : commitment;
+
+        while (cache->count < BLOCK_CACHE_REFILL) {
+            usize const offset = commit_acquired_blocks(find_free_block(roots_end, ceiling), block_aligned);
+            if (!offset) break;
+            cache->blocks[cache->count++] = offset;
+        }
+        /* no free blocks were committed, grow */
+        if (cache->count == 0)
+            return acquire_blocks(block_aligned);
+    }
+    return cache->blocks[--cache->count];
+}
+
+void release_cached_blocks(usize const offset, usize const size)
+{
+    if (size == LAKE_TAGGED_HEAP_BLOCK_SIZE && lake_is_worker_thread()) {
+        struct block_cache *cache = &get_thread_local_storage()->block_cache;
+        if (cache->count < BLOCK_CACHE_COUNT) {
+            cache->blocks[cache->count++] = offset;
+            return;
+        }
+    }
+    release_heap_bitmap(g_bedrock->bitmap, offset, size);
+}
+
+/** Raises a high-water mark, it may be raised concurrently. */
+static void raise_high_water(atomic_u64 *mark, u64 const value)
+{
+    u64 prev = lake_atomic_read_explicit(mark, lake_memory_model_relaxed);
+    while (prev < value && !lake_atomic_compare_exchange_weak_explicit(mark, &prev, value,
+                lake_memory_model_relaxed, lake_memory_model_relaxed));
+}
+
+/** Takes the lock of a heap, counting how often it was already taken. */
+static void lock_tagged_heap(struct tagged_heap *th)
+{
+    if (lake_fiber_mutex_try_lock(&th->lock)) return;
+    lake_atomic_add_explicit(&th->contentions, 1lu, lake_memory_model_relaxed);
+    lake_fiber_mutex_lock(&th->lock);
+}
+
+/** Counts new blocks of a heap, under it's lock. */
+static void account_heap_blocks(struct tagged_heap *th, usize const alloc)
+{
+    u32 const blocks = lake_atomic_read_explicit(&th->blocks, lake_memory_model_relaxed) 
+        + (u32)__position_from_block(alloc);
+    lake_atomic_write_explicit(&th->blocks, blocks, lake_memory_model_relaxed);
+    if (blocks > lake_atomic_read_explicit(&th->blocks_high_water, lake_memory_model_relaxed))
+        lake_atomic_write_explicit(&th->blocks_high_water, blocks, lake_memory_model_relaxed);
+}
+
+static void account_heap_allocations(struct tagged_heap *th, u64 const count, u64 const requested)
+{
+    lake_atomic_add_explicit(&th->allocations, count, lake_memory_model_relaxed);
+    u64 const total = lake_atomic_add_explicit(&th->requested, requested, lake_memory_model_relaxed) + requested;
+    raise_high_water(&th->requested_high_water, total);
+}
+
 /** We grab them from roots, so they are never released.
  *  This operation must never fail. */
 static struct region *LAKECALL construct_tagged_heap_region(
@@ -217,16 +493,17 @@ static struct region *LAKECALL construct_tagged_heap_region(
 {
     u8 *raw = (u8 *)g_bedrock;
     struct tagged_heap *roots = &g_bedrock->roots;
-    if (lake_likely(tag != 0)) lake_spinlock_acquire(&roots->spinlock);
+    if (lake_likely(tag != 0)) lock_tagged_heap(roots);
 
     struct region *tail = roots->tail;
     constexpr usize page_bytes = sizeof(struct region);     
     usize aligned = lake_align(tail->offset, alignof(struct region));
 
     if (lake_unlikely(aligned + page_bytes > tail->alloc)) {
-        usize block = acquire_blocks(block_aligned);
+        usize block = acquire_cached_blocks(block_aligned);
         lake_assert(block, LAKE_ERROR_OUT_OF_HOST_MEMORY, nullptr); 
 
+        account_heap_blocks(roots, block_aligned);
         tail = roots->tail = tail->next = (struct region *)(void *)(uptr)(raw + block);
         *tail = (struct region){
             .v = block,
@@ -237,7 +514,7 @@ static struct region *LAKECALL construct_tagged_heap_region(
     } else {
         tail->offset = aligned + page_bytes;
     }
-    if (lake_likely(tag != 0)) lake_spinlock_release(&roots->spinlock);
+    if (lake_likely(tag != 0)) lake_fiber_mutex_unlock(&roots->lock);
     return (struct region *)(void *)(uptr)(raw + tail->v + aligned);
 }
 
@@ -251,19 +528,20 @@ static void *LAKECALL allocate_from_tagged_heap(struct tagged_heap *th, usize si
 
     usize const block_aligned = lake_align(size, LAKE_TAGGED_HEAP_BLOCK_SIZE);
 
-    lake_spinlock_acquire(&th->spinlock);
-    if (lake_unlikely(th->head.alloc = 0lu)) {
-        th->head.v = acquire_blocks(block_aligned);
+    lock_tagged_heap(th);
+    if (lake_unlikely(th->head.alloc == 0lu)) {
+        th->head.v = acquire_cached_blocks(block_aligned);
         th->tail = &th->head;
 
         if (lake_unlikely(th->head.v == 0lu)) {
             lake_fatal(err, size, block_aligned, block_aligned >> 20, tag);
-            lake_spinlock_release(&th->spinlock);
+            lake_fiber_mutex_unlock(&th->lock);
             return nullptr;
         }
         th->head.offset = size;
         th->head.alloc = block_aligned;
-        lake_spinlock_release(&th->spinlock);
+        account_heap_blocks(th, block_aligned);
+        lake_fiber_mutex_unlock(&th->lock);
         return (void *)(uptr)(raw + th->head.v);
     }
 
@@ -275,19 +553,20 @@ static void *LAKECALL allocate_from_tagged_heap(struct tagged_heap *th, usize si
 
             if (page->alloc == 0) {
                 th->tail = page;
-                page->v = acquire_blocks(block_aligned); 
+                page->v = acquire_cached_blocks(block_aligned); 
 
                 if (lake_unlikely(page->v == 0lu)) {
                     lake_fatal(err, size, block_aligned, block_aligned >> 20, tag);
-                    lake_spinlock_release(&th->spinlock);
+                    lake_fiber_mutex_unlock(&th->lock);
                     return nullptr;
                 }
                 page->offset = aligned + size;
                 page->alloc = block_aligned;
+                account_heap_blocks(th, block_aligned);
             } else if (aligned + size > page->alloc) {
                 continue;
             }
-            lake_spinlock_release(&th->spinlock);
+            lake_fiber_mutex_unlock(&th->lock);
             return (void *)(uptr)(raw + page->v + aligned);
         }
     }
@@ -295,19 +574,168 @@ static void *LAKECALL allocate_from_tagged_heap(struct tagged_heap *th, usize si
     /* we could not yet satisfy the allocation, so grab a new arena page */
     struct region *next = construct_tagged_heap_region(tag, block_aligned);
     th->tail = th->tail->next = next;
-    next->v = acquire_blocks(block_aligned); 
+    next->v = acquire_cached_blocks(block_aligned); 
 
     if (lake_unlikely(next->v == 0lu)) {
         lake_error(err, size, block_aligned, block_aligned >> 20, tag);
-        lake_spinlock_release(&th->spinlock);
+        lake_fiber_mutex_unlock(&th->lock);
         return nullptr;
     }
     next->offset = size;
     next->alloc = block_aligned;
-    lake_spinlock_release(&th->spinlock);
+    account_heap_blocks(th, block_aligned);
+    lake_fiber_mutex_unlock(&th->lock);
     return (void *)(uptr)(raw + next->v);
 }
 
+/** Allocations up to this size are made from a block owned by the worker thread. */
+#define HEAP_CACHE_MAX_SIZE (LAKE_TAGGED_HEAP_BLOCK_SIZE / 8)
+/** How many allocations from a cached block are counted, before they're added to the telemetry. */
+#define HEAP_CACHE_PUBLISH_COUNT 32
+
+/** Adds the allocations from a cached block to the telemetry, unless the heap was freed since. */
+static void publish_heap_cache(struct heap_cache *cache)
+{
+    if (cache->pending_allocations 
+            && cache->generation == lake_atomic_read_explicit(&cache->heap->generation, lake_memory_model_acquire))
+        account_heap_allocations(cache->heap, cache->pending_allocations, cache->pending_requested);
+    cache->pending_allocations = 0;
+    cache->pending_requested = 0;
+}
+
+/** Allocates from the block of the heap cached by this worker thread, without any locks or atomic writes. */
+LAKE_HOT_FN LAKE_MALLOC
+static void *LAKECALL allocate_from_heap_cache(lake_heap_tag tag, usize size, usize align)
+{
+    struct heap_cache *cache = &get_thread_local_storage()->heap_cache[tag & (HEAP_CACHE_COUNT - 1)];
+
+    /* the heap may have been freed, and reused for another tag since */
+    if (cache->v == 0 || cache->tag != tag 
+            || cache->generation != lake_atomic_read_explicit(&cache->heap->generation, lake_memory_model_acquire))
+        return nullptr;
+
+    usize const aligned = lake_align(cache->offset, align);
+    if (aligned + size > LAKE_TAGGED_HEAP_BLOCK_SIZE)
+        return nullptr;
+    cache->offset = aligned + size;
+    cache->pending_requested += size;
+    if (++cache->pending_allocations >= HEAP_CACHE_PUBLISH_COUNT)
+        publish_heap_cache(cache);
+    return (void *)(uptr)((u8 *)g_bedrock + cache->v + aligned);
+}
+
+/** Links a new block into the heap, and caches it for this worker thread. */
+LAKE_HOT_FN LAKE_MALLOC
+static void *LAKECALL refill_heap_cache(struct tagged_heap *th, lake_heap_tag tag, usize size)
+{
+    usize const block = acquire_cached_blocks(LAKE_TAGGED_HEAP_BLOCK_SIZE);
+    if (lake_unlikely(block == 0lu)) {
+        lake_error("Host memory failure, can't acquire a block for tagged heap %X.", tag);
+        return nullptr;
+    }
+    lock_tagged_heap(th);
+    /* reuse a page of a freed heap, the block is full as far as other threads can see */
+    struct region *page = &th->head;
+    while (page->alloc != 0 && page->next != nullptr)
+        page = page->next;
+    if (page->alloc != 0)
+        page = page->next = construct_tagged_heap_region(tag, LAKE_TAGGED_HEAP_BLOCK_SIZE);
+    if (page->next == nullptr)
+        th->tail = page;
+    page->v = block;
+    page->offset = LAKE_TAGGED_HEAP_BLOCK_SIZE;
+    page->alloc = LAKE_TAGGED_HEAP_BLOCK_SIZE;
+    account_heap_blocks(th, LAKE_TAGGED_HEAP_BLOCK_SIZE);
+    u32 const generation = lake_atomic_read_explicit(&th->generation, lake_memory_model_relaxed);
+    lake_fiber_mutex_unlock(&th->lock);
+
+    /* the lock may have parked us, and resumed on another worker thread */
+    struct heap_cache *cache = &get_thread_local_storage()->heap_cache[tag & (HEAP_CACHE_COUNT - 1)];
+    if (cache->v) publish_heap_cache(cache);
+    *cache = (struct heap_cache){
+        .heap = th,
+        .tag = tag,
+        .generation = generation,
+        .v = block,
+        .offset = size,
+        .pending_allocations = 1,
+        .pending_requested = size,
+    };
+    return (void *)(uptr)((u8 *)g_bedrock + block);
+}
+
+/** Spreads the tags over the table, sequential tags and tags that differ only 
+ *  in their high bits shouldn't collide. */
+LAKE_FORCE_INLINE u32 hash_heap_tag(lake_heap_tag tag)
+{
+    u32 hash = tag ^ (tag >> 16);
+    hash *= 0x7feb352du;
+    hash ^= hash >> 15;
+    return hash & g_bedrock->tagged_heap_mask;
+}
+
+/** Finds the heap of the tag, without taking any locks. It may miss a tag inserted 
+ *  concurrently, the insertion looks it up again under the lock. */
+LAKE_HOT_FN
+static struct tagged_heap *LAKECALL lookup_tagged_heap(lake_heap_tag tag)
+{
+    u32 const mask = g_bedrock->tagged_heap_mask;
+
+    for (u32 i = 0, slot = hash_heap_tag(tag); i <= mask; i++, slot = (slot + 1) & mask) {
+        struct tagged_heap *th = &g_bedrock->tagged_heaps[slot];
+        lake_heap_tag const entry = lake_atomic_read_explicit(&th->tag, lake_memory_model_acquire);
+
+        if (entry == tag) return th;
+        /* an empty slot ends the probe sequence, a freed one doesn't */
+        if (entry == 0 && !lake_atomic_read_explicit(&th->deleted, lake_memory_model_relaxed))
+            return nullptr;
+    }
+    return nullptr;
+}
+
+/** Finds the heap of the tag, or prepares a new one. */
+LAKE_HOT_FN
+static struct tagged_heap *LAKECALL find_tagged_heap(lake_heap_tag tag)
+{
+    if (tag == 0) 
+        return &g_bedrock->roots;
+
+    struct tagged_heap *th = lookup_tagged_heap(tag);
+    if (lake_likely(th != nullptr)) 
+        return th;
+
+    lake_spinlock_acquire(&g_bedrock->tagged_heap_lock);
+    th = lookup_tagged_heap(tag);
+    if (th == nullptr) {
+        usize const used = lake_atomic_read_explicit(&g_bedrock->tagged_heap_used, lake_memory_model_relaxed);
+        if (lake_unlikely(used >= (usize)g_bedrock->tagged_heap_count)) {
+            lake_spinlock_release(&g_bedrock->tagged_heap_lock);
+            lake_error("Reached maximum count of unique tagged heaps (%lu), can't satisfy" 
+                    " the allocation for tag `%X`, as the heap does not yet exist.", used, tag);
+            return nullptr;
+        }
+        /* the table is at most half full, a free slot is always found */
+        u32 const mask = g_bedrock->tagged_heap_mask;
+        u32 slot = hash_heap_tag(tag);
+        while (lake_atomic_read_explicit(&g_bedrock->tagged_heaps[slot].tag, lake_memory_model_relaxed) != 0)
+            slot = (slot + 1) & mask;
+
+        /* the tag is published before the slot stops being freed, lookups probe past it */
+        th = &g_bedrock->tagged_heaps[slot];
+        /* the high-water marks of a tag are kept, while it's reused every frame */
+        if (th->stats_tag != tag) {
+            th->stats_tag = tag;
+            lake_atomic_write_explicit(&th->blocks_high_water, 0u, lake_memory_model_relaxed);
+            lake_atomic_write_explicit(&th->requested_high_water, 0lu, lake_memory_model_relaxed);
+        }
+        lake_atomic_write_explicit(&th->tag, tag, lake_memory_model_release);
+        lake_atomic_write_explicit(&th->deleted, 0u, lake_memory_model_release);
+        lake_atomic_write_explicit(&g_bedrock->tagged_heap_used, used + 1, lake_memory_model_relaxed);
+    }
+    lake_spinlock_release(&g_bedrock->tagged_heap_lock);
+    return th;
+}
+
 void *lake_thalloc(lake_heap_tag tag, usize size, usize align)
 {
     lake_dbg_assert(lake_is_pow2(align), LAKE_INVALID_PARAMETERS, "alignment must be a power of 2");
@@ -315,68 +743,210 @@ void *lake_thalloc(lake_heap_tag tag, usize size, usize align)
     if (lake_unlikely(size == 0 || align == 0))
         return nullptr;
 
-    if (tag == 0) 
-        return allocate_from_tagged_heap(&g_bedrock->roots, size, align);
-
-    /* if a tag exists, it will be found here */
-    usize tail = lake_atomic_read_explicit(&g_bedrock->tagged_heap_tail, lake_memory_model_acquire);
-    for (usize i = 0; i < tail; i++) {
-        struct tagged_heap *th = g_bedrock->tagged_heaps[i];
-        if (tag == lake_atomic_read(&th->tag))
-            return allocate_from_tagged_heap(th, size, align);
+    /* small allocations of a worker thread don't contend on the heap, roots are shared */
+    bool const cached = tag != 0 && size <= HEAP_CACHE_MAX_SIZE && align <= HEAP_CACHE_MAX_SIZE && lake_is_worker_thread();
+    if (cached) {
+        void *ptr = allocate_from_heap_cache(tag, size, align);
+        if (ptr) return ptr;
     }
+    struct tagged_heap *th = find_tagged_heap(tag);
+    if (lake_unlikely(th == nullptr))
+        return nullptr;
+    if (cached)
+        return refill_heap_cache(th, tag, size);
+
+    void *ptr = allocate_from_tagged_heap(th, size, align);
+    if (lake_likely(ptr != nullptr)) 
+        account_heap_allocations(th, 1lu, size);
+    return ptr;
+}
+
+/** Sizes of the slab classes: steps of 16 bytes up to 128, then 4 steps per power of 2. */
+static u16 const g_slab_class_sizes[SLAB_CLASS_COUNT] = {
+      16,   32,   48,   64,   80,   96,  112,  128,
+     160,  192,  224,  256,  320,  384,  448,  512,
+     640,  768,  896, 1024, 1280, 1536, 1792, 2048,
+};
+
+/** Picks the smallest size class that fits, the size must be within (0, LAKE_THSLAB_MAX_SIZE]. */
+LAKE_FORCE_INLINE u32 slab_class_of(usize const size)
+{
+    if (size <= 128) 
+        return (u32)((size + 15) >> 4) - 1;
+    /* the highest bit of (size - 1) picks the power of 2, the two below it the step */
+    u32 const shift = 31 - (u32)lake_clz((u32)(size - 1)) - 2;
+    return 8 + (shift - 5) * 4 + (u32)(((size - 1) >> shift) & 3);
+}
+
+void *lake_thslab_alloc(lake_heap_tag tag, usize size)
+{
+    if (lake_unlikely(size == 0))
+        return nullptr;
+    if (size > LAKE_THSLAB_MAX_SIZE)
+        return lake_thalloc(tag, size, 16);
+
+    struct tagged_heap *th = find_tagged_heap(tag);
+    if (lake_unlikely(th == nullptr))
+        return nullptr;
+    u32 const class_idx = slab_class_of(size);
+    usize const class_size = g_slab_class_sizes[class_idx];
+    struct slab_class *slab = &th->slabs[class_idx];
 
-    /* prepare a new tagged heap */
+    lake_spinlock_acquire(&slab->lock);
     for (;;) {
-        if (lake_unlikely(tail >= (u32)g_bedrock->tagged_heap_count)) {
-            lake_error("Reached maximum count of unique tagged heaps (%lu), can't satisfy" 
-                    " the allocation for tag `%X`, as the heap does not yet exist.", tail, tag);
-            return nullptr;
+        void *memory = slab->free;
+        if (memory) {
+            lake_memcpy(&slab->free, memory, sizeof(void *));
+            lake_spinlock_release(&slab->lock);
+            return memory;
+        }
+        if (slab->cursor + class_size <= slab->end) {
+            memory = slab->cursor;
+            slab->cursor += class_size;
+            lake_spinlock_release(&slab->lock);
+            return memory;
         }
-        /* we are using the roots tag to identify free heaps */
-        lake_heap_tag expected = 0;
-        struct tagged_heap *th = g_bedrock->tagged_heaps[tail];
+        /* carving a new slab may park the fiber on the heap lock, don't spin meanwhile */
+        lake_spinlock_release(&slab->lock);
+        u8 *carved = (u8 *)lake_thalloc(tag, SLAB_SIZE, SLAB_SIZE);
+        if (lake_unlikely(carved == nullptr))
+            return nullptr;
 
-        if (lake_atomic_compare_exchange_weak_explicit(&th->tag, &expected, tag,
-                lake_memory_model_release, lake_memory_model_relaxed))
-        {
-            lake_atomic_add_explicit(&g_bedrock->tagged_heap_tail, 1lu, lake_memory_model_release);
-            return allocate_from_tagged_heap(th, size, align);
+        lake_spinlock_acquire(&slab->lock);
+        /* if another slab was carved meanwhile, ours stays unused until the heap is freed */
+        if (slab->cursor + class_size > slab->end) {
+            slab->cursor = carved;
+            slab->end = carved + SLAB_SIZE;
         }
-        tail = lake_atomic_read_explicit(&g_bedrock->tagged_heap_tail, lake_memory_model_acquire);
     }
     LAKE_UNREACHABLE;
 }
 
+void lake_thslab_free(lake_heap_tag tag, void *memory, usize size)
+{
+    if (memory == nullptr || size > LAKE_THSLAB_MAX_SIZE) 
+        return;
+
+    struct tagged_heap *th = tag == 0 ? &g_bedrock->roots : lookup_tagged_heap(tag);
+    lake_dbg_assert(th != nullptr, LAKE_INVALID_PARAMETERS, "the object was freed with it's heap");
+    if (lake_unlikely(th == nullptr))
+        return;
+    struct slab_class *slab = &th->slabs[slab_class_of(size)];
+
+    lake_spinlock_acquire(&slab->lock);
+    lake_memcpy(memory, &slab->free, sizeof(void *));
+    slab->free = memory;
+    lake_spinlock_release(&slab->lock);
+}
+
 void lake_thfree(lake_heap_tag tag)
 {
-    usize const tail = lake_atomic_read_explicit(&g_bedrock->tagged_heap_tail, lake_memory_model_relaxed);
     lake_dbg_assert(tag != 0, LAKE_ERROR_NOT_PERMITTED, "roots tagged heap MUST NOT be freed");
 
-    for (usize i = 0; i < tail; i++) {
-        struct tagged_heap *th = g_bedrock->tagged_heaps[i];
+    struct tagged_heap *th = lookup_tagged_heap(tag);
+    if (th == nullptr) return;
 
-        if (lake_atomic_compare_exchange_weak_explicit(&th->tag, &tag, 0u, 
-                lake_memory_model_release, lake_memory_model_relaxed))
-        {
-            usize const actual_tail = lake_atomic_sub_explicit(
-                    &g_bedrock->tagged_heap_tail, 1lu, lake_memory_model_release);
-            /* swap the heap with the tail */
-            g_bedrock->tagged_heaps[i] = g_bedrock->tagged_heaps[actual_tail];
-            g_bedrock->tagged_heaps[actual_tail] = th;
-            lake_spinlock_acquire(&th->spinlock);
-
-            for (struct region *page = &th->head; page != nullptr; page = page->next) {
-                if (!page->alloc) break;
-
-                release_heap_bitmap(g_bedrock->bitmap, page->v, page->alloc);
-                *page = (struct region){ .next = page->next };
+    lake_atomic_add_explicit(&th->generation, 1u, lake_memory_model_release);
+    lock_tagged_heap(th);
+
+    /* blocks beyond the resident limit give their physical memory back, wherever they are, 
+     * so a long-lived heap near the end of the commitment doesn't keep the rest resident */
+    usize const commitment = lake_atomic_read_explicit(&g_bedrock->commitment, lake_memory_model_acquire);
+    usize resident = count_resident_free_blocks(g_bedrock->roots.head.alloc, commitment);
+    usize run = 0lu, run_end = 0lu;
+
+    for (struct region *page = &th->head; page != nullptr; page = page->next) {
+        if (!page->alloc) break;
+
+        usize const blocks = __position_from_block(page->alloc);
+        if (resident + blocks <= g_bedrock->resident_block_limit) {
+            release_cached_blocks(page->v, page->alloc);
+            resident += blocks;
+        } else {
+            /* pages often follow each other, decommit them together */
+            if (page->v != run_end) {
+                (void)decommit_owned_blocks(run, run_end - run);
+                run = page->v;
             }
-            th->tail = &th->head;
-            lake_spinlock_release(&th->spinlock);
-            return;
+            run_end = page->v + page->alloc;
         }
+        *page = (struct region){ .next = page->next };
     }
+    (void)decommit_owned_blocks(run, run_end - run);
+    /* the slabs were carved from the released blocks */
+    lake_memset(th->slabs, 0, sizeof(th->slabs));
+    th->tail = &th->head;
+    lake_atomic_write_explicit(&th->blocks, 0u, lake_memory_model_relaxed);
+    lake_atomic_write_explicit(&th->requested, 0lu, lake_memory_model_relaxed);
+    lake_atomic_write_explicit(&th->allocations, 0lu, lake_memory_model_relaxed);
+    lake_atomic_write_explicit(&th->contentions, 0lu, lake_memory_model_relaxed);
+    lake_fiber_mutex_unlock(&th->lock);
+
+    lake_spinlock_acquire(&g_bedrock->tagged_heap_lock);
+    /* it may have been freed concurrently */
+    if (lake_atomic_read_explicit(&th->tag, lake_memory_model_relaxed) == tag) {
+        u32 const mask = g_bedrock->tagged_heap_mask;
+        struct tagged_heap *heaps = g_bedrock->tagged_heaps;
+
+        lake_atomic_write_explicit(&th->deleted, 1u, lake_memory_model_release);
+        lake_atomic_write_explicit(&th->tag, 0u, lake_memory_model_release);
+        lake_atomic_sub_explicit(&g_bedrock->tagged_heap_used, 1lu, lake_memory_model_relaxed);
+
+        /* freed slots right before an empty one don't continue any probe sequence, 
+         * clear them so lookups of missing tags stay short */
+        u32 slot = (u32)(th - heaps);
+        while (lake_atomic_read_explicit(&heaps[slot].tag, lake_memory_model_relaxed) == 0
+                && lake_atomic_read_explicit(&heaps[slot].deleted, lake_memory_model_relaxed)
+                && lake_atomic_read_explicit(&heaps[(slot + 1) & mask].tag, lake_memory_model_relaxed) == 0
+                && !lake_atomic_read_explicit(&heaps[(slot + 1) & mask].deleted, lake_memory_model_relaxed))
+        {
+            lake_atomic_write_explicit(&heaps[slot].deleted, 0u, lake_memory_model_release);
+            slot = (slot - 1) & mask;
+        }
+    }
+    lake_spinlock_release(&g_bedrock->tagged_heap_lock);
+}
+
+static lake_thstats read_heap_stats(struct tagged_heap *th, lake_heap_tag tag)
+{
+    u32 const blocks = lake_atomic_read_explicit(&th->blocks, lake_memory_model_relaxed);
+    return (lake_thstats){
+        .tag = tag,
+        .blocks = blocks,
+        .blocks_high_water = lake_atomic_read_explicit(&th->blocks_high_water, lake_memory_model_relaxed),
+        .bytes_requested = lake_atomic_read_explicit(&th->requested, lake_memory_model_relaxed),
+        .bytes_requested_high_water = lake_atomic_read_explicit(&th->requested_high_water, lake_memory_model_relaxed),
+        .bytes_committed = (u64)blocks * LAKE_TAGGED_HEAP_BLOCK_SIZE,
+        .allocations = lake_atomic_read_explicit(&th->allocations, lake_memory_model_relaxed),
+        .lock_contentions = lake_atomic_read_explicit(&th->contentions, lake_memory_model_relaxed),
+    };
+}
+
+u32 lake_thstats_snapshot(u32 capacity, lake_thstats *out)
+{
+    lake_san_assert(g_bedrock != nullptr, LAKE_FRAMEWORK_REQUIRED, nullptr);
+    u32 count = 0;
+
+    /* no locks are taken, the heaps may change while we read them */
+    if (count < capacity && out != nullptr)
+        out[count] = read_heap_stats(&g_bedrock->roots, 0);
+    count++;
+    for (u32 i = 0; i <= g_bedrock->tagged_heap_mask; i++) {
+        struct tagged_heap *th = &g_bedrock->tagged_heaps[i];
+        lake_heap_tag const tag = lake_atomic_read_explicit(&th->tag, lake_memory_model_acquire);
+        if (tag == 0) continue;
+
+        if (count < capacity && out != nullptr)
+            out[count] = read_heap_stats(th, tag);
+        count++;
+    }
+    return count;
+}
+
+lake_thpage_report lake_thpages(void)
+{
+    lake_san_assert(g_bedrock != nullptr, LAKE_FRAMEWORK_REQUIRED, nullptr);
+    return g_bedrock->pages;
 }
 
 usize lake_thadvise(usize request, lake_thadvise_mode mode)
@@ -393,6 +963,7 @@ usize lake_thadvise(usize request, lake_thadvise_mode mode)
 
     usize expected = 0lu;
     while (!lake_atomic_compare_exchange_weak_explicit(sync, &expected, roots_end, lake_memory_model_acquire, lake_memory_model_relaxed))
+        expected = 0lu;
 
     for (;;) {
         usize const page_aligned = lake_align(request, g_bedrock->page_size);
@@ -400,29 +971,31 @@ usize lake_thadvise(usize request, lake_thadvise_mode mode)
 
         /* try to release physical resources */
         if (mode & lake_thadvise_release) {
-            usize const offset = commitment - page_aligned;
-            usize const index = __index_from_page(offset);
-            usize const range = __index_from_page(page_aligned);
-            usize const bits = (range + 1) * 8  /* full bytes of free blocks */
-                - (index & 0x07)                /* trim head index bits from range */ 
-                - ((index + range) & 0x07);     /* trim tail index bits from range */
-            u64 const popcnt = lake_popcnt((u8 const *)g_bedrock->bitmap + index, range);
-
-            bool success = false;
-            if (popcnt >= bits && sys_madvise((void *)g_bedrock, offset, page_aligned, false)) {
-                success = true;
-            } else if (allow_suboptimal) {
-                request >>= 1;
-                if (request > g_bedrock->page_size)
-                    continue;
+            usize const offset = page_aligned < commitment ? commitment - page_aligned : 0lu;
+            bool tail_free = false;
+            if (offset >= roots_end) {
+                usize const index = __index_from_page(offset);
+                usize const range = __index_from_page(page_aligned);
+                usize const bits = (range + 1) * 8  /* full bytes of free blocks */
+                    - (index & 0x07)                /* trim head index bits from range */ 
+                    - ((index + range) & 0x07);     /* trim tail index bits from range */
+                tail_free = lake_popcnt((u8 const *)g_bedrock->bitmap + index, range) >= bits;
             }
-
-            lake_atomic_write_explicit(sync, 0lu, lake_memory_model_release);
-            if (success) {
+            /* shrink the commitment if the tail is free */
+            if (tail_free && sys_madvise((void *)g_bedrock, offset, page_aligned, sys_madvise_mode_release)) {
+                recommit_heap_bitmap(g_bedrock->decommitted, offset, page_aligned);
                 lake_atomic_write_explicit(&g_bedrock->commitment, offset, lake_memory_model_release);
+                lake_atomic_write_explicit(sync, 0lu, lake_memory_model_release);
                 return page_aligned;
             }
-            return 0lu;
+            /* otherwise free blocks are decommitted from anywhere below the commitment */
+            usize released = 0lu;
+            usize const block_aligned = lake_align(page_aligned, LAKE_TAGGED_HEAP_BLOCK_SIZE);
+            if (allow_suboptimal || __block_from_position(count_resident_free_blocks(roots_end, commitment)) >= block_aligned)
+                released = decommit_free_blocks(roots_end, commitment, block_aligned);
+
+            lake_atomic_write_explicit(sync, 0lu, lake_memory_model_release);
+            return released;
 
         /* try to commit physical resources */
         } else if (mode & lake_thadvise_commit) {
@@ -436,7 +1009,7 @@ usize lake_thadvise(usize request, lake_thadvise_mode mode)
 
             /* commit physical resources */
             bool success = false;
-            if (sys_madvise((void *)g_bedrock, commitment, page_aligned, true)) {
+            if (sys_madvise((void *)g_bedrock, commitment, page_aligned, sys_madvise_mode_commit)) {
                 success = true;
             } else if (allow_suboptimal) {
                 request >>= 1;
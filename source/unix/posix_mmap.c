@@ -8,25 +8,11 @@
 
 void *sys_mmap(usize page_aligned, usize hugepage_size)
 {
-    void *mapped = NULL;
-    s32 flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+    s32 const flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
 
-    if (!hugepage_size) {
-        /* ignore */
-#if defined(MAP_HUGE_4MB)
-    } else if (hugepage_size == 4*1024*1024) {
-        flags |= MAP_HUGE_4MB;
-#endif /* 4MB */
-#if defined(MAP_HUGE_2MB)
-    } else if (hugepage_size == 2*1024*1024) {
-        flags |= MAP_HUGE_2MB;
-#endif /* 2MB */
-#if defined(MAP_HUGE_1MB)
-    } else if (hugepage_size == 1024*1024) {
-        flags |= MAP_HUGE_1MB;
-#endif /* 1MB */
-    }
-    mapped = mmap(NULL, page_aligned, PROT_NONE, flags, -1, 0);
+    /* reserve a huge page more, to align the start, and give the slack back */
+    usize const slack = lake_is_pow2(hugepage_size) ? hugepage_size : 0lu;
+    u8 *mapped = mmap(NULL, page_aligned + slack, PROT_NONE, flags, -1, 0);
     if (mapped == MAP_FAILED) {
         lake_log_from_critical_path(-4, "mmap failed to reserve virtual memory of %lu bytes (%lumb): %s.", 
                 page_aligned, page_aligned >> 20, strerror(errno));
@@ -35,6 +21,13 @@ void *sys_mmap(usize page_aligned, usize hugepage_size)
 #endif /* LAKE_NDEBUG */
         return nullptr;
     }
+    if (slack) {
+        u8 *aligned = (u8 *)lake_align((uptr)mapped, slack);
+        usize const head = (usize)(aligned - mapped);
+        if (head) munmap(mapped, head);
+        if (slack - head) munmap(aligned + page_aligned, slack - head);
+        mapped = aligned;
+    }
     return mapped;
 }
 
@@ -44,27 +37,33 @@ void sys_munmap(void *mapped, usize size_page_aligned)
     if (res != 0) { lake_log_from_critical_path(-4, "Failed munmap with status %d.", res); }
 }
 
-bool sys_madvise(void *mapped, usize offset, usize size, bool commit_or_release)
+bool sys_madvise(void *mapped, usize offset, usize size, enum sys_madvise_mode mode)
 {
     void       *raw_map = (void *)((sptr)mapped + offset);
-    char const *errtype = commit_or_release ? "commitment" : "release";
+    char const *errtype = mode == sys_madvise_mode_commit ? "commitment" 
+                        : mode == sys_madvise_mode_release ? "release" : "guard";
     bool        success = 1;
 #ifndef LAKE_NDEBUG
     if (size == 0 && "The page size must not be zero.") lake_debugtrap();
 #endif /* LAKE_NDEBUG */
 
     /* commit physical memory */
-    if (commit_or_release) {
+    if (mode == sys_madvise_mode_commit) {
         s32 res = mprotect(raw_map, size, PROT_READ | PROT_WRITE);
         if (res == 0)
             res = madvise(raw_map, size, MADV_WILLNEED);
         success = (res == 0);
     /* release physical memory */
-    } else {
+    } else if (mode == sys_madvise_mode_release) {
         s32 res = madvise(raw_map, size, MADV_DONTNEED);
         if (res == 0)
             res = mprotect(raw_map, size, PROT_NONE);
         success = (res == 0);
+    /* a guard page, there are a lot of them so don't spam the log */
+    } else {
+        s32 res = mprotect(raw_map, size, PROT_NONE);
+        if (res == 0) return true;
+        success = false;
     }
     /* check for errors */
     if (!success) {
@@ -78,4 +77,43 @@ bool sys_madvise(void *mapped, usize offset, usize size, bool commit_or_release)
     }
     return success;
 }
+
+lake_page_policy sys_mpolicy(void *mapped, usize offset, usize size, usize hugepage_size, lake_page_policy policy)
+{
+    void *raw_map = (void *)((sptr)mapped + offset);
+    (void)hugepage_size;
+
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+    /* the pages are reserved from the pool right away, without it a fault could fail later */
+    if (policy == lake_page_policy_hugetlb) {
+        s32 const flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB 
+                        | (lake_ctz_u64(hugepage_size) << MAP_HUGE_SHIFT);
+        if (mmap(raw_map, size, PROT_NONE, flags, -1, 0) == raw_map)
+            return lake_page_policy_hugetlb;
+
+        lake_log_from_critical_path(2, "Can't map %lu bytes (%lu MB) of hugetlbfs pages: %s.", 
+                size, size >> 20, strerror(errno));
+        /* a failed fixed mapping may have unmapped the range, reserve it again */
+        if (mmap(raw_map, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) != raw_map) {
+            lake_log_from_critical_path(-4, "mmap failed to reserve virtual memory of %lu bytes (%lumb) again: %s.", 
+                    size, size >> 20, strerror(errno));
+            return lake_page_policy_standard;
+        }
+        policy = lake_page_policy_transparent;
+    }
+#endif /* MAP_HUGETLB */
+#if defined(MADV_HUGEPAGE)
+    if (policy == lake_page_policy_transparent) {
+        if (madvise(raw_map, size, MADV_HUGEPAGE) == 0)
+            return lake_page_policy_transparent;
+        lake_log_from_critical_path(2, "Can't use transparent huge pages for %lu bytes (%lu MB): %s.", 
+                size, size >> 20, strerror(errno));
+    }
+#endif /* MADV_HUGEPAGE */
+#if defined(MADV_NOHUGEPAGE)
+    /* the kernel won't collapse it into huge pages in the background either */
+    (void)madvise(raw_map, size, MADV_NOHUGEPAGE);
+#endif /* MADV_NOHUGEPAGE */
+    return lake_page_policy_standard;
+}
 #endif /* LAKE_PLATFORM_UNIX */
@@ -8,6 +8,15 @@
 #include <pthread.h>
 #include <sys/types.h>
 #include <sys/cdefs.h>
+#if defined(LAKE_PLATFORM_LINUX)
+#include <limits.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#else
+#include <errno.h>
+#include <time.h>
+#endif /* LAKE_PLATFORM_LINUX */
 
 void sys_thread_create(sys_thread_id *out_thread, void *(*procedure)(void *), void *argument)
 {
@@ -49,20 +58,102 @@ void sys_thread_join(sys_thread_id thread)
     }
 }
 
-void sys_thread_affinity(u32 thread_count, sys_thread_id const *threads, u32 cpu_count, u32 begin_cpu_idx)
+void sys_thread_affinity(u32 thread_count, sys_thread_id const *threads, struct sys_cpu const *cpus, u32 cpu_count)
 {
-    u32 i = 0;
-    u32 j = begin_cpu_idx;
-    while (i < thread_count && j < cpu_count) {
+    for (u32 i = 0; i < thread_count && i < cpu_count; i++) {
         cpu_set_t set;
         CPU_ZERO(&set);
-        CPU_SET(j, &set);
+        CPU_SET(cpus[i].id, &set);
 
         if (pthread_setaffinity_np((pthread_t)threads[i], sizeof(cpu_set_t), &set) != 0) {
-            lake_error("pthread_setaffinity_np failed for CPU %u and thread %u.", j, i);
+            lake_error("pthread_setaffinity_np failed for CPU %u and thread %u.", cpus[i].id, i);
             return;
         }
-        i++; j++;
     }
 }
+
+#if defined(LAKE_PLATFORM_LINUX)
+void sys_futex_wait(atomic_u32 *address, u32 expected, u64 timeout_ns)
+{
+    /* the timeout is relative, it's fine to return early on EAGAIN, EINTR or ETIMEDOUT */
+    struct timespec timeout = {
+        .tv_sec = (time_t)(timeout_ns / LAKE_NS_PER_SECOND),
+        .tv_nsec = (long)(timeout_ns % LAKE_NS_PER_SECOND),
+    };
+    syscall(SYS_futex, (u32 *)address, FUTEX_WAIT_PRIVATE, expected, 
+            timeout_ns == UINT64_MAX ? nullptr : &timeout, nullptr, 0);
+}
+
+void sys_futex_wake(atomic_u32 *address, u32 count)
+{
+    s32 const n = count > (u32)INT_MAX ? INT_MAX : (s32)count;
+    syscall(SYS_futex, (u32 *)address, FUTEX_WAKE_PRIVATE, n, nullptr, nullptr, 0);
+}
+#else
+/** Without a futex, waiters sleep on a condition variable picked by a hash of the address. 
+ *  The value is compared under the bucket's mutex, and wakers take the same mutex before 
+ *  broadcasting, so a wake after the value was changed can't slip in between. */
+#define FUTEX_BUCKET_COUNT 64
+
+struct futex_bucket {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+};
+static struct futex_bucket g_futex_buckets[FUTEX_BUCKET_COUNT];
+static pthread_once_t g_futex_buckets_once = PTHREAD_ONCE_INIT;
+
+static void init_futex_buckets(void)
+{
+    for (u32 i = 0; i < FUTEX_BUCKET_COUNT; i++) {
+        if (pthread_mutex_init(&g_futex_buckets[i].mutex, nullptr) != 0 ||
+            pthread_cond_init(&g_futex_buckets[i].cond, nullptr) != 0) 
+        {
+            lake_fatal("Creating the futex buckets with 'pthread_mutex_init' and 'pthread_cond_init' failed.");
+            lake_debugtrap();
+        }
+    }
+}
+
+static struct futex_bucket *get_futex_bucket(atomic_u32 *address)
+{
+    pthread_once(&g_futex_buckets_once, init_futex_buckets);
+    uptr const key = (uptr)address >> 2;
+    return &g_futex_buckets[(key ^ (key >> 6) ^ (key >> 12)) % FUTEX_BUCKET_COUNT];
+}
+
+void sys_futex_wait(atomic_u32 *address, u32 expected, u64 timeout_ns)
+{
+    struct futex_bucket *bucket = get_futex_bucket(address);
+    struct timespec deadline;
+    if (timeout_ns != UINT64_MAX) {
+        /* the timeout is relative, the condition variable takes an absolute time */
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        u64 const nsec = (u64)deadline.tv_nsec + timeout_ns % LAKE_NS_PER_SECOND;
+        deadline.tv_sec += (time_t)(timeout_ns / LAKE_NS_PER_SECOND + nsec / LAKE_NS_PER_SECOND);
+        deadline.tv_nsec = (long)(nsec % LAKE_NS_PER_SECOND);
+    }
+    pthread_mutex_lock(&bucket->mutex);
+    /* as with the futex, it's fine to return early on a spurious wakeup or a timeout */
+    if (lake_atomic_read_explicit(address, lake_memory_model_acquire) == expected) {
+        if (timeout_ns == UINT64_MAX) {
+            pthread_cond_wait(&bucket->cond, &bucket->mutex);
+        } else {
+            s32 const res = pthread_cond_timedwait(&bucket->cond, &bucket->mutex, &deadline);
+            lake_dbg_assert(res == 0 || res == ETIMEDOUT, LAKE_PANIC, "pthread_cond_timedwait failed: %d.", res);
+            (void)res;
+        }
+    }
+    pthread_mutex_unlock(&bucket->mutex);
+}
+
+void sys_futex_wake(atomic_u32 *address, u32 count)
+{
+    /* other addresses may share the bucket, so everyone is woken up to check their value */
+    struct futex_bucket *bucket = get_futex_bucket(address);
+    (void)count;
+    pthread_mutex_lock(&bucket->mutex);
+    pthread_cond_broadcast(&bucket->cond);
+    pthread_mutex_unlock(&bucket->mutex);
+}
+#endif /* LAKE_PLATFORM_LINUX */
 #endif /* LAKE_PLATFORM_UNIX */
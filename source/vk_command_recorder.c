@@ -29,8 +29,10 @@ FN_MOON_COMMAND_RECORDER_ZERO_REFCNT(vulkan)
             .vk_cmd_pool = cmd->vk_cmd_pool,
         },
     };
-    lake_spinlock *lock = &device->zombies_locks[zombie_timeline_command_recorder_idx];
-    lake_deque_unshift_v_locked(device->command_recorder_zombies, zombie_timeline_command_recorder, submit, lock);
+    lake_fiber_mutex *lock = &device->zombies_locks[zombie_timeline_command_recorder_idx];
+    lake_fiber_mutex_lock(lock);
+    lake_deque_unshift_v(device->command_recorder_zombies, zombie_timeline_command_recorder, submit);
+    lake_fiber_mutex_unlock(lock);
     
     /* TODO recycle command pool into the arena */
 
@@ -654,35 +654,41 @@ FN_MOON_DEVICE_SUBMIT_COMMANDS(vulkan)
     if (submit->queue.idx >= device->physical_device->queue_families[submit->queue.type].queue_count)
         return LAKE_ERROR_INVALID_QUEUE;
 
-    lake_spinlock *lifetime_lock = &device->gpu_sr_table.lifetime_lock;
-    lake_spinlock_acquire(lifetime_lock);
+    lake_fiber_mutex *lifetime_lock = &device->gpu_sr_table.lifetime_lock;
+    lake_fiber_mutex_lock(lifetime_lock);
+    lake_result result = LAKE_SUCCESS;
 
-    for (u32 i = 0; i < submit->staged_command_list_count; i++) {
+    for (u32 i = 0; i < submit->staged_command_list_count && result == LAKE_SUCCESS; i++) {
         struct moon_staged_command_list_impl const *cmd_list = submit->staged_command_lists[i];
 
         if (cmd_list->header.cmd.header->assembly.queue_type != submit->queue.type)
-            return LAKE_ERROR_QUEUE_SCHEDULING_TYPE_MISMATCH;
+            result = LAKE_ERROR_QUEUE_SCHEDULING_TYPE_MISMATCH;
 
         lake_darray_foreach_v(cmd_list->data.used_buffers, moon_buffer_id, id)
             if (!_moon_vulkan_is_buffer_valid(device, *id)) 
-                return LAKE_ERROR_INVALID_BUFFER_ID;
+                result = LAKE_ERROR_INVALID_BUFFER_ID;
 
         lake_darray_foreach_v(cmd_list->data.used_textures, moon_texture_id, id)
             if (!_moon_vulkan_is_texture_valid(device, *id))
-                return LAKE_ERROR_INVALID_TEXTURE_ID;
+                result = LAKE_ERROR_INVALID_TEXTURE_ID;
 
         lake_darray_foreach_v(cmd_list->data.used_texture_views, moon_texture_view_id, id)
             if (!_moon_vulkan_is_texture_view_valid(device, *id))
-                return LAKE_ERROR_INVALID_TEXTURE_VIEW_ID;
+                result = LAKE_ERROR_INVALID_TEXTURE_VIEW_ID;
 
         lake_darray_foreach_v(cmd_list->data.used_samplers, moon_sampler_id, id)
             if (!_moon_vulkan_is_sampler_valid(device, *id))
-                return LAKE_ERROR_INVALID_SAMPLER_ID;
+                result = LAKE_ERROR_INVALID_SAMPLER_ID;
+    }
+    /* the lock must not be leaked, or every later submit would wait on it forever */
+    if (result != LAKE_SUCCESS) {
+        lake_fiber_mutex_unlock(lifetime_lock);
+        return result;
     }
     struct queue_impl *queue = get_device_queue_impl(device, submit->queue);
     u64 const current_timeline_value = lake_atomic_add_explicit(&device->submit_timeline, 1, lake_memory_model_release) + 1;
     lake_atomic_write_explicit(&queue->latest_pending_submit_timeline_value, current_timeline_value, lake_memory_model_release);
-    lake_spinlock_release(lifetime_lock);
+    lake_fiber_mutex_unlock(lifetime_lock);
 
     u32 const sem_signal_count = 1 + submit->signal_binary_semaphore_count + submit->signal_timeline_semaphore_count;
     u32 const sem_wait_count = submit->wait_binary_semaphore_count + submit->wait_timeline_semaphore_count;
@@ -853,18 +859,18 @@ FN_MOON_DEVICE_PRESENT_FRAMES(vulkan)
 
 FN_MOON_DEVICE_COMMIT_DEFERRED_DESTRUCTORS(vulkan)
 {
-    lake_spinlock *lifetime_lock = &device->gpu_sr_table.lifetime_lock;
-    lake_spinlock *zombie_lock = device->zombies_locks;
+    lake_fiber_mutex *lifetime_lock = &device->gpu_sr_table.lifetime_lock;
+    lake_fiber_mutex *zombie_lock = device->zombies_locks;
     u64 min_pending_timeline_value = UINT64_MAX;
 
-    lake_spinlock_acquire(lifetime_lock);
+    lake_fiber_mutex_lock(lifetime_lock);
     for (u32 i = 0; i < MOON_QUEUE_INDEX_COUNT; i++) {
         struct queue_impl *queue = &device->queues[i];
 
         u64 latest_pending_submit;
         lake_result result = get_oldest_pending_submit(device, queue, &latest_pending_submit);
         if (result != LAKE_SUCCESS) {
-            lake_spinlock_release(lifetime_lock);
+            lake_fiber_mutex_unlock(lifetime_lock);
             return result;
         }
         if (latest_pending_submit != UINT64_MAX)
@@ -872,7 +878,7 @@ FN_MOON_DEVICE_COMMIT_DEFERRED_DESTRUCTORS(vulkan)
     }
 #define COMMIT_DESTRUCTORS(T, ...) \
     zombie_lock = &device->zombies_locks[zombie_timeline_##T##_idx]; \
-    lake_spinlock_acquire(zombie_lock); \
+    lake_fiber_mutex_lock(zombie_lock); \
     \
     while (!lake_deque_empty_v(device->T##_zombies)) { \
         zombie_timeline_##T zombie = {0}; \
@@ -886,7 +892,7 @@ FN_MOON_DEVICE_COMMIT_DEFERRED_DESTRUCTORS(vulkan)
         } \
         __VA_ARGS__ \
     } \
-    lake_spinlock_release(zombie_lock);
+    lake_fiber_mutex_unlock(zombie_lock);
 
     COMMIT_DESTRUCTORS(buffer, buffer_destructor(device, zombie.second); );
     COMMIT_DESTRUCTORS(texture, texture_destructor(device, zombie.second); );
@@ -905,9 +911,11 @@ FN_MOON_DEVICE_COMMIT_DEFERRED_DESTRUCTORS(vulkan)
                 (u32)lake_darray_size(&zombie.second.allocated_command_buffers.da), 
                 zombie.second.allocated_command_buffers.v);
             VERIFY_VK_ERROR(device->vkResetCommandPool(device->vk_device, zombie.second.vk_cmd_pool, 0));
-            lake_darray_append_v_locked(arena->pools_and_buffers, VkCommandPool, zombie.second.vk_cmd_pool, 1, &arena->spinlock);
+            lake_fiber_mutex_lock(&arena->lock);
+            lake_darray_append_n(&arena->pools_and_buffers.da, VkCommandPool, &zombie.second.vk_cmd_pool, 1);
+            lake_fiber_mutex_unlock(&arena->lock);
     );
-    lake_spinlock_release(lifetime_lock);
+    lake_fiber_mutex_unlock(lifetime_lock);
 #undef COMMIT_DESTRUCTORS
     return LAKE_SUCCESS;
 }
@@ -1219,8 +1227,10 @@ FN_MOON_MEMORY_HEAP_ZERO_REFCNT(vulkan)
         .first = lake_atomic_read(&device->submit_timeline),
         .second = { .vma_allocation = heap->vma_allocation },
     };
-    lake_spinlock *lock = &device->zombies_locks[zombie_timeline_memory_heap_idx];
-    lake_deque_unshift_v_locked(device->memory_heap_zombies, zombie_timeline_memory_heap, submit, lock);
+    lake_fiber_mutex *lock = &device->zombies_locks[zombie_timeline_memory_heap_idx];
+    lake_fiber_mutex_lock(lock);
+    lake_deque_unshift_v(device->memory_heap_zombies, zombie_timeline_memory_heap, submit);
+    lake_fiber_mutex_unlock(lock);
 
     moon_device_unref(heap->header.device);
     __lake_free(heap);
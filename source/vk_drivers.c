@@ -2475,6 +2475,8 @@ LAKEAPI FN_LAKE_INTERFACE_IMPL(moon, vulkan, lake_framework)
         query_work[i].procedure = (PFN_lake_work)query_physical_device;
         query_work[i].argument = (void *)&query_physical_device_work[i];
         query_work[i].name = "moon/vulkan/query_physical_device";
+        query_work[i].priority = lake_work_priority_normal;
+        query_work[i].stack = lake_fiber_stack_default;
     }
     lake_submit_work_and_yield(physical_device_count, query_work);
 
@@ -484,7 +484,7 @@ struct gpu_shader_resource_table {
     struct sampler_gpu_sr_pool              sampler_slots;
     struct tlas_gpu_sr_pool                 tlas_slots;
     struct blas_gpu_sr_pool                 blas_slots;
-    lake_spinlock                           lifetime_lock;
+    lake_fiber_mutex                        lifetime_lock;
 
     VkDescriptorSetLayout                   vk_descriptor_set_layout;
     VkDescriptorSet                         vk_descriptor_set;
@@ -617,7 +617,7 @@ static constexpr usize COMMAND_LIST_COLOR_ATTACHMENT_MAX = 16;
 struct command_pool_arena {
     lake_darray_t(VkCommandPool)        pools_and_buffers;
     s32                                 queue_family_idx;
-    lake_spinlock                       spinlock;
+    lake_fiber_mutex                    lock;
 };
 
 typedef lake_pair(u64, u8) staged_deferred_destructor_pair;
@@ -801,7 +801,8 @@ struct moon_device_impl {
      *  zombies global submit index is smaller than the global index of all submits currently 
      *  in flight (on all queues), we can safely clean the resource up. */
     atomic_u64                                      submit_timeline;
-    lake_spinlock                                   zombies_locks[zombie_timeline_count];
+    /** Destroying zombies calls into the driver, lockers park instead of spinning. */
+    lake_fiber_mutex                                zombies_locks[zombie_timeline_count];
     /** Pairs of resource handles or zombies with submit timeline values. */
     lake_deque_t(zombie_timeline_buffer)            buffer_zombies;
     lake_deque_t(zombie_timeline_texture)           texture_zombies;
@@ -1193,8 +1194,10 @@ LAKE_FORCE_INLINE void zombify_buffer(struct moon_device_impl *device, moon_buff
         .first = lake_atomic_read(&device->submit_timeline), 
         .second = buffer 
     };
-    lake_spinlock *lock = &device->zombies_locks[zombie_timeline_buffer_idx];
-    lake_deque_unshift_v_locked(device->buffer_zombies, zombie_timeline_buffer, submit, lock);
+    lake_fiber_mutex *lock = &device->zombies_locks[zombie_timeline_buffer_idx];
+    lake_fiber_mutex_lock(lock);
+    lake_deque_unshift_v(device->buffer_zombies, zombie_timeline_buffer, submit);
+    lake_fiber_mutex_unlock(lock);
 }
 
 LAKE_FORCE_INLINE void zombify_texture(struct moon_device_impl *device, moon_texture_id texture)
@@ -1207,8 +1210,10 @@ LAKE_FORCE_INLINE void zombify_texture(struct moon_device_impl *device, moon_tex
         .first = lake_atomic_read(&device->submit_timeline), 
         .second = texture
     };
-    lake_spinlock *lock = &device->zombies_locks[zombie_timeline_texture_idx];
-    lake_deque_unshift_v_locked(device->texture_zombies, zombie_timeline_texture, submit, lock);
+    lake_fiber_mutex *lock = &device->zombies_locks[zombie_timeline_texture_idx];
+    lake_fiber_mutex_lock(lock);
+    lake_deque_unshift_v(device->texture_zombies, zombie_timeline_texture, submit);
+    lake_fiber_mutex_unlock(lock);
 }
 
 LAKE_FORCE_INLINE void zombify_texture_view(struct moon_device_impl *device, moon_texture_view_id texture_view)
@@ -1217,8 +1222,10 @@ LAKE_FORCE_INLINE void zombify_texture_view(struct moon_device_impl *device, moo
         .first = lake_atomic_read(&device->submit_timeline), 
         .second = texture_view
     };
-    lake_spinlock *lock = &device->zombies_locks[zombie_timeline_texture_view_idx];
-    lake_deque_unshift_v_locked(device->texture_view_zombies, zombie_timeline_texture_view, submit, lock);
+    lake_fiber_mutex *lock = &device->zombies_locks[zombie_timeline_texture_view_idx];
+    lake_fiber_mutex_lock(lock);
+    lake_deque_unshift_v(device->texture_view_zombies, zombie_timeline_texture_view, submit);
+    lake_fiber_mutex_unlock(lock);
 }
 
 LAKE_FORCE_INLINE void zombify_sampler(struct moon_device_impl *device, moon_sampler_id sampler)
@@ -1227,8 +1234,10 @@ LAKE_FORCE_INLINE void zombify_sampler(struct moon_device_impl *device, moon_sam
         .first = lake_atomic_read(&device->submit_timeline), 
         .second = sampler
     };
-    lake_spinlock *lock = &device->zombies_locks[zombie_timeline_sampler_idx];
-    lake_deque_unshift_v_locked(device->sampler_zombies, zombie_timeline_sampler, submit, lock);
+    lake_fiber_mutex *lock = &device->zombies_locks[zombie_timeline_sampler_idx];
+    lake_fiber_mutex_lock(lock);
+    lake_deque_unshift_v(device->sampler_zombies, zombie_timeline_sampler, submit);
+    lake_fiber_mutex_unlock(lock);
 }
 
 LAKE_FORCE_INLINE void zombify_tlas(struct moon_device_impl *device, moon_tlas_id tlas)
@@ -1241,8 +1250,10 @@ LAKE_FORCE_INLINE void zombify_tlas(struct moon_device_impl *device, moon_tlas_i
         .first = lake_atomic_read(&device->submit_timeline), 
         .second = tlas 
     };
-    lake_spinlock *lock = &device->zombies_locks[zombie_timeline_tlas_idx];
-    lake_deque_unshift_v_locked(device->tlas_zombies, zombie_timeline_tlas, submit, lock);
+    lake_fiber_mutex *lock = &device->zombies_locks[zombie_timeline_tlas_idx];
+    lake_fiber_mutex_lock(lock);
+    lake_deque_unshift_v(device->tlas_zombies, zombie_timeline_tlas, submit);
+    lake_fiber_mutex_unlock(lock);
 }
 
 LAKE_FORCE_INLINE void zombify_blas(struct moon_device_impl *device, moon_blas_id blas)
@@ -1255,8 +1266,10 @@ LAKE_FORCE_INLINE void zombify_blas(struct moon_device_impl *device, moon_blas_i
         .first = lake_atomic_read(&device->submit_timeline), 
         .second = blas 
     };
-    lake_spinlock *lock = &device->zombies_locks[zombie_timeline_blas_idx];
-    lake_deque_unshift_v_locked(device->blas_zombies, zombie_timeline_blas, submit, lock);
+    lake_fiber_mutex *lock = &device->zombies_locks[zombie_timeline_blas_idx];
+    lake_fiber_mutex_lock(lock);
+    lake_deque_unshift_v(device->blas_zombies, zombie_timeline_blas, submit);
+    lake_fiber_mutex_unlock(lock);
 }
 
 LAKE_FORCE_INLINE void buffer_destructor(struct moon_device_impl *device, moon_buffer_id buffer)
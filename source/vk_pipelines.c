@@ -792,6 +792,8 @@ static void LAKECALL destroy_raster_pipeline_assembly_shader_modules(
             work_details[i].procedure = (PFN_lake_work)populate_##T##_pipeline; \
             work_details[i].argument = &work[i]; \
             work_details[i].name = "populate " #T " pipeline create info"; \
+            work_details[i].priority = lake_work_priority_background; \
+            work_details[i].stack = lake_fiber_stack_default; \
             vk_pipelines[i] = VK_NULL_HANDLE; \
         } \
         /* populate the Vk*PipelineCreateInfo's for all assembly */ \
@@ -851,8 +853,10 @@ static void LAKECALL destroy_raster_pipeline_assembly_shader_modules(
             .first = lake_atomic_read(&device->submit_timeline), \
             .second = { .vk_pipeline = pipeline->vk_pipeline }, \
         }; \
-        lake_spinlock *lock = &device->zombies_locks[zombie_timeline_pipeline_idx]; \
-        lake_deque_unshift_v_locked(device->pipeline_zombies, zombie_timeline_pipeline, submit, lock); \
+        lake_fiber_mutex *lock = &device->zombies_locks[zombie_timeline_pipeline_idx]; \
+        lake_fiber_mutex_lock(lock); \
+        lake_deque_unshift_v(device->pipeline_zombies, zombie_timeline_pipeline, submit); \
+        lake_fiber_mutex_unlock(lock); \
         \
         moon_device_unref(pipeline->header.device); \
         __lake_free(pipeline); \
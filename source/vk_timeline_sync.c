@@ -57,8 +57,10 @@ FN_MOON_TIMELINE_QUERY_POOL_ZERO_REFCNT(vulkan)
         .first = lake_atomic_read(&device->submit_timeline), 
         .second = { .vk_query_pool = timeline_query_pool->vk_query_pool }, 
     };
-    lake_spinlock *lock = &device->zombies_locks[zombie_timeline_query_pool_idx];
-    lake_deque_unshift_v_locked(device->query_pool_zombies, zombie_timeline_query_pool, submit, lock);
+    lake_fiber_mutex *lock = &device->zombies_locks[zombie_timeline_query_pool_idx];
+    lake_fiber_mutex_lock(lock);
+    lake_deque_unshift_v(device->query_pool_zombies, zombie_timeline_query_pool, submit);
+    lake_fiber_mutex_unlock(lock);
 
     moon_device_unref(timeline_query_pool->header.device);
     __lake_free(timeline_query_pool);
@@ -722,8 +724,10 @@ FN_MOON_TIMELINE_SEMAPHORE_ZERO_REFCNT(vulkan)
         .first = lake_atomic_read(&device->submit_timeline), 
         .second = { .vk_semaphore = timeline_semaphore->vk_semaphore }, 
     };
-    lake_spinlock *lock = &device->zombies_locks[zombie_timeline_semaphore_idx];
-    lake_deque_unshift_v_locked(device->semaphore_zombies, zombie_timeline_semaphore, submit, lock);
+    lake_fiber_mutex *lock = &device->zombies_locks[zombie_timeline_semaphore_idx];
+    lake_fiber_mutex_lock(lock);
+    lake_deque_unshift_v(device->semaphore_zombies, zombie_timeline_semaphore, submit);
+    lake_fiber_mutex_unlock(lock);
 
     moon_device_unref(timeline_semaphore->header.device);
     __lake_free(timeline_semaphore);
@@ -815,8 +819,10 @@ FN_MOON_BINARY_SEMAPHORE_ZERO_REFCNT(vulkan)
         .first = lake_atomic_read(&device->submit_timeline), 
         .second = { .vk_semaphore = binary_semaphore->vk_semaphore }, 
     };
-    lake_spinlock *lock = &device->zombies_locks[zombie_timeline_semaphore_idx];
-    lake_deque_unshift_v_locked(device->semaphore_zombies, zombie_timeline_semaphore, submit, lock);
+    lake_fiber_mutex *lock = &device->zombies_locks[zombie_timeline_semaphore_idx];
+    lake_fiber_mutex_lock(lock);
+    lake_deque_unshift_v(device->semaphore_zombies, zombie_timeline_semaphore, submit);
+    lake_fiber_mutex_unlock(lock);
 
     moon_device_unref(binary_semaphore->header.device);
     __lake_free(binary_semaphore);
@@ -872,8 +878,10 @@ FN_MOON_EVENT_ZERO_REFCNT(vulkan)
         .first = lake_atomic_read(&device->submit_timeline), 
         .second = { .vk_event = event->vk_event }, 
     };
-    lake_spinlock *lock = &device->zombies_locks[zombie_timeline_event_idx];
-    lake_deque_unshift_v_locked(device->event_zombies, zombie_timeline_event, submit, lock);
+    lake_fiber_mutex *lock = &device->zombies_locks[zombie_timeline_event_idx];
+    lake_fiber_mutex_lock(lock);
+    lake_deque_unshift_v(device->event_zombies, zombie_timeline_event, submit);
+    lake_fiber_mutex_unlock(lock);
 
     moon_device_unref(event->header.device);
     __lake_free(event);
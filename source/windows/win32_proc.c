@@ -11,6 +11,14 @@ void sys_cpuinfo(s32 *out_threads, s32 *out_cores, s32 *out_packages)
     // TODO
 }
 
+u32 sys_cpu_topology(u32 capacity, struct sys_cpu *out_cpus)
+{
+    (void)capacity;
+    (void)out_cpus;
+    // TODO
+    return 0;
+}
+
 void sys_meminfo(usize *out_total_ram, usize *out_page_size)
 {
     (void)out_total_ram;
@@ -25,6 +33,14 @@ void sys_hugetlbinfo(usize *out_hugepage_size, usize ceiling)
     // TODO
 }
 
+void sys_hugepageinfo(usize hugepage_size, usize *out_hugetlb_free, bool *out_transparent)
+{
+    (void)hugepage_size;
+    if (out_hugetlb_free) *out_hugetlb_free = 0;
+    if (out_transparent) *out_transparent = false;
+    // TODO
+}
+
 void sys_dump_stack_trace(void *stream)
 {
     (void)stream;
@@ -43,11 +43,28 @@ void sys_thread_join(sys_thread_id thread)
     }
 }
 
-void sys_thread_affinity(u32 thread_count, sys_thread_id const *threads, u32 cpu_count, u32 begin_cpu_idx)
+void sys_thread_affinity(u32 thread_count, sys_thread_id const *threads, struct sys_cpu const *cpus, u32 cpu_count)
 {
     (void)thread_count;
     (void)threads;
+    (void)cpus;
     (void)cpu_count;
-    (void)begin_cpu_index;
+}
+
+void sys_futex_wait(atomic_u32 *address, u32 expected, u64 timeout_ns)
+{
+    /* round up to whole milliseconds, so a timed wait doesn't wake up too early */
+    DWORD const timeout_ms = timeout_ns == UINT64_MAX ? INFINITE 
+        : (DWORD)lake_min((timeout_ns + LAKE_NS_PER_MS - 1) / LAKE_NS_PER_MS, (u64)INFINITE - 1);
+    WaitOnAddress((volatile void *)address, &expected, sizeof(u32), timeout_ms);
+}
+
+void sys_futex_wake(atomic_u32 *address, u32 count)
+{
+    if (count == 1) {
+        WakeByAddressSingle((void *)address);
+    } else {
+        WakeByAddressAll((void *)address);
+    }
 }
 #endif /* LAKE_PLATFORM_WINDOWS */
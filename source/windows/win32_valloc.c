@@ -23,4 +23,14 @@ bool sys_madvise(void *mapped, usize offset, usize size, enum sys_madvise_mode m
     (void)size;
     (void)mode;
 }
+
+lake_page_policy sys_mpolicy(void *mapped, usize offset, usize size, usize hugepage_size, lake_page_policy policy)
+{
+    (void)mapped;
+    (void)offset;
+    (void)size;
+    (void)hugepage_size;
+    (void)policy;
+    return lake_page_policy_standard;
+}
 #endif /* LAKE_PLATFORM_WINDOWS */
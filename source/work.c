@@ -1,21 +1,23 @@
 #include "internal.h"
 
-u32 lake_worker_thread_index(void)
+/** Index of the worker thread, assigned once when the thread enters the job system. 
+ *  Threads outside of the framework keep the default value of 0. */
+static thread_local u32 t_worker_thread_index = 0;
+/** Set once the thread enters the job system, foreign threads can't push into a deque. */
+static thread_local bool t_worker_thread = false;
+
+/* A fiber may resume on a different thread than the one it yielded from, but the compiler 
+ * is free to cache the address of a thread local variable for the duration of a function. 
+ * This function must never be inlined, so the lookup is made again after every yield. */
+LAKE_FORCE_NOINLINE u32 lake_worker_thread_index(void)
 {
     lake_san_assert(g_bedrock != nullptr, LAKE_FRAMEWORK_REQUIRED, nullptr);
+    return t_worker_thread_index;
+}
 
-    sys_thread_id self;
-    /* TODO implement a hashmap lookup for the worker thread index */
-#if defined(LAKE_PLATFORM_UNIX)
-    self = (sys_thread_id)pthread_self();
-    for (s32 i = 0; i < g_bedrock->thread_count; i++)
-        if (pthread_equal(g_bedrock->threads[i], self)) return i;
-#elif defined(LAKE_PLATFORM_WINDOWS)
-    self = (sys_thread_id)GetCurrentThreadId();
-    for (s32 i = 0; i < g_bedrock->thread_count; i++)
-        if (self == g_bedrock->threads[i]) return i;
-#endif /* LAKE_PLATFORM_UNIX */
-    return 0;
+bool lake_is_worker_thread(void)
+{
+    return t_worker_thread;
 }
 
 char const *lake_fiber_name(void)
@@ -24,122 +26,613 @@ char const *lake_fiber_name(void)
     return g_bedrock->fibers[tls->fiber_in_use].work.details.name;
 }
 
-/* XXX a lot of false sharing around index 0 is expected, there probably should be a better
- * way to acquire a free fiber than this primitive method - but it works so i don't care now */
-extern usize get_free_fiber(void)
+/** Pops a fiber from the free stack (Treiber stack), returns FIBER_INVALID if it's empty. 
+ *  The tag in the high bits of the head changes with every push and pop, so a head that 
+ *  was popped and pushed back in the meantime will fail the compare exchange (ABA). */
+static usize pop_free_fiber(atomic_u64 *free_head)
 {
-    for (s32 i = 0; i < g_bedrock->fiber_count; i++) {
-        /* double lock helps CPUs that have a weak memory model, ARM should 
-         * go 2x to 3x faster using double lock, if it is the bottleneck */
-        usize fiber_idx = lake_atomic_read_explicit(&g_bedrock->free[i], lake_memory_model_relaxed);
-        if (fiber_idx == FIBER_INVALID) continue;
+    u64 head = lake_atomic_read_explicit(free_head, lake_memory_model_acquire);
+    for (;;) {
+        u32 const fiber_idx = (u32)head;
+        if (fiber_idx == FREE_FIBER_END) return FIBER_INVALID;
 
-        fiber_idx = lake_atomic_read_explicit(&g_bedrock->free[i], lake_memory_model_acquire);
-        if (fiber_idx == FIBER_INVALID) continue;
+        /* may read a stale value if the fiber was popped concurrently, the CAS will fail then */
+        u32 const next = lake_atomic_read_explicit(&g_bedrock->fibers[fiber_idx].free_next, lake_memory_model_relaxed);
+        u64 const desired = (((head >> 32) + 1lu) << 32) | (u64)next;
 
-        usize expected = fiber_idx;
-        if (lake_atomic_compare_exchange_weak_explicit(&g_bedrock->free[i], &expected, 
-                FIBER_INVALID, lake_memory_model_release, lake_memory_model_relaxed))
+        if (lake_atomic_compare_exchange_weak_explicit(free_head, &head, 
+                desired, lake_memory_model_acquire, lake_memory_model_acquire))
         {
             return fiber_idx;
         }
     }
+    LAKE_UNREACHABLE;
+}
+
+/** Acquires a free fiber with a stack of at least the requested size class. */
+usize get_free_fiber(lake_fiber_stack stack_class)
+{
+    for (u32 c = stack_class; c < lake_fiber_stack_class_count; c++) {
+        usize const fiber_idx = pop_free_fiber(&g_bedrock->free_head[c]);
+        if (fiber_idx != FIBER_INVALID) return fiber_idx;
+    }
     return FIBER_INVALID;
 }
 
+void release_free_fiber(u32 fiber_idx)
+{
+    atomic_u64 *free_head = &g_bedrock->free_head[g_bedrock->fibers[fiber_idx].stack_class];
+    u64 head = lake_atomic_read_explicit(free_head, lake_memory_model_relaxed);
+    u64 desired;
+    do {
+        lake_atomic_write_explicit(&g_bedrock->fibers[fiber_idx].free_next, (u32)head, lake_memory_model_relaxed);
+        desired = (((head >> 32) + 1lu) << 32) | (u64)fiber_idx;
+    } while (!lake_atomic_compare_exchange_weak_explicit(free_head, &head, 
+                desired, lake_memory_model_release, lake_memory_model_relaxed));
+}
+
+/** How many times an idle worker will look for work, before it parks on the futex. */
+#define IDLE_SPIN_COUNT 64
+
+bool wake_parked_worker(struct tls *tls)
+{
+    if (lake_atomic_read_explicit(&tls->parked, lake_memory_model_relaxed) == 0) return false;
+    if (lake_atomic_exchange_explicit(&tls->parked, 0u, lake_memory_model_release) == 0) return false;
+    sys_futex_wake(&tls->parked, 1);
+    return true;
+}
+
+/* Must be called after the new work (or a resumable fiber) was published, the fence pairs 
+ * with the one in `fiber_search()`, so either the sleeper sees the new work, or we see the sleeper. */
+void wake_idle_workers(u32 count)
+{
+    lake_atomic_thread_fence(lake_memory_model_seq_cst);
+    if (lake_atomic_read_explicit(&g_bedrock->sleepers, lake_memory_model_relaxed) == 0) return;
+
+    for (s32 i = 0; i < g_bedrock->thread_count && count > 0; i++)
+        if (wake_parked_worker(&g_bedrock->tls[i])) count--;
+}
+
+/** Wakes the workers that parked while holding a fiber that waits on `holding`, a chain or 
+ *  a wait list. Must be called after the condition they wait for was published, as above. */
+static void wake_holding_workers(void const *holding)
+{
+    lake_atomic_thread_fence(lake_memory_model_seq_cst);
+    if (lake_atomic_read_explicit(&g_bedrock->sleepers, lake_memory_model_relaxed) == 0) return;
+
+    for (s32 i = 0; i < g_bedrock->thread_count; i++) {
+        struct tls *tls = &g_bedrock->tls[i];
+        if (lake_atomic_read_explicit(&tls->parked_holding, lake_memory_model_relaxed) == (usize)holding)
+            wake_parked_worker(tls);
+    }
+}
+
+/** The wait list of a chain. Chains are always acquired from `g_bedrock->locks`. */
+LAKE_FORCE_INLINE atomic_u32 *get_chain_waiters(atomic_usize *chain)
+{
+    usize const chain_idx = (usize)(chain - g_bedrock->locks);
+    lake_dbg_assert(chain_idx < (usize)g_bedrock->fiber_count, LAKE_INVALID_PARAMETERS, 
+            "The work chain was not acquired from the job system.");
+    return &g_bedrock->waiters[chain_idx];
+}
+
+/** Makes a fiber that waited on a chain available to any worker thread. */
+static void push_ready_fiber(u32 fiber_idx)
+{
+    bool const ok = lake_mpmc_enqueue_t(&g_bedrock->ready.ring, ready_fiber_node, &fiber_idx);
+    /* every fiber is in the ring at most once, and the ring can hold all of them */
+    lake_dbg_assert(ok, LAKE_PANIC, "The ready fiber ring is full.");
+    (void)ok;
+}
+
+/** How many fibers are moved into the ready ring with a single claim. */
+#define READY_BATCH_SIZE 32
+
+/** Makes many fibers available at once, the ring position is claimed once per batch. */
+static void push_ready_fibers(u32 const *fiber_indices, u32 count)
+{
+    while (count > 0) {
+        s32 const pushed = lake_mpmc_enqueue_n_t(&g_bedrock->ready.ring, ready_fiber_node, fiber_indices, (s32)count);
+        /* every fiber is in the ring at most once, and the ring can hold all of them */
+        lake_dbg_assert(pushed > 0, LAKE_PANIC, "The ready fiber ring is full.");
+        fiber_indices += pushed;
+        count -= (u32)pushed;
+    }
+}
+
+/** Called once the chain reaches zero. Closes it's wait list, so no fiber will be added 
+ *  to it anymore, and moves every fiber that was waiting on it into the ready ring. */
+static void close_chain(atomic_usize *chain)
+{
+    trace_work_event(trace_event_chain_done, nullptr, (u32)(chain - g_bedrock->locks));
+    u32 fiber_idx = lake_atomic_exchange_explicit(get_chain_waiters(chain), 
+            CHAIN_CLOSED, lake_memory_model_acq_rel);
+    lake_dbg_assert(fiber_idx != CHAIN_CLOSED, LAKE_PANIC, "The work chain was closed twice.");
+
+    /* A fiber that is still switching out is held by a worker searching for something else 
+     * to run, it's not in the wait list yet. If that worker parked, it's woken up to resume it. */
+    wake_holding_workers(chain);
+
+    u32 batch[READY_BATCH_SIZE];
+    u32 batch_count = 0;
+    u32 ready_count = 0;
+    while (fiber_idx != FREE_FIBER_END) {
+        u32 const next = g_bedrock->fibers[fiber_idx].wait_next;
+        batch[batch_count++] = fiber_idx;
+        if (batch_count == READY_BATCH_SIZE) {
+            push_ready_fibers(batch, batch_count);
+            batch_count = 0;
+        }
+        fiber_idx = next;
+        ready_count++;
+    }
+    push_ready_fibers(batch, batch_count);
+    if (ready_count) wake_idle_workers(ready_count);
+}
+
+/** Adds a fiber to the wait list of it's chain, this must happen after the fiber was 
+ *  switched out. If the chain was closed in the meantime, the fiber is ready to run. */
+static void wait_on_chain(u32 fiber_idx)
+{
+    struct fiber *fiber = &g_bedrock->fibers[fiber_idx];
+    atomic_u32 *waiters = get_chain_waiters(fiber->wait_counter);
+
+    u32 head = lake_atomic_read_explicit(waiters, lake_memory_model_relaxed);
+    do {
+        if (head == CHAIN_CLOSED) {
+            push_ready_fiber(fiber_idx);
+            wake_idle_workers(1);
+            return;
+        }
+        fiber->wait_next = head;
+    } while (!lake_atomic_compare_exchange_weak_explicit(waiters, &head, 
+                fiber_idx, lake_memory_model_release, lake_memory_model_relaxed));
+}
+
+/** Wait lists hold fiber indices offset by one, so a zeroed wait list is empty. */
+#define WAIT_LIST_END 0u
+
+/** Adds a fiber to the wait list it parks on, this must happen after the fiber was 
+ *  switched out. If the condition to park no longer holds, the fiber is ready to run. */
+static void park_on_wait_list(u32 fiber_idx)
+{
+    struct fiber *fiber = &g_bedrock->fibers[fiber_idx];
+    struct fiber_park const *park = fiber->park;
+    lake_fiber_wait_list *list = park->list;
+
+    lake_spinlock_acquire(&list->lock);
+    lake_atomic_sub_explicit(&list->pending, 1u, lake_memory_model_relaxed);
+    bool const parked = park->should_park(park->context);
+    if (parked) {
+        /* fibers are appended at the tail, so they are resumed in order */
+        fiber->wait_next = WAIT_LIST_END;
+        if (list->head == WAIT_LIST_END) {
+            list->head = fiber_idx + 1;
+        } else {
+            g_bedrock->fibers[list->tail - 1].wait_next = fiber_idx + 1;
+        }
+        list->tail = fiber_idx + 1;
+    }
+    lake_spinlock_release(&list->lock);
+
+    if (!parked) {
+        push_ready_fiber(fiber_idx);
+        wake_idle_workers(1);
+    }
+}
+
 static void update_free_and_waiting(struct tls *tls)
 {
     if (tls->fiber_old == (u32)FIBER_INVALID) return;
 
     usize const fiber_idx = tls->fiber_old & tls_mask;
 
-    /* a thread that added the fiber to the free list is the same as the one freeing it */
+    /* the fiber is pushed only now, after we have switched away from it's stack */
     if (tls->fiber_old & tls_to_free)
-        lake_atomic_write_explicit(&g_bedrock->free[fiber_idx], fiber_idx, lake_memory_model_relaxed);
+        release_free_fiber((u32)fiber_idx);
 
-    /* wait threshold needs to be thread synced, so a CPU fence is welcome */
-    if (tls->fiber_old & tls_to_wait)
-        lake_atomic_write_explicit(&g_bedrock->waiting[fiber_idx], fiber_idx, lake_memory_model_release);
+    if (tls->fiber_old & tls_to_wait) {
+        if (g_bedrock->fibers[fiber_idx].park != nullptr) {
+            park_on_wait_list((u32)fiber_idx);
+        } else {
+            wait_on_chain((u32)fiber_idx);
+        }
+    }
 
     tls->fiber_old = (u32)FIBER_INVALID;
 }
 
-static LAKE_NORETURN void LAKECALL the_work(sptr raw_tls);
+/** Only the owner of the deque may push work. Returns false if the deque is full. */
+static bool deque_push(struct work_deque *deq, struct work const *work)
+{
+    ssize const b = lake_atomic_read_explicit(&deq->bottom, lake_memory_model_relaxed);
+    ssize const t = lake_atomic_read_explicit(&deq->top, lake_memory_model_acquire);
+
+    if (b - t > deq->buffer_mask) return false;
 
-static usize acquire_next_fiber(void)
+    deq->buffer[b & deq->buffer_mask] = *work;
+    lake_atomic_thread_fence(lake_memory_model_release);
+    lake_atomic_write_explicit(&deq->bottom, b + 1, lake_memory_model_relaxed);
+    return true;
+}
+
+/** Pushes a run of work of the same priority, as much of it as there is room for. All of it is 
+ *  published to thieves with a single store. Only the owner of the deque may push work. 
+ *  Returns how many were pushed, 0 if the deque is full. */
+static u32 deque_push_n(
+    struct work_deque       *deq, 
+    lake_work_details const *details, 
+    u32                      count, 
+    atomic_usize            *work_left)
 {
-    usize fiber_idx = FIBER_INVALID;
+    ssize const b = lake_atomic_read_explicit(&deq->bottom, lake_memory_model_relaxed);
+    ssize const t = lake_atomic_read_explicit(&deq->top, lake_memory_model_acquire);
+    ssize const room = deq->buffer_mask + 1 - (b - t);
 
-    for (s32 i = 0; i < g_bedrock->fiber_count; i++) {
-        /* double lock helps CPUs that have a weak memory model, ARM should 
-         * go 2x to 3x faster using double lock, if it is the bottleneck */
-        usize fiber_waiting = lake_atomic_read_explicit(&g_bedrock->waiting[i], lake_memory_model_relaxed);
-        if (fiber_waiting == FIBER_INVALID) continue;
+    u32 pushed = 0;
+    while (pushed < count && (ssize)pushed < room && details[pushed].priority == details[0].priority) {
+        deq->buffer[(b + pushed) & deq->buffer_mask] = (struct work){ 
+            .details = details[pushed], 
+            .work_left = work_left,
+        };
+        pushed++;
+    }
+    if (pushed == 0) return 0;
 
-        fiber_waiting = lake_atomic_read_explicit(&g_bedrock->waiting[i], lake_memory_model_acquire);
-        if (fiber_waiting == FIBER_INVALID) continue;
+    lake_atomic_thread_fence(lake_memory_model_release);
+    lake_atomic_write_explicit(&deq->bottom, b + pushed, lake_memory_model_relaxed);
+    return pushed;
+}
 
-        struct fiber *fiber = &g_bedrock->fibers[fiber_waiting];
-        s32 finished = 1;
-        atomic_usize *counter = fiber->wait_counter;
+/** Only the owner of the deque may pop work, from the bottom of the deque. */
+static bool deque_pop(struct work_deque *deq, struct work *out_work)
+{
+    ssize const b = lake_atomic_read_explicit(&deq->bottom, lake_memory_model_relaxed) - 1;
+    lake_atomic_write_explicit(&deq->bottom, b, lake_memory_model_relaxed);
+    lake_atomic_thread_fence(lake_memory_model_seq_cst);
+    ssize t = lake_atomic_read_explicit(&deq->top, lake_memory_model_relaxed);
 
-        if (counter) {
-            usize left = lake_atomic_read(counter);
-            finished = (!left);
-        }
-        if (!finished) continue;
+    if (t > b) {
+        /* the deque was empty */
+        lake_atomic_write_explicit(&deq->bottom, b + 1, lake_memory_model_relaxed);
+        return false;
+    }
+    *out_work = deq->buffer[b & deq->buffer_mask];
+    if (t != b) return true;
 
-        usize expected = fiber_waiting;
-        if (lake_atomic_compare_exchange_weak_explicit(&g_bedrock->waiting[i], &expected,
-                FIBER_INVALID, lake_memory_model_release, lake_memory_model_relaxed))
-        {
-            fiber_idx = i;
-            break;
+    /* this is the last item, we race against thieves for it */
+    bool const won = lake_atomic_compare_exchange_strong_explicit(&deq->top, &t, t + 1, 
+            lake_memory_model_seq_cst, lake_memory_model_relaxed);
+    lake_atomic_write_explicit(&deq->bottom, b + 1, lake_memory_model_relaxed);
+    return won;
+}
+
+/** Any thread may steal work, from the top of the deque. */
+static bool deque_steal(struct work_deque *deq, struct work *out_work)
+{
+    ssize t = lake_atomic_read_explicit(&deq->top, lake_memory_model_acquire);
+    lake_atomic_thread_fence(lake_memory_model_seq_cst);
+    ssize const b = lake_atomic_read_explicit(&deq->bottom, lake_memory_model_acquire);
+
+    if (t >= b) return false;
+
+    /* If the CAS fails, the slot may have been overwritten by the owner 
+     * after we've read it, so the copied work must be discarded. */
+    struct work work = deq->buffer[t & deq->buffer_mask];
+    if (!lake_atomic_compare_exchange_strong_explicit(&deq->top, &t, t + 1,
+            lake_memory_model_seq_cst, lake_memory_model_relaxed))
+        return false;
+
+    *out_work = work;
+    return true;
+}
+
+/** The order in which the priority lanes are visited, most urgent first. */
+static lake_work_priority const g_lane_order[WORK_LANE_COUNT] = {
+    lake_work_priority_critical,
+    lake_work_priority_normal,
+    lake_work_priority_background,
+    lake_work_priority_streaming,
+};
+
+/** Starvation protection. Every n-th acquisition of a worker thread begins the scan 
+ *  from a lower priority lane, so a steady stream of urgent work can't starve the rest.
+ *  Returns an index into `g_lane_order`. */
+LAKE_FORCE_INLINE u32 lane_scan_start(struct tls *tls)
+{
+    u32 const tick = tls->lane_tick++;
+    if (!(tick & 63)) return 3; /* streaming */
+    if (!(tick & 15)) return 2; /* background */
+    if (!(tick & 3))  return 1; /* normal */
+    return 0;
+}
+
+bool push_local_work(lake_work_details const *details)
+{
+    struct work const work = { .details = *details, .work_left = nullptr };
+    return deque_push(get_work_deque(lake_worker_thread_index(), details->priority), &work);
+}
+
+/** How much foreign work a worker moves into it's own deques at once. */
+#define FOREIGN_ADOPT_COUNT 16
+
+/** Moves work submitted from foreign threads into the deques of this worker, so it's picked 
+ *  up by priority like any other work, and other workers can steal it from us. A worker that
+ *  has no room for it leaves the work to the others, cheap unless the ring has something. */
+static void adopt_foreign_work(s32 self)
+{
+    lake_mpmc_ring *ring = &g_bedrock->foreign.ring;
+    if (lake_likely(lake_atomic_read_explicit(&ring->enqueue_pos, lake_memory_model_relaxed) 
+                == lake_atomic_read_explicit(&ring->dequeue_pos, lake_memory_model_relaxed)))
+        return;
+
+    /* we don't know the priority before it's dequeued, every lane must have room */
+    for (u32 lane = 0; lane < WORK_LANE_COUNT; lane++) {
+        struct work_deque *deq = get_work_deque(self, lane);
+        ssize const b = lake_atomic_read_explicit(&deq->bottom, lake_memory_model_relaxed);
+        ssize const t = lake_atomic_read_explicit(&deq->top, lake_memory_model_acquire);
+        if (deq->buffer_mask + 1 - (b - t) < FOREIGN_ADOPT_COUNT) return;
+    }
+    struct work work;
+    for (u32 i = 0; i < FOREIGN_ADOPT_COUNT; i++) {
+        if (!lake_mpmc_dequeue_t(ring, foreign_work_node, &work)) break;
+        bool const ok = deque_push(get_work_deque(self, work.details.priority), &work);
+        lake_dbg_assert(ok, LAKE_PANIC, nullptr);
+        (void)ok;
+    }
+}
+
+/** Pops work from the deques owned by this worker thread, by priority. */
+static bool acquire_local_work(struct tls *tls, struct work *out_work)
+{
+    /* every pick goes through the seeded scheduler */
+    if (lake_unlikely(work_schedule_is_deterministic())) return false;
+
+    s32 const self = (s32)(tls - g_bedrock->tls);
+    u32 const start = lane_scan_start(tls);
+    poll_work_timers();
+    adopt_foreign_work(self);
+
+    for (u32 i = 0; i < WORK_LANE_COUNT; i++) {
+        u32 const lane = g_lane_order[(start + i) % WORK_LANE_COUNT];
+        if (deque_pop(get_work_deque(self, lane), out_work)) {
+            trace_work_event(trace_event_pop, out_work->details.name, lane);
+            return true;
         }
     }
-    if (fiber_idx == FIBER_INVALID) {
-        struct work data;
-        if (lake_mpmc_dequeue_t(&g_bedrock->work_queue.ring, work_queue_node, &data)) {
-            while (fiber_idx == FIBER_INVALID)
-                fiber_idx = get_free_fiber();
+    return false;
+}
 
-            struct fiber *fiber = &g_bedrock->fibers[fiber_idx];
-            fiber->work = data;
+/** Pops work from the deque owned by this worker thread, or steals work from other 
+ *  workers if our own deque is empty. Lanes are visited by priority, so urgent work 
+ *  of other workers is preferred over less urgent work of our own. Victims are visited 
+ *  round-robin, starting from a pseudo-random worker thread. */
+static bool acquire_work(struct tls *tls, struct work *out_work)
+{
+    s32 const thread_count = g_bedrock->thread_count;
+    s32 const self = (s32)(tls - g_bedrock->tls);
+    u32 const start = lane_scan_start(tls);
+
+    u32 seed = tls->steal_seed;
+    seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+    tls->steal_seed = seed;
+    s32 const first = (s32)(seed % (u32)thread_count);
+    poll_work_timers();
+    poll_worker_scaling();
+    adopt_foreign_work(self);
+
+    for (u32 l = 0; l < WORK_LANE_COUNT; l++) {
+        u32 const lane = g_lane_order[(start + l) % WORK_LANE_COUNT];
 
-            /* make_fcontext requires the top of the stack, as it grows downwards */
-            u8 *stack = &g_bedrock->stack[(fiber_idx + 1) * g_bedrock->stack_size];
-            make_fiber_context(&fiber->context, the_work, stack, g_bedrock->stack_size);
+        if (deque_pop(get_work_deque(self, lane), out_work)) {
+            trace_work_event(trace_event_pop, out_work->details.name, lane);
+            return true;
+        }
+
+        for (s32 i = 0; i < thread_count; i++) {
+            s32 const victim = (first + i) % thread_count;
+            if (victim == self) continue;
+            if (deque_steal(get_work_deque(victim, lane), out_work)) {
+                trace_work_event(trace_event_steal, out_work->details.name, (u32)victim);
+                return true;
+            }
         }
     }
+    return false;
+}
+
+static LAKE_NORETURN void LAKECALL the_work(sptr raw_tls);
+
+/** Prepares a free fiber to run the work from it's beginning. */
+static usize start_work_fiber(struct work const *work)
+{
+    usize fiber_idx = FIBER_INVALID;
+    while (fiber_idx == FIBER_INVALID)
+        fiber_idx = get_free_fiber(work->details.stack);
+
+    struct fiber *fiber = &g_bedrock->fibers[fiber_idx];
+    fiber->work = *work;
+
+    /* make_fcontext requires the top of the stack, as it grows downwards */
+    make_fiber_context(&fiber->context, the_work, fiber->stack, fiber->stack_size);
     return fiber_idx;
 }
 
+/** Counts the work in the deque that has a free fiber to start on. If `nth` is not UINT32_MAX, 
+ *  returns the position of the nth such work from the top instead. Every work is startable
+ *  as long as the largest stack class has a free fiber, then it's just the deque size. */
+static u32 count_startable_work(struct work_deque *deq, bool const *startable, u32 nth)
+{
+    ssize const t = lake_atomic_read_explicit(&deq->top, lake_memory_model_relaxed);
+    ssize const b = lake_atomic_read_explicit(&deq->bottom, lake_memory_model_relaxed);
+    if (startable[lake_fiber_stack_class_count - 1])
+        return nth != UINT32_MAX ? nth : (u32)(b - t);
+
+    u32 count = 0;
+    for (ssize i = t; i < b; i++) {
+        if (!startable[deq->buffer[i & deq->buffer_mask].details.stack]) continue;
+        if (count == nth) return (u32)(i - t);
+        count++;
+    }
+    return count;
+}
+
+/** Picks one of `candidate_count` things to run next, and records the decision. */
+static u32 next_schedule_decision(struct work_schedule *schedule, u32 candidate_count)
+{
+    u32 pick;
+    if (schedule->replay_cursor < schedule->replay_count) {
+        pick = schedule->replay[schedule->replay_cursor++] % candidate_count;
+    } else {
+        u64 x = schedule->rng;
+        x ^= x >> 12; x ^= x << 25; x ^= x >> 27;
+        schedule->rng = x;
+        pick = (u32)((x * 0x2545f4914f6cdd1dlu) >> 32) % candidate_count;
+    }
+    if (schedule->record) {
+        if (schedule->record_count < schedule->record_capacity)
+            schedule->record[schedule->record_count] = pick;
+        schedule->record_count++;
+    }
+    return pick;
+}
+
+/** The deterministic mode. Only worker 0 runs, so no one steals from it's deques and queued 
+ *  work can be taken from any position. The candidates are indexed by the ready fibers first, 
+ *  in the order they were made ready, then by the work in every lane from the top of it. */
+static usize acquire_scheduled_fiber(void)
+{
+    struct work_schedule *schedule = &g_bedrock->schedule;
+    poll_work_timers();
+    adopt_foreign_work(0);
+
+    u32 ready_idx;
+    while (lake_mpmc_dequeue_t(&g_bedrock->ready.ring, ready_fiber_node, &ready_idx))
+        schedule->ready[schedule->ready_count++] = ready_idx;
+
+    /* Work can start only if there is a free fiber with a stack large enough for it, we must 
+     * not pick work that would wait for a fiber, as no other worker would free one for us. */
+    bool startable[lake_fiber_stack_class_count + 1] = {0};
+    for (u32 c = lake_fiber_stack_class_count; c > 0; c--)
+        startable[c - 1] = startable[c] || (u32)lake_atomic_read_explicit(&g_bedrock->free_head[c - 1], 
+                    lake_memory_model_relaxed) != FREE_FIBER_END;
+
+    u32 candidate_count = schedule->ready_count;
+    for (u32 lane = 0; lane < WORK_LANE_COUNT; lane++)
+        candidate_count += count_startable_work(get_work_deque(0, lane), startable, UINT32_MAX);
+    if (candidate_count == 0) return FIBER_INVALID;
+
+    u32 pick = next_schedule_decision(schedule, candidate_count);
+    if (pick < schedule->ready_count) {
+        u32 const fiber_idx = schedule->ready[pick];
+        schedule->ready_count--;
+        lake_memmove(&schedule->ready[pick], &schedule->ready[pick + 1], sizeof(u32) * (schedule->ready_count - pick));
+        return fiber_idx;
+    }
+    pick -= schedule->ready_count;
+
+    for (u32 lane = 0; lane < WORK_LANE_COUNT; lane++) {
+        struct work_deque *deq = get_work_deque(0, lane);
+        ssize const t = lake_atomic_read_explicit(&deq->top, lake_memory_model_relaxed);
+        ssize const b = lake_atomic_read_explicit(&deq->bottom, lake_memory_model_relaxed);
+        u32 const count = count_startable_work(deq, startable, UINT32_MAX);
+        if (pick >= count) {
+            pick -= count;
+            continue;
+        }
+        /* move the picked work to the bottom, and pop it from there */
+        struct work *picked = &deq->buffer[(t + count_startable_work(deq, startable, pick)) & deq->buffer_mask];
+        struct work *last = &deq->buffer[(b - 1) & deq->buffer_mask];
+        struct work data = *picked;
+        *picked = *last;
+        *last = data;
+
+        bool const ok = deque_pop(deq, &data);
+        lake_dbg_assert(ok, LAKE_PANIC, nullptr);
+        (void)ok;
+        trace_work_event(trace_event_pop, data.details.name, lane);
+        return start_work_fiber(&data);
+    }
+    LAKE_UNREACHABLE;
+}
+
+static usize acquire_next_fiber(struct tls *tls)
+{
+    if (lake_unlikely(work_schedule_is_deterministic()))
+        return acquire_scheduled_fiber();
+
+    /* fibers that waited on a finished chain are resumed first */
+    u32 ready_idx;
+    if (lake_mpmc_dequeue_t(&g_bedrock->ready.ring, ready_fiber_node, &ready_idx))
+        return ready_idx;
+
+    struct work data;
+    if (acquire_work(tls, &data))
+        return start_work_fiber(&data);
+    return FIBER_INVALID;
+}
+
+/** Takes back the announcement to park, the worker may have been woken up already. */
+static void unpark_worker(struct tls *tls)
+{
+    lake_atomic_write_explicit(&tls->parked, 0u, lake_memory_model_relaxed);
+    lake_atomic_write_explicit(&tls->parked_holding, 0lu, lake_memory_model_relaxed);
+    lake_atomic_sub_explicit(&g_bedrock->sleepers, 1u, lake_memory_model_relaxed);
+}
+
 struct tls *fiber_search(struct tls *tls, fcontext *context)
 {
     struct fiber *old = nullptr;
     atomic_usize *wait_counter = nullptr;
+    struct fiber_park *park = nullptr;
     
     if ((tls->fiber_old != (u32)FIBER_INVALID) && (tls->fiber_old & tls_to_wait)) {
         usize const fiber_idx = tls->fiber_old & tls_mask;
         old = &g_bedrock->fibers[fiber_idx];
         wait_counter = old->wait_counter;
+        park = old->park;
     }
 
+    u32 const self = (u32)(tls - g_bedrock->tls);
+    u32 idle_spins = 0;
     for (;;) {
-        usize fiber_idx = acquire_next_fiber();
+        /* A worker that is not active parks until it's needed again. It must not hold a fiber 
+         * that waits, no one could wake us up to resume it - we'll retire once it's switched out. */
+        if (lake_unlikely(self >= lake_atomic_read_explicit(&g_bedrock->scaling.active_limit, 
+                        lake_memory_model_relaxed)) && old == nullptr) {
+            /* We still run on the stack of a finished fiber, it can't be released until we leave 
+             * it. The worker retires from it's home context, or the fiber would be stranded. */
+            if (tls->fiber_old != (u32)FIBER_INVALID) {
+                tls->retiring = true;
+                return (struct tls *)jump_fiber_context(tls, context, &tls->home_context);
+            }
+            retire_worker(self);
+            continue;
+        }
+        /* After failing to find work for a while, the worker announces it is going to sleep 
+         * and looks for work one last time. Anyone publishing work after our last look must 
+         * see the sleepers count and clear our futex, so the futex wait can't miss a wakeup. */
+        bool const parking = idle_spins >= IDLE_SPIN_COUNT;
+        if (parking) {
+            lake_atomic_write_explicit(&tls->parked_holding, 
+                    wait_counter ? (usize)wait_counter : park ? (usize)park->list : 0lu, lake_memory_model_relaxed);
+            lake_atomic_write_explicit(&tls->parked, 1u, lake_memory_model_relaxed);
+            lake_atomic_add_explicit(&g_bedrock->sleepers, 1u, lake_memory_model_relaxed);
+            lake_atomic_thread_fence(lake_memory_model_seq_cst);
+        }
+        usize fiber_idx = acquire_next_fiber(tls);
 
         if (fiber_idx != FIBER_INVALID) {
+            if (parking) unpark_worker(tls);
             struct fiber *fiber = &g_bedrock->fibers[fiber_idx];
             tls->fiber_in_use = (u32)fiber_idx;
 
-            /* inherit information from the last fiber */
+            /* Inherit information from the last fiber. Not it's drift memory or the log buffer 
+             * within it, another worker may resume it while this fiber still runs. */
             if (old != nullptr) {
-                if (old->drifter.head) 
-                    fiber->drifter = old->drifter;
                 fiber->logger.depth = 1 + old->logger.depth;
                 if (old->logger.should_flush)
                     flush_logger(&old->logger);
-                fiber->logger.buf = old->logger.buf;
             }
             return (struct tls *)jump_fiber_context(tls, context, &fiber->context);
         }
@@ -152,14 +645,40 @@ struct tls *fiber_search(struct tls *tls, fcontext *context)
          * the "to be swapped" context is waiting to be run, but cannot as it hasn't been 
          * swapped out yet (in order to be picked up by the wait list). */
         if (wait_counter) {
-            usize count = lake_atomic_read_explicit(wait_counter, lake_memory_model_relaxed);
+            usize count = lake_atomic_read_explicit(wait_counter, lake_memory_model_acquire);
 
             if (!count) {
+                if (parking) unpark_worker(tls);
                 /* variable `tls->fiber_in_use` still points to the "to waitlist" fiber */
                 tls->fiber_old = (u32)FIBER_INVALID;
                 return tls;
             }
         }
+        /* The same applies to a fiber parking on a wait list, it's not in the list until 
+         * we switch away from it, so no one can wake it up. A fiber that no longer has to 
+         * park is resumed right away, and a wake-up sees the `pending` count and wakes us. */
+        if (park && !park->should_park(park->context)) {
+            if (parking) unpark_worker(tls);
+            lake_atomic_sub_explicit(&park->list->pending, 1u, lake_memory_model_relaxed);
+            tls->fiber_old = (u32)FIBER_INVALID;
+            return tls;
+        }
+
+        if (parking) {
+            /* one of the parked workers wakes up when the next timer is due */
+            u64 timeout_ns = UINT64_MAX;
+            bool const keeper = acquire_timer_keeper(&timeout_ns);
+            u64 const idle_since = lake_rtc_counter();
+            lake_atomic_write_explicit(&tls->idle_since, idle_since, lake_memory_model_relaxed);
+            sys_futex_wait(&tls->parked, 1u, timeout_ns);
+            lake_atomic_write_explicit(&tls->idle_since, 0lu, lake_memory_model_relaxed);
+            lake_atomic_add_explicit(&tls->idle_ticks, lake_rtc_counter() - idle_since, lake_memory_model_relaxed);
+            if (keeper) release_timer_keeper();
+            unpark_worker(tls);
+            idle_spins = 0;
+        } else {
+            idle_spins++;
+        }
     }
     LAKE_UNREACHABLE;
 }
@@ -170,11 +689,18 @@ void *LAKECALL dirty_deeds_done_dirt_cheap(void *raw_tls)
 
     /* we need to wait for the main thread to be ready */
     while (!lake_atomic_read_explicit(&g_bedrock->tls_sync, lake_memory_model_acquire)){/* spin */};
+    t_worker_thread_index = (u32)(tls - g_bedrock->tls);
+    t_worker_thread = true;
 
     tls->fiber_old = (u32)FIBER_INVALID;
-    tls = fiber_search(tls, &tls->home_context);
+    for (;;) {
+        tls = fiber_search(tls, &tls->home_context);
+        update_free_and_waiting(tls);
 
-    update_free_and_waiting(tls);
+        /* we're back to retire, otherwise it's the end */
+        if (!tls->retiring) break;
+        tls->retiring = false;
+    }
     return nullptr;
 }
 
@@ -194,38 +720,62 @@ static LAKE_NORETURN void LAKECALL the_work(sptr raw_tls)
     fiber->logger.should_flush = false;
 
     for (;;) { /* do the work */
+        u32 const fiber_idx = (u32)(fiber - g_bedrock->fibers);
+        trace_work_event(trace_event_work_begin, fiber->work.details.name, fiber_idx);
+        account_work_begin(&fiber->clock);
         fiber->work.details.procedure(fiber->work.details.argument);
+        if (fiber->clock.begin) account_work_end(&fiber->clock, fiber->work.details.name);
+        trace_work_event(trace_event_work_end, fiber->work.details.name, fiber_idx);
 
-        if (fiber->logger.should_flush) 
+        if (fiber->logger.should_flush)
             flush_logger(&fiber->logger);
+        /* the log buffer was drifted by this work, it won't survive the rewind below */
+        if (fiber->logger.tail_cursor == &fiber->cursor) {
+            fiber->logger.tail_cursor = nullptr;
+            fiber->logger.buf = (lake_strbuf){0};
+        }
         /* release unnecessary resources */
         if (fiber->drifter.head != nullptr) {
-            for (struct region *page = fiber->drifter.tail_page->next; page != nullptr; page = page->next)
-                if (page->alloc) release_heap_bitmap(g_bedrock->bitmap, page->v, page->alloc);
+            /* rewind to where the work started, the region header lives in the page it releases */
+            struct region *next = fiber->cursor.tail ? fiber->cursor.tail->next : fiber->drifter.head->next;
+            for (struct region *page = next; page != nullptr; page = next) {
+                next = page->next;
+                if (page->alloc) release_cached_blocks(page->v, page->alloc);
+            }
             if (fiber->cursor.tail) {
                 fiber->drifter.tail_page = fiber->cursor.tail;
                 fiber->drifter.tail_page->offset = fiber->cursor.offset;
+            } else {
+                fiber->drifter.tail_page = fiber->drifter.head;
+                fiber->drifter.tail_page->offset = sizeof(struct region);
             }
             fiber->drifter.tail_page->next = nullptr;
         }
 
         /* decrement the chain */
         if (fiber->work.work_left) {
-            usize last = lake_atomic_sub(fiber->work.work_left, 1lu);
+            usize last = lake_atomic_sub_explicit(fiber->work.work_left, 1lu, lake_memory_model_acq_rel);
             lake_dbg_assert(last > 0, LAKE_PANIC, nullptr);
 
-            /* try to reuse the fiber */
-            if (last > 1 && lake_mpmc_dequeue_t(
-                    &g_bedrock->work_queue.ring, 
-                    work_queue_node, 
-                    &fiber->work)) 
-                continue;
+            /* the chain is done, fibers waiting on it can be resumed */
+            if (last == 1) close_chain(fiber->work.work_left);
+
+            /* try to reuse the fiber, only local work is considered here */
+            if (last > 1 && acquire_local_work(get_thread_local_storage(), &fiber->work)) {
+                if (fiber->work.details.stack <= fiber->stack_class)
+                    continue;
+                /* the stack is too small, we own the deque and just made room in it */
+                bool const ok = deque_push(get_work_deque(lake_worker_thread_index(), 
+                            fiber->work.details.priority), &fiber->work);
+                lake_dbg_assert(ok, LAKE_PANIC, nullptr);
+                (void)ok;
+            }
         }
         fiber->drifter.tail_cursor = fiber->cursor.prev;
         /* if we own the drifter, destroy it */
         if (fiber->drifter.tail_cursor == nullptr && fiber->drifter.head) {
             struct region *page = fiber->drifter.head;
-            release_heap_bitmap(g_bedrock->bitmap, page->v, page->alloc);
+            release_cached_blocks(page->v, page->alloc);
             fiber->drifter = (struct drifter){0};
         }
 
@@ -255,6 +805,10 @@ lake_work_chain lake_acquire_chain_n(usize initial_value)
                 if (lake_atomic_compare_exchange_weak_explicit(lock, &expected,
                         initial_value, lake_memory_model_relaxed, lake_memory_model_relaxed))
                 {
+                    /* Reopen the wait list, it was closed when the chain was last used. A chain 
+                     * that starts at zero won't be decremented, so it's wait list stays closed. */
+                    lake_atomic_write_explicit(&g_bedrock->waiters[i], 
+                            initial_value ? FREE_FIBER_END : CHAIN_CLOSED, lake_memory_model_release);
                     return (lake_work_chain)lock;
                 }
             }
@@ -263,6 +817,73 @@ lake_work_chain lake_acquire_chain_n(usize initial_value)
     LAKE_UNREACHABLE;
 }
 
+/** Runs work that was taken out of a full deque, on a fiber of it's own stack class. */
+static void LAKECALL run_spilled_work(struct work const *work)
+{
+    work->details.procedure(work->details.argument);
+    if (work->work_left) {
+        usize last = lake_atomic_sub_explicit(work->work_left, 1lu, lake_memory_model_acq_rel);
+        lake_dbg_assert(last > 0, LAKE_PANIC, nullptr);
+        if (last == 1) close_chain(work->work_left);
+    }
+}
+
+/** Makes room in a full deque. The newest queued work is handed to a fresh fiber through 
+ *  the bottom of the deque, and the submitting fiber yields until it's done. This worker 
+ *  runs it next, even with no other thread to steal it, and it gets a stack of the class 
+ *  it asked for - the submitter's stack is partly used and may be of a smaller class. */
+static void spill_work(struct work_deque *deq)
+{
+    struct work work;
+
+    /* the deque may have been stolen from meanwhile, then there is room already */
+    if (!deque_pop(deq, &work)) return;
+
+    lake_work_chain chain = lake_acquire_chain();
+    struct work const handoff = {
+        .details = {
+            .procedure = (PFN_lake_work)run_spilled_work,
+            .argument = &work,
+            .name = work.details.name,
+            .priority = work.details.priority,
+            .stack = work.details.stack,
+        },
+        .work_left = chain,
+    };
+    /* we own the deque and just made room in it */
+    bool const ok = deque_push(deq, &handoff);
+    lake_dbg_assert(ok, LAKE_PANIC, nullptr);
+    (void)ok;
+    lake_yield(chain);
+}
+
+/** Submits the work to the deques of this worker, it's chained with `work_left` if not nullptr. */
+static void submit_work(
+    u32                      work_count, 
+    lake_work_details const *work, 
+    atomic_usize            *work_left)
+{
+    for (u32 i = 0; i < work_count; i++) {
+        lake_dbg_assert(work[i].priority < lake_work_priority_count, LAKE_INVALID_PARAMETERS, 
+                "Invalid work priority %u at: %u/%u.", work[i].priority, i, work_count);
+        lake_dbg_assert(work[i].stack < lake_fiber_stack_class_count, LAKE_INVALID_PARAMETERS, 
+                "Invalid fiber stack class %u at: %u/%u.", work[i].stack, i, work_count);
+    }
+    /* Runs of the same priority are pushed together. If the deque is full, instead of waiting
+     * for other workers to steal from it we run some of the queued work ourselves. Spilled 
+     * work may yield and resume this fiber on another thread, so the deque is looked up again. */
+    for (u32 i = 0; i < work_count;) {
+        struct work_deque *deq = get_work_deque(lake_worker_thread_index(), work[i].priority);
+        u32 const pushed = deque_push_n(deq, &work[i], work_count - i, work_left);
+        if (pushed == 0) spill_work(deq);
+        i += pushed;
+    }
+    /* a burst may need the workers that were retired */
+    poll_worker_scaling();
+    /* the submitting worker will run some of it itself, but that's fine */
+    wake_idle_workers(work_count);
+}
+
 void lake_submit_work(
     u32                      work_count, 
     lake_work_details const *work, 
@@ -270,20 +891,109 @@ void lake_submit_work(
 {
     atomic_usize *to_use = nullptr;
     lake_san_assert(g_bedrock != nullptr, LAKE_FRAMEWORK_REQUIRED, nullptr);
+    lake_dbg_assert(t_worker_thread, LAKE_INVALID_PARAMETERS, 
+            "Work must be submitted with `lake_submit_foreign_work()` from outside of the job system.");
 
     if (out_chain) {
         *out_chain = lake_acquire_chain_n(work_count);
         to_use = (atomic_usize *)*out_chain;
     }
+    submit_work(work_count, work, to_use);
+}
 
-    for (u32 i = 0; i < work_count; i++) {
-        struct work submit = { .details = work[i], .work_left = to_use };
+u32 lake_submit_foreign_work(
+    u32                      work_count, 
+    lake_work_details const *work)
+{
+    lake_san_assert(g_bedrock != nullptr, LAKE_FRAMEWORK_REQUIRED, nullptr);
+    if (t_worker_thread) {
+        submit_work(work_count, work, nullptr);
+        return work_count;
+    }
+    struct work submit[FOREIGN_ADOPT_COUNT];
+    u32 submitted = 0;
 
-        while (!lake_mpmc_enqueue_t(&g_bedrock->work_queue.ring, work_queue_node, &submit)) {
-            lake_dbg_assert(false, LAKE_ERROR_OUT_OF_RANGE, 
-                "Failed to submit work into the work queue at: %u/%u.", i, work_count);
+    /* no locks and no waiting, the ring may be full and the rest is left to the caller */
+    while (submitted < work_count) {
+        u32 const count = lake_min(work_count - submitted, FOREIGN_ADOPT_COUNT);
+        for (u32 i = 0; i < count; i++) {
+            lake_dbg_assert(work[submitted + i].priority < lake_work_priority_count, LAKE_INVALID_PARAMETERS, 
+                    "Invalid work priority %u at: %u/%u.", work[submitted + i].priority, submitted + i, work_count);
+            lake_dbg_assert(work[submitted + i].stack < lake_fiber_stack_class_count, LAKE_INVALID_PARAMETERS, 
+                    "Invalid fiber stack class %u at: %u/%u.", work[submitted + i].stack, submitted + i, work_count);
+            submit[i] = (struct work){ .details = work[submitted + i], .work_left = nullptr };
         }
+        s32 const pushed = lake_mpmc_enqueue_n_t(&g_bedrock->foreign.ring, foreign_work_node, submit, (s32)count);
+        submitted += (u32)pushed;
+        if ((u32)pushed < count) break;
+    }
+    if (submitted) wake_idle_workers(submitted);
+    return submitted;
+}
+
+void lake_work_batch_flush(lake_work_batch *batch)
+{
+    lake_san_assert(g_bedrock != nullptr, LAKE_FRAMEWORK_REQUIRED, nullptr);
+    if (batch->count == 0) return;
+
+    /* the batch holds a reference of it's own, so the chain can't complete between flushes */
+    if (batch->chain == nullptr) {
+        batch->chain = lake_acquire_chain_n(batch->count + 1lu);
+    } else {
+        lake_atomic_add_explicit(batch->chain, (usize)batch->count, lake_memory_model_relaxed);
+    }
+    submit_work(batch->count, batch->work, batch->chain);
+    batch->count = 0;
+}
+
+void lake_work_batch_yield(lake_work_batch *batch)
+{
+    lake_work_batch_flush(batch);
+    lake_work_chain chain = batch->chain;
+    if (chain == nullptr) return;
+
+    batch->chain = nullptr;
+    usize const last = lake_atomic_sub_explicit(chain, 1lu, lake_memory_model_acq_rel);
+    if (last == 1) close_chain(chain);
+    lake_yield(chain);
+}
+
+void lake_work_schedule_record(u32 capacity, u32 *decisions)
+{
+    lake_san_assert(g_bedrock != nullptr, LAKE_FRAMEWORK_REQUIRED, nullptr);
+    struct work_schedule *schedule = &g_bedrock->schedule;
+    lake_dbg_assert(work_schedule_is_deterministic(), LAKE_INVALID_PARAMETERS, "The job system is not in the deterministic mode.");
+
+    /* when stopped, the count is kept until the next recording starts */
+    if (decisions) {
+        schedule->record_capacity = capacity;
+        schedule->record_count = 0;
     }
+    schedule->record = decisions;
+}
+
+u32 lake_work_schedule_recorded(void)
+{
+    lake_san_assert(g_bedrock != nullptr, LAKE_FRAMEWORK_REQUIRED, nullptr);
+    return g_bedrock->schedule.record_count;
+}
+
+void lake_work_schedule_replay(u32 count, u32 const *decisions)
+{
+    lake_san_assert(g_bedrock != nullptr, LAKE_FRAMEWORK_REQUIRED, nullptr);
+    struct work_schedule *schedule = &g_bedrock->schedule;
+    lake_dbg_assert(work_schedule_is_deterministic(), LAKE_INVALID_PARAMETERS, "The job system is not in the deterministic mode.");
+
+    schedule->replay = decisions;
+    schedule->replay_count = decisions ? count : 0;
+    schedule->replay_cursor = 0;
+}
+
+void lake_release_chain(lake_work_chain chain)
+{
+    /* a chain that already reached zero was closed by whoever brought it there */
+    if (lake_atomic_exchange_explicit(chain, 0lu, lake_memory_model_acq_rel) != 0)
+        close_chain(chain);
 }
 
 void lake_yield(lake_work_chain chain)
@@ -292,7 +1002,7 @@ void lake_yield(lake_work_chain chain)
     lake_san_assert(g_bedrock != nullptr, LAKE_FRAMEWORK_REQUIRED, nullptr);
 
     if (chain) {
-        wait_value = lake_atomic_read(chain);
+        wait_value = lake_atomic_read_explicit(chain, lake_memory_model_acquire);
         lake_dbg_assert(wait_value != FIBER_INVALID, LAKE_ERROR_OUT_OF_DATE, "The work chain has expired.");
     }
     if (wait_value) {
@@ -303,16 +1013,175 @@ void lake_yield(lake_work_chain chain)
 
         old->wait_counter = chain;
         tls->fiber_old = tls->fiber_in_use | tls_to_wait;
+        trace_work_event(trace_event_yield, old->work.details.name, (u32)(chain - g_bedrock->locks));
+        account_work_suspend(&old->clock);
         tls = fiber_search(tls, &old->context);
         update_free_and_waiting(tls);
+        account_work_resume(&old->clock);
+        trace_work_event(trace_event_resume, old->work.details.name, (u32)(old - g_bedrock->fibers));
+    }
+    if (chain) {
+        /* The chain reaches zero before it's wait list is closed, and the closing thread still 
+         * writes to it afterwards. Until it's closed, the slot can't be given to a new chain. */
+        atomic_u32 *waiters = get_chain_waiters(chain);
+        while (lake_atomic_read_explicit(waiters, lake_memory_model_acquire) != CHAIN_CLOSED){/* spin */};
+        lake_atomic_write_explicit(chain, FIBER_INVALID, lake_memory_model_release);
     }
-    if (chain) lake_atomic_write_explicit(chain, FIBER_INVALID, lake_memory_model_release);
+}
+
+void park_fiber(lake_fiber_wait_list *list, bool (*should_park)(void const *), void const *context)
+{
+    lake_san_assert(g_bedrock != nullptr, LAKE_FRAMEWORK_REQUIRED, nullptr);
+
+    struct tls *tls = get_thread_local_storage();
+    struct fiber *fiber = &g_bedrock->fibers[tls->fiber_in_use];
+    struct fiber_park park = {
+        .list = list,
+        .should_park = should_park,
+        .context = context,
+    };
+    /* pairs with the fence in `unpark_fibers()` */
+    lake_atomic_add_explicit(&list->pending, 1u, lake_memory_model_seq_cst);
+    if (fiber->logger.should_flush)
+        flush_logger(&fiber->logger);
+
+    fiber->wait_counter = nullptr;
+    fiber->park = &park;
+    tls->fiber_old = tls->fiber_in_use | tls_to_wait;
+    trace_work_event(trace_event_yield, fiber->work.details.name, UINT32_MAX);
+    account_work_suspend(&fiber->clock);
+    tls = fiber_search(tls, &fiber->context);
+    update_free_and_waiting(tls);
+    account_work_resume(&fiber->clock);
+    trace_work_event(trace_event_resume, fiber->work.details.name, (u32)(fiber - g_bedrock->fibers));
+    fiber->park = nullptr;
+}
+
+void unpark_fibers(lake_fiber_wait_list *list, u32 count)
+{
+    /* the state of the primitive was changed before, pairs with the fence in `park_fiber()` */
+    lake_atomic_thread_fence(lake_memory_model_seq_cst);
+
+    lake_spinlock_acquire(&list->lock);
+    u32 const first = list->head;
+    u32 woken = 0;
+    while (list->head != WAIT_LIST_END && woken < count) {
+        list->head = g_bedrock->fibers[list->head - 1].wait_next;
+        woken++;
+    }
+    bool const pending = lake_atomic_read_explicit(&list->pending, lake_memory_model_relaxed) != 0;
+    lake_spinlock_release(&list->lock);
+
+    /* the detached fibers are only ours now, read the link before the fiber may run again */
+    u32 batch[READY_BATCH_SIZE];
+    u32 batch_count = 0;
+    for (u32 i = 0, node = first; i < woken; i++) {
+        u32 const next = g_bedrock->fibers[node - 1].wait_next;
+        batch[batch_count++] = node - 1;
+        if (batch_count == READY_BATCH_SIZE) {
+            push_ready_fibers(batch, batch_count);
+            batch_count = 0;
+        }
+        node = next;
+    }
+    push_ready_fibers(batch, batch_count);
+    /* A fiber is switching out to park, but the worker holding it didn't find anything else 
+     * to run and may be asleep, as with `close_chain()`. */
+    if (pending) wake_holding_workers(list);
+    if (woken) wake_idle_workers(woken);
+}
+
+struct parallel_for {
+    PFN_lake_parallel_for   procedure;
+    void                   *argument;
+    usize                   count;
+    usize                   grain_size;
+    /** How many participants share the range, used to size the chunks. */
+    usize                   participants;
+    /** The start of the range that was not claimed yet. */
+    atomic_usize            next;
+};
+
+/** Claims a chunk of the remaining range, returns false if the whole range was claimed. */
+static bool claim_parallel_for_chunk(struct parallel_for *pf, usize *out_begin, usize *out_end)
+{
+    usize begin = lake_atomic_read_explicit(&pf->next, lake_memory_model_relaxed);
+    usize end;
+    do {
+        if (begin >= pf->count) return false;
+        usize const remaining = pf->count - begin;
+        usize const size = lake_max(pf->grain_size, remaining / (2 * pf->participants));
+        end = begin + lake_min(size, remaining);
+    } while (!lake_atomic_compare_exchange_weak_explicit(&pf->next, &begin, 
+                end, lake_memory_model_relaxed, lake_memory_model_relaxed));
+    *out_begin = begin;
+    *out_end = end;
+    return true;
+}
+
+static FN_LAKE_WORK(run_parallel_for, struct parallel_for *pf)
+{
+    usize begin, end;
+    while (claim_parallel_for_chunk(pf, &begin, &end))
+        pf->procedure(pf->argument, begin, end);
+}
+
+void lake_parallel_for(
+    usize                   count,
+    usize                   grain_size,
+    PFN_lake_parallel_for   procedure,
+    void                   *argument,
+    char const             *name)
+{
+    lake_san_assert(g_bedrock != nullptr, LAKE_FRAMEWORK_REQUIRED, nullptr);
+    if (count == 0) return;
+
+    usize const thread_count = (usize)g_bedrock->thread_count;
+    if (grain_size == 0)
+        grain_size = lake_max(1lu, count / (8 * thread_count));
+
+    usize const chunk_count = (count + grain_size - 1) / grain_size;
+    u32 const helper_count = (u32)lake_min(thread_count, chunk_count) - 1;
+
+    /* the state lives on our stack, we don't return until every helper is done with it */
+    struct parallel_for pf = {
+        .procedure = procedure,
+        .argument = argument,
+        .count = count,
+        .grain_size = grain_size,
+        .participants = helper_count + 1,
+    };
+    lake_atomic_init(&pf.next, 0lu);
+
+    lake_work_chain chain = nullptr;
+    if (helper_count > 0) {
+        struct tls *tls = get_thread_local_storage();
+        lake_work_details const *caller = &g_bedrock->fibers[tls->fiber_in_use].work.details;
+
+        /* the details are copied by the submit, they don't outlive this scope */
+        lake_drift_push();
+        lake_work_details *helpers = lake_drift_n(lake_work_details, helper_count);
+        for (u32 i = 0; i < helper_count; i++) {
+            helpers[i] = (lake_work_details){
+                .procedure = (PFN_lake_work)run_parallel_for,
+                .argument = &pf,
+                .name = name,
+                .priority = caller->priority,
+                .stack = caller->stack,
+            };
+        }
+        lake_submit_work(helper_count, helpers, &chain);
+        lake_drift_pop();
+    }
+    run_parallel_for(&pf);
+    /* helpers that started late will find the range already claimed */
+    lake_yield(chain);
 }
 
 static struct region *construct_drift_region(usize const block_aligned)
 {
     u8 *raw = (u8 *)g_bedrock;
-    usize block = acquire_blocks(block_aligned);
+    usize block = acquire_cached_blocks(block_aligned);
     lake_san_assert(block != 0lu, LAKE_ERROR_OUT_OF_HOST_MEMORY, nullptr);
 
     struct region *out = (struct region *)(void *)(uptr)(raw + block);
@@ -382,11 +1251,14 @@ void lake_drift_depth_op(s32 depth)
     struct drifter *d = &f->drifter;
 
     if (depth == __lake_drift_depth_op_entry__) {
+        /* the scope begins before it's cursor, so a push and pop called every frame don't grow */
+        struct region *tail = d->tail_page;
+        usize const offset = tail ? tail->offset : 0lu;
         struct drifter_cursor *cursor = (struct drifter_cursor *)
             drift_allocation(d, sizeof(struct drifter_cursor), alignof(struct drifter_cursor));
         cursor->tail = d->tail_page;
         cursor->prev = d->tail_cursor;
-        cursor->offset = d->tail_page->offset;
+        cursor->offset = tail == d->tail_page ? offset : d->tail_page->offset;
         d->tail_cursor = cursor;
     } else if (depth == __lake_drift_depth_op_leave__) {
         struct drifter_cursor *cursor = d->tail_cursor;
@@ -401,8 +1273,12 @@ void lake_drift_depth_op(s32 depth)
             f->logger.tail_cursor = nullptr;
             f->logger.buf = (lake_strbuf){0};
         }
-        for (struct region *page = cursor->tail->next; page != nullptr; page = page->next)
-            if (page->alloc) release_heap_bitmap(g_bedrock->bitmap, page->v, page->alloc);
+        /* the cursor itself may be overwritten by now */
+        struct region *next = d->tail_page->next;
+        for (struct region *page = next; page != nullptr; page = next) {
+            next = page->next;
+            if (page->alloc) release_cached_blocks(page->v, page->alloc);
+        }
         d->tail_page->next = nullptr;
 #ifndef LAKE_NDEBUG
     } else {
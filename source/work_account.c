@@ -0,0 +1,128 @@
+#include "internal.h"
+
+#include <stdlib.h>
+
+/** How many entries are probed for a name, before the job is accounted as "(other)". */
+#define ACCOUNT_PROBE_COUNT 16
+
+static char const g_other_name[] = "(other)";
+
+/** FNV-1a of the name, as it fits into an entry. Never returns 0, it marks an unused entry. */
+static u64 hash_account_name(char const *name)
+{
+    u64 hash = 0xcbf29ce484222325lu;
+    for (u32 i = 0; i < LAKE_WORK_ACCOUNT_NAME_SIZE - 1 && name[i]; i++) {
+        hash ^= (u8)name[i];
+        hash *= 0x100000001b3lu;
+    }
+    return hash ? hash : 1lu;
+}
+
+static bool account_name_equals(char const *entry, char const *name)
+{ return lake_strncmp(entry, name, LAKE_WORK_ACCOUNT_NAME_SIZE - 1) == 0; }
+
+static struct work_account *find_account(struct work_account *accounts, char const *name)
+{
+    u64 const hash = hash_account_name(name);
+
+    for (u32 i = 0; i < ACCOUNT_PROBE_COUNT; i++) {
+        struct work_account *account = &accounts[(hash + i) & (WORK_ACCOUNT_COUNT - 1)];
+        u64 const entry = lake_atomic_read_explicit(&account->hash, lake_memory_model_relaxed);
+
+        if (entry == 0) {
+            /* only this worker thread writes into it's table, publish the name with the hash */
+            lake_strncpy(account->name, name, LAKE_WORK_ACCOUNT_NAME_SIZE - 1);
+            lake_atomic_write_explicit(&account->hash, hash, lake_memory_model_release);
+            return account;
+        }
+        if (entry == hash && account_name_equals(account->name, name))
+            return account;
+    }
+    return &accounts[WORK_ACCOUNT_COUNT];
+}
+
+void account_work_end(struct work_clock *clock, char const *name)
+{
+    u64 const now = lake_rtc_counter();
+    clock->cpu += now - clock->mark;
+
+    struct tls *tls = get_thread_local_storage();
+    struct work_account *account = find_account(tls->accounts, name ? name : "(unnamed)");
+    lake_atomic_add_explicit(&account->count, 1lu, lake_memory_model_relaxed);
+    lake_atomic_add_explicit(&account->wall, now - clock->begin, lake_memory_model_relaxed);
+    lake_atomic_add_explicit(&account->cpu, clock->cpu, lake_memory_model_relaxed);
+    lake_atomic_add_explicit(&account->wait, clock->wait, lake_memory_model_relaxed);
+    clock->begin = 0;
+}
+
+void lake_work_accounting(bool enable)
+{
+    lake_san_assert(g_bedrock != nullptr, LAKE_FRAMEWORK_REQUIRED, nullptr);
+    lake_atomic_write_explicit(&g_bedrock->account_enabled, enable ? 1u : 0u, lake_memory_model_relaxed);
+}
+
+static s32 compare_accounts_by_cpu(void const *a, void const *b)
+{
+    lake_work_account const *x = (lake_work_account const *)a;
+    lake_work_account const *y = (lake_work_account const *)b;
+    if (x->cpu_ns != y->cpu_ns) return x->cpu_ns > y->cpu_ns ? -1 : 1;
+    return 0;
+}
+
+u32 lake_work_accounting_collect(u32 capacity, lake_work_account *out)
+{
+    lake_san_assert(g_bedrock != nullptr, LAKE_FRAMEWORK_REQUIRED, nullptr);
+    f64 const ns_per_tick = (f64)LAKE_NS_PER_SECOND / (f64)lake_rtc_frequency();
+
+    /* the merged table lives only until we return, an open addressing index finds the names */
+    lake_drift_push();
+    u32 const entry_count = (u32)g_bedrock->thread_count * (WORK_ACCOUNT_COUNT + 1);
+    u32 const index_count = lake_bits_next_pow2(entry_count);
+    lake_work_account *merged = lake_drift_n(lake_work_account, entry_count);
+    u64 *hashes = lake_drift_n(u64, entry_count);
+    u32 *index = lake_drift_n(u32, index_count);
+    lake_memset(index, 0xff, sizeof(u32) * index_count);
+    u32 merged_count = 0;
+
+    for (s32 t = 0; t < g_bedrock->thread_count; t++) {
+        struct work_account *accounts = g_bedrock->tls[t].accounts;
+
+        for (u32 i = 0; i <= WORK_ACCOUNT_COUNT; i++) {
+            struct work_account *account = &accounts[i];
+            u64 const hash = i < WORK_ACCOUNT_COUNT
+                ? lake_atomic_read_explicit(&account->hash, lake_memory_model_acquire)
+                : hash_account_name(g_other_name);
+            if (hash == 0) continue;
+
+            u64 const count = lake_atomic_exchange_explicit(&account->count, 0lu, lake_memory_model_relaxed);
+            if (count == 0) continue;
+            u64 const wall = lake_atomic_exchange_explicit(&account->wall, 0lu, lake_memory_model_relaxed);
+            u64 const cpu = lake_atomic_exchange_explicit(&account->cpu, 0lu, lake_memory_model_relaxed);
+            u64 const wait = lake_atomic_exchange_explicit(&account->wait, 0lu, lake_memory_model_relaxed);
+            char const *name = i < WORK_ACCOUNT_COUNT ? account->name : g_other_name;
+
+            u32 slot = (u32)hash & (index_count - 1);
+            while (index[slot] != UINT32_MAX && !(hashes[index[slot]] == hash
+                        && account_name_equals(merged[index[slot]].name, name)))
+                slot = (slot + 1) & (index_count - 1);
+
+            if (index[slot] == UINT32_MAX) {
+                index[slot] = merged_count;
+                hashes[merged_count] = hash;
+                merged[merged_count] = (lake_work_account){0};
+                lake_strncpy(merged[merged_count].name, name, LAKE_WORK_ACCOUNT_NAME_SIZE - 1);
+                merged_count++;
+            }
+            lake_work_account *entry = &merged[index[slot]];
+            entry->count += count;
+            entry->wall_ns += (u64)((f64)wall * ns_per_tick);
+            entry->cpu_ns += (u64)((f64)cpu * ns_per_tick);
+            entry->wait_ns += (u64)((f64)wait * ns_per_tick);
+        }
+    }
+    qsort(merged, merged_count, sizeof(lake_work_account), compare_accounts_by_cpu);
+    if (out != nullptr)
+        lake_memcpy(out, merged, sizeof(lake_work_account) * lake_min(capacity, merged_count));
+    lake_drift_pop();
+    return merged_count;
+}
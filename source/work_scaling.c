@@ -0,0 +1,129 @@
+#include "internal.h"
+
+/** How long the load is measured before the number of active workers may change. */
+#define SCALING_PERIOD_MS 10
+
+/** Work that waits to be picked up: queued in the deques, resumed fibers and foreign work. */
+static u64 measure_queue_depth(void)
+{
+    u64 depth = 0;
+
+    s32 const deque_count = g_bedrock->thread_count * WORK_LANE_COUNT;
+    for (s32 i = 0; i < deque_count; i++) {
+        struct work_deque *deq = &g_bedrock->deques[i];
+        ssize const t = lake_atomic_read_explicit(&deq->top, lake_memory_model_relaxed);
+        ssize const b = lake_atomic_read_explicit(&deq->bottom, lake_memory_model_relaxed);
+        if (b > t) depth += (u64)(b - t);
+    }
+    lake_mpmc_ring *rings[] = { &g_bedrock->ready.ring, &g_bedrock->foreign.ring };
+    for (u32 i = 0; i < lake_arraysize(rings); i++) {
+        ssize const in = lake_atomic_read_explicit(&rings[i]->enqueue_pos, lake_memory_model_relaxed);
+        ssize const out = lake_atomic_read_explicit(&rings[i]->dequeue_pos, lake_memory_model_relaxed);
+        if (in > out) depth += (u64)(in - out);
+    }
+    return depth;
+}
+
+/** Idle time of all workers, a worker that is parked right now counts up to `now`. */
+static u64 sum_idle_ticks(u64 now)
+{
+    u64 idle = 0;
+    for (s32 i = 0; i < g_bedrock->thread_count; i++) {
+        struct tls *tls = &g_bedrock->tls[i];
+        u64 const since = lake_atomic_read_explicit(&tls->idle_since, lake_memory_model_relaxed);
+        idle += lake_atomic_read_explicit(&tls->idle_ticks, lake_memory_model_relaxed);
+        if (since && now > since) idle += now - since;
+    }
+    return idle;
+}
+
+static void set_active_limit(u32 limit)
+{
+    struct worker_scaling *scaling = &g_bedrock->scaling;
+    u32 const prev = lake_atomic_exchange_explicit(&scaling->active_limit, limit, lake_memory_model_acq_rel);
+
+    if (limit > prev) {
+        lake_atomic_add_explicit(&scaling->epoch, 1u, lake_memory_model_release);
+        sys_futex_wake(&scaling->epoch, (u32)g_bedrock->thread_count);
+    }
+}
+
+void adapt_active_workers(void)
+{
+    struct worker_scaling *scaling = &g_bedrock->scaling;
+    /* someone else is measuring the load, that's good enough */
+    if (lake_spinlock_try_acquire(&scaling->lock)) return;
+
+    /* it may have been disabled, or measured by someone else meanwhile */
+    u64 const now = lake_rtc_counter();
+    u64 const due = lake_atomic_read_explicit(&scaling->next_due, lake_memory_model_relaxed);
+    if (due == UINT64_MAX || now < due) {
+        lake_spinlock_release(&scaling->lock);
+        return;
+    }
+    u32 const thread_count = (u32)g_bedrock->thread_count;
+    u32 const active = lake_atomic_read_explicit(&scaling->active_limit, lake_memory_model_relaxed);
+    u64 const depth = measure_queue_depth();
+    u64 const idle_total = sum_idle_ticks(now);
+    u64 const idle = idle_total - lake_min(scaling->window_idle, idle_total);
+    u64 const elapsed = now - scaling->window_start;
+
+    u32 limit = active;
+    if (depth > 2lu * active) {
+        /* a backlog is building up, grow fast */
+        limit = lake_min(thread_count, 2 * active);
+    } else if (depth > active) {
+        limit = lake_min(thread_count, active + 1);
+    } else if (depth < active && elapsed > 0) {
+        /* keep as many workers as were busy on average with one to spare,
+         * but retire at most half of the rest at once, shrinking is never urgent */
+        u64 const capacity = elapsed * active;
+        u64 const busy = capacity > idle ? capacity - idle : 0lu;
+        u32 const needed = (u32)((busy + elapsed - 1) / elapsed) + 1;
+        if (needed < active)
+            limit = active - (active - needed + 1) / 2;
+    }
+    scaling->window_start = now;
+    scaling->window_idle = idle_total;
+    lake_atomic_write_explicit(&scaling->next_due, now + scaling->period, lake_memory_model_relaxed);
+
+    if (limit != active)
+        set_active_limit(lake_max(limit, 1u));
+    lake_spinlock_release(&scaling->lock);
+}
+
+void retire_worker(u32 thread_idx)
+{
+    struct worker_scaling *scaling = &g_bedrock->scaling;
+    /* the limit is raised before the epoch is bumped, the futex won't miss it */
+    u32 const epoch = lake_atomic_read_explicit(&scaling->epoch, lake_memory_model_acquire);
+    if (thread_idx < lake_atomic_read_explicit(&scaling->active_limit, lake_memory_model_acquire))
+        return;
+    sys_futex_wait(&scaling->epoch, epoch, UINT64_MAX);
+}
+
+void lake_work_adaptive_workers(bool enable)
+{
+    lake_san_assert(g_bedrock != nullptr, LAKE_FRAMEWORK_REQUIRED, nullptr);
+    struct worker_scaling *scaling = &g_bedrock->scaling;
+    /* the deterministic mode keeps a single worker */
+    if (work_schedule_is_deterministic()) return;
+
+    lake_spinlock_acquire(&scaling->lock);
+    if (enable) {
+        scaling->period = lake_max(lake_rtc_frequency() * SCALING_PERIOD_MS / 1000lu, 1lu);
+        scaling->window_start = lake_rtc_counter();
+        scaling->window_idle = sum_idle_ticks(scaling->window_start);
+        lake_atomic_write_explicit(&scaling->next_due, scaling->window_start + scaling->period, lake_memory_model_relaxed);
+    } else {
+        lake_atomic_write_explicit(&scaling->next_due, UINT64_MAX, lake_memory_model_relaxed);
+        set_active_limit((u32)g_bedrock->thread_count);
+    }
+    lake_spinlock_release(&scaling->lock);
+}
+
+u32 lake_work_active_workers(void)
+{
+    lake_san_assert(g_bedrock != nullptr, LAKE_FRAMEWORK_REQUIRED, nullptr);
+    return lake_atomic_read_explicit(&g_bedrock->scaling.active_limit, lake_memory_model_relaxed);
+}
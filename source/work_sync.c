@@ -0,0 +1,107 @@
+#include "internal.h"
+
+/** How many times a contended mutex is checked again, before the fiber parks. Critical
+ *  sections are usually short, and parking costs at least two fiber context switches. */
+#define MUTEX_SPIN_COUNT 64
+
+static bool mutex_is_contended(void const *raw_mutex)
+{
+    lake_fiber_mutex *mutex = (lake_fiber_mutex *)raw_mutex;
+    return lake_atomic_read_explicit(&mutex->state, lake_memory_model_relaxed) == 2u;
+}
+
+bool lake_fiber_mutex_try_lock(lake_fiber_mutex *mutex)
+{
+    u32 expected = 0u;
+    return lake_atomic_compare_exchange_strong_explicit(&mutex->state, &expected, 1u,
+            lake_memory_model_acquire, lake_memory_model_relaxed);
+}
+
+void lake_fiber_mutex_lock(lake_fiber_mutex *mutex)
+{
+    if (lake_fiber_mutex_try_lock(mutex)) return;
+
+    for (u32 i = 0; i < MUTEX_SPIN_COUNT; i++) {
+        if (lake_atomic_read_explicit(&mutex->state, lake_memory_model_relaxed) == 0u
+                && lake_fiber_mutex_try_lock(mutex))
+            return;
+    }
+    /* Mark the mutex as contended, so the unlock will resume a parked fiber. If we got it
+     * this way, it stays marked as contended - at worst, the unlock looks for no one. */
+    while (lake_atomic_exchange_explicit(&mutex->state, 2u, lake_memory_model_acquire) != 0u)
+        park_fiber(&mutex->waiters, mutex_is_contended, mutex);
+}
+
+void lake_fiber_mutex_unlock(lake_fiber_mutex *mutex)
+{
+    u32 const state = lake_atomic_exchange_explicit(&mutex->state, 0u, lake_memory_model_release);
+    lake_dbg_assert(state != 0u, LAKE_PANIC, "The fiber mutex was not locked.");
+
+    if (state == 2u)
+        unpark_fibers(&mutex->waiters, 1);
+}
+
+static bool semaphore_is_drained(void const *raw_semaphore)
+{
+    lake_fiber_semaphore *semaphore = (lake_fiber_semaphore *)raw_semaphore;
+    return lake_atomic_read_explicit(&semaphore->count, lake_memory_model_relaxed) == 0u;
+}
+
+bool lake_fiber_semaphore_try_acquire(lake_fiber_semaphore *semaphore)
+{
+    u32 count = lake_atomic_read_explicit(&semaphore->count, lake_memory_model_relaxed);
+    while (count > 0u) {
+        if (lake_atomic_compare_exchange_weak_explicit(&semaphore->count, &count, count - 1u,
+                lake_memory_model_acquire, lake_memory_model_relaxed))
+            return true;
+    }
+    return false;
+}
+
+void lake_fiber_semaphore_acquire(lake_fiber_semaphore *semaphore)
+{
+    while (!lake_fiber_semaphore_try_acquire(semaphore))
+        park_fiber(&semaphore->waiters, semaphore_is_drained, semaphore);
+}
+
+void lake_fiber_semaphore_release(lake_fiber_semaphore *semaphore, u32 count)
+{
+    if (count == 0u) return;
+    lake_atomic_add_explicit(&semaphore->count, count, lake_memory_model_release);
+    unpark_fibers(&semaphore->waiters, count);
+}
+
+struct condvar_wait {
+    lake_fiber_condvar *condvar;
+    u32                 sequence;
+};
+
+static bool condvar_not_signaled(void const *raw_wait)
+{
+    struct condvar_wait const *wait = (struct condvar_wait const *)raw_wait;
+    return lake_atomic_read_explicit(&wait->condvar->sequence, lake_memory_model_relaxed) == wait->sequence;
+}
+
+void lake_fiber_condvar_wait(lake_fiber_condvar *condvar, lake_fiber_mutex *mutex)
+{
+    /* read under the mutex, so a signal sent after the caller checked it's condition is seen */
+    struct condvar_wait const wait = {
+        .condvar = condvar,
+        .sequence = lake_atomic_read_explicit(&condvar->sequence, lake_memory_model_relaxed),
+    };
+    lake_fiber_mutex_unlock(mutex);
+    park_fiber(&condvar->waiters, condvar_not_signaled, &wait);
+    lake_fiber_mutex_lock(mutex);
+}
+
+void lake_fiber_condvar_signal(lake_fiber_condvar *condvar)
+{
+    lake_atomic_add_explicit(&condvar->sequence, 1u, lake_memory_model_release);
+    unpark_fibers(&condvar->waiters, 1);
+}
+
+void lake_fiber_condvar_broadcast(lake_fiber_condvar *condvar)
+{
+    lake_atomic_add_explicit(&condvar->sequence, 1u, lake_memory_model_release);
+    unpark_fibers(&condvar->waiters, UINT32_MAX);
+}
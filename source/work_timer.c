@@ -0,0 +1,269 @@
+#include "internal.h"
+
+static u64 ns_from_counter(u64 counter)
+{
+    u64 const frequency = g_bedrock->timers.rtc_frequency;
+    return counter / frequency * LAKE_NS_PER_SECOND + counter % frequency * LAKE_NS_PER_SECOND / frequency;
+}
+
+LAKE_FORCE_INLINE u64 ticks_from_counter(u64 counter)
+{ return ns_from_counter(counter) >> TIMER_TICK_SHIFT; }
+
+static u64 counter_from_ticks(u64 ticks)
+{
+    u64 const frequency = g_bedrock->timers.rtc_frequency;
+    u64 const ns = ticks << TIMER_TICK_SHIFT;
+    return ns / LAKE_NS_PER_SECOND * frequency + ns % LAKE_NS_PER_SECOND * frequency / LAKE_NS_PER_SECOND;
+}
+
+/** Handles hold the timer index offset by one in the low bits, so 0 is never valid. */
+LAKE_FORCE_INLINE lake_work_timer timer_handle(u32 timer_idx)
+{ return ((u64)g_bedrock->timers.timers[timer_idx].generation << 32) | (u64)(timer_idx + 1); }
+
+/** Links the timer into a slot, relative to the first tick that was not processed yet. */
+static void insert_timer(struct timer_wheel *wheel, u32 timer_idx)
+{
+    struct work_timer *timer = &wheel->timers[timer_idx];
+    u64 const base = wheel->now + 1;
+    u64 deadline = lake_max(timer->deadline, base);
+    u64 const delta = deadline - base;
+
+    u32 level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >> (TIMER_WHEEL_BITS * (level + 1)))
+        level++;
+    /* past the range of the wheel, it waits in the last slot and cascades into it again */
+    if (delta >> (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+        deadline = base + (1lu << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+
+    u32 const slot = level * TIMER_WHEEL_SLOTS + (u32)((deadline >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK);
+    timer->slot = slot;
+    timer->prev = TIMER_NONE;
+    timer->next = wheel->slots[slot];
+    if (timer->next != TIMER_NONE)
+        wheel->timers[timer->next].prev = timer_idx;
+    wheel->slots[slot] = timer_idx;
+}
+
+static void unlink_timer(struct timer_wheel *wheel, u32 timer_idx)
+{
+    struct work_timer *timer = &wheel->timers[timer_idx];
+    if (timer->prev != TIMER_NONE) {
+        wheel->timers[timer->prev].next = timer->next;
+    } else {
+        wheel->slots[timer->slot] = timer->next;
+    }
+    if (timer->next != TIMER_NONE)
+        wheel->timers[timer->next].prev = timer->prev;
+}
+
+static void release_timer(struct timer_wheel *wheel, u32 timer_idx)
+{
+    struct work_timer *timer = &wheel->timers[timer_idx];
+    timer->slot = TIMER_NONE;
+    timer->generation++;
+    timer->next = wheel->free_head;
+    wheel->free_head = timer_idx;
+    wheel->active_count--;
+}
+
+/** Returns the first tick after `now` that fires a slot of level 0, or cascades a slot
+ *  of a higher level. The wheel doesn't need to be advanced before that tick. */
+static u64 next_timer_tick(struct timer_wheel const *wheel)
+{
+    u64 const base = wheel->now + 1;
+    u64 next = UINT64_MAX;
+
+    if (wheel->active_count == 0) return next;
+    for (u32 level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        u32 const shift = TIMER_WHEEL_BITS * level;
+        /* the first tick at or after base, that is aligned to a slot of this level */
+        u64 const first = (base + (1lu << shift) - 1) >> shift;
+
+        for (u32 slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+            if (wheel->slots[level * TIMER_WHEEL_SLOTS + slot] == TIMER_NONE) continue;
+            u64 const tick = (first + ((slot - first) & TIMER_WHEEL_MASK)) << shift;
+            next = lake_min(next, tick);
+        }
+    }
+    return next;
+}
+
+static void update_next_due(struct timer_wheel *wheel)
+{
+    u64 const tick = next_timer_tick(wheel);
+    lake_atomic_write_explicit(&wheel->next_due,
+            tick == UINT64_MAX ? UINT64_MAX : counter_from_ticks(tick), lake_memory_model_relaxed);
+}
+
+/** Processes a single tick, `wheel->now` must be the tick right before it. */
+static u32 process_timer_tick(struct timer_wheel *wheel, u64 tick)
+{
+    u32 submitted = 0;
+
+    /* cascade the higher levels first, their timers may land in a slot processed right after */
+    for (u32 level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+        u32 const shift = TIMER_WHEEL_BITS * level;
+        if (tick & ((1lu << shift) - 1)) continue;
+
+        u32 const slot = level * TIMER_WHEEL_SLOTS + (u32)((tick >> shift) & TIMER_WHEEL_MASK);
+        u32 timer_idx = wheel->slots[slot];
+        wheel->slots[slot] = TIMER_NONE;
+        while (timer_idx != TIMER_NONE) {
+            u32 const next = wheel->timers[timer_idx].next;
+            insert_timer(wheel, timer_idx);
+            timer_idx = next;
+        }
+    }
+    wheel->now = tick;
+
+    u32 const slot = (u32)(tick & TIMER_WHEEL_MASK);
+    u32 timer_idx = wheel->slots[slot];
+    wheel->slots[slot] = TIMER_NONE;
+    while (timer_idx != TIMER_NONE) {
+        struct work_timer *timer = &wheel->timers[timer_idx];
+        u32 const next = timer->next;
+
+        if (!push_local_work(&timer->details)) {
+            /* our deque is full, try again on the next tick */
+            insert_timer(wheel, timer_idx);
+        } else if (timer->period) {
+            /* a fixed rate, but ticks missed while the workers were busy are skipped */
+            timer->deadline += timer->period * ((tick - timer->deadline) / timer->period + 1);
+            insert_timer(wheel, timer_idx);
+            submitted++;
+        } else {
+            release_timer(wheel, timer_idx);
+            submitted++;
+        }
+        timer_idx = next;
+    }
+    return submitted;
+}
+
+void init_work_timers(struct work_timer *timers, u32 timer_count)
+{
+    struct timer_wheel *wheel = &g_bedrock->timers;
+
+    wheel->timers = timers;
+    wheel->timer_count = timer_count;
+    wheel->rtc_frequency = lake_rtc_frequency();
+    wheel->now = ticks_from_counter(lake_rtc_counter());
+    wheel->free_head = TIMER_NONE;
+    wheel->active_count = timer_count;
+    for (u32 i = timer_count; i > 0; i--)
+        release_timer(wheel, i - 1);
+    for (u32 i = 0; i < lake_arraysize(wheel->slots); i++)
+        wheel->slots[i] = TIMER_NONE;
+    lake_atomic_init(&wheel->next_due, UINT64_MAX);
+    lake_atomic_init(&wheel->keeper, 0u);
+}
+
+void advance_work_timers(void)
+{
+    struct timer_wheel *wheel = &g_bedrock->timers;
+    /* someone else is advancing the wheel, that's good enough */
+    if (lake_spinlock_try_acquire(&wheel->lock)) return;
+
+    u64 const target = ticks_from_counter(lake_rtc_counter());
+    u32 submitted = 0;
+    /* skip the ticks that have nothing to do */
+    for (u64 tick = next_timer_tick(wheel); tick <= target; tick = next_timer_tick(wheel)) {
+        wheel->now = tick - 1;
+        submitted += process_timer_tick(wheel, tick);
+    }
+    wheel->now = lake_max(wheel->now, target);
+    update_next_due(wheel);
+    lake_spinlock_release(&wheel->lock);
+
+    /* we will run one of them ourselves */
+    if (submitted > 1)
+        wake_idle_workers(submitted - 1);
+}
+
+bool acquire_timer_keeper(u64 *out_timeout_ns)
+{
+    struct timer_wheel *wheel = &g_bedrock->timers;
+    u64 const due = lake_atomic_read_explicit(&wheel->next_due, lake_memory_model_relaxed);
+    if (due == UINT64_MAX) return false;
+
+    u32 expected = 0u;
+    if (!lake_atomic_compare_exchange_strong_explicit(&wheel->keeper, &expected, lake_worker_thread_index() + 1,
+                lake_memory_model_acquire, lake_memory_model_relaxed))
+        return false;
+
+    u64 const now = lake_rtc_counter();
+    *out_timeout_ns = due > now ? ns_from_counter(due - now) : 0lu;
+    return true;
+}
+
+/** The keeper may be sleeping until a later deadline, it's woken up to sleep until the new one. 
+ *  If no one keeps time at all, an idle worker wakes up to do it. */
+static void wake_timer_keeper(struct timer_wheel *wheel)
+{
+    /* pairs with the fence of a parking worker, it announces itself before it takes the role */
+    lake_atomic_thread_fence(lake_memory_model_seq_cst);
+    u32 const keeper = lake_atomic_read_explicit(&wheel->keeper, lake_memory_model_relaxed);
+    if (keeper != 0u)
+        wake_parked_worker(&g_bedrock->tls[keeper - 1]);
+    else
+        wake_idle_workers(1);
+}
+
+lake_work_timer lake_submit_work_after(lake_work_details const *work, u64 delay_ns, u64 period_ns)
+{
+    lake_san_assert(g_bedrock != nullptr, LAKE_FRAMEWORK_REQUIRED, nullptr);
+    lake_dbg_assert(work->priority < lake_work_priority_count, LAKE_INVALID_PARAMETERS,
+            "Invalid work priority %u.", work->priority);
+    lake_dbg_assert(work->stack < lake_fiber_stack_class_count, LAKE_INVALID_PARAMETERS,
+            "Invalid fiber stack class %u.", work->stack);
+    struct timer_wheel *wheel = &g_bedrock->timers;
+
+    /* round the deadline up to a whole tick, so the work never runs early */
+    u64 const tick_ns = 1lu << TIMER_TICK_SHIFT;
+    u64 const now_ns = ns_from_counter(lake_rtc_counter());
+    u64 const deadline = (now_ns + delay_ns + tick_ns - 1) >> TIMER_TICK_SHIFT;
+    u64 const period = period_ns ? lake_max((period_ns + tick_ns - 1) >> TIMER_TICK_SHIFT, 1lu) : 0lu;
+
+    lake_spinlock_acquire(&wheel->lock);
+    u32 const timer_idx = wheel->free_head;
+    if (timer_idx == TIMER_NONE) {
+        lake_spinlock_release(&wheel->lock);
+        lake_error("All %u work timers are in use.", wheel->timer_count);
+        return 0;
+    }
+    struct work_timer *timer = &wheel->timers[timer_idx];
+    wheel->free_head = timer->next;
+    wheel->active_count++;
+    timer->details = *work;
+    timer->deadline = deadline;
+    timer->period = period;
+    insert_timer(wheel, timer_idx);
+
+    u64 const due = lake_atomic_read_explicit(&wheel->next_due, lake_memory_model_relaxed);
+    update_next_due(wheel);
+    bool const sooner = lake_atomic_read_explicit(&wheel->next_due, lake_memory_model_relaxed) < due;
+    lake_work_timer const handle = timer_handle(timer_idx);
+    lake_spinlock_release(&wheel->lock);
+
+    if (sooner) wake_timer_keeper(wheel);
+    return handle;
+}
+
+bool lake_cancel_work_timer(lake_work_timer handle)
+{
+    lake_san_assert(g_bedrock != nullptr, LAKE_FRAMEWORK_REQUIRED, nullptr);
+    struct timer_wheel *wheel = &g_bedrock->timers;
+    u32 const timer_idx = (u32)(handle & UINT32_MAX) - 1;
+    if (handle == 0 || timer_idx >= wheel->timer_count) return false;
+
+    lake_spinlock_acquire(&wheel->lock);
+    struct work_timer *timer = &wheel->timers[timer_idx];
+    bool const pending = timer->slot != TIMER_NONE && timer->generation == (u32)(handle >> 32);
+    if (pending) {
+        unlink_timer(wheel, timer_idx);
+        release_timer(wheel, timer_idx);
+        update_next_due(wheel);
+    }
+    lake_spinlock_release(&wheel->lock);
+    return pending;
+}
@@ -0,0 +1,114 @@
+#include "internal.h"
+
+#include <stdio.h>
+
+void record_trace_event(enum trace_event_type type, char const *name, u32 arg)
+{
+    struct tls *tls = get_thread_local_storage();
+    u64 const head = lake_atomic_read_explicit(&tls->trace_head, lake_memory_model_relaxed);
+
+    struct trace_event *event = &tls->trace_events[head & (TRACE_EVENT_COUNT - 1)];
+    event->timestamp = lake_rtc_counter();
+    event->name = name;
+    event->arg = arg;
+    event->type = type;
+    lake_atomic_write_explicit(&tls->trace_head, head + 1, lake_memory_model_release);
+}
+
+void lake_work_trace(bool enable)
+{
+    lake_san_assert(g_bedrock != nullptr, LAKE_FRAMEWORK_REQUIRED, nullptr);
+
+    u32 const was_enabled = lake_atomic_exchange_explicit(&g_bedrock->trace_enabled,
+            enable ? 1u : 0u, lake_memory_model_relaxed);
+    if (enable && !was_enabled)
+        lake_atomic_write_explicit(&g_bedrock->trace_start, lake_rtc_counter(), lake_memory_model_relaxed);
+}
+
+/** Job names are usually string literals, but quotes and backslashes would break the JSON. */
+static void write_json_string(FILE *f, char const *str)
+{
+    fputc('"', f);
+    for (char const *c = str ? str : "(unnamed)"; *c; c++) {
+        if (*c == '"' || *c == '\\') fputc('\\', f);
+        if ((u8)*c >= 0x20) fputc(*c, f);
+    }
+    fputc('"', f);
+}
+
+static void write_trace_event(FILE *f, struct trace_event const *event, u32 tid, f64 ts, bool *first)
+{
+    char const *instant = nullptr;
+    char const *arg_name = nullptr;
+
+    switch (event->type) {
+        case trace_event_work_begin:
+        case trace_event_resume:
+            fprintf(f, "%s\n{\"ph\":\"B\",\"cat\":\"work\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"name\":", *first ? "" : ",", tid, ts);
+            write_json_string(f, event->name);
+            fprintf(f, ",\"args\":{\"fiber\":%u,\"resumed\":%s}}", event->arg, event->type == trace_event_resume ? "true" : "false");
+            *first = false;
+            return;
+        case trace_event_work_end:
+            fprintf(f, "%s\n{\"ph\":\"E\",\"cat\":\"work\",\"pid\":0,\"tid\":%u,\"ts\":%.3f}", *first ? "" : ",", tid, ts);
+            *first = false;
+            return;
+        case trace_event_yield:
+            /* the job is suspended, close it's slice on this thread */
+            fprintf(f, "%s\n{\"ph\":\"E\",\"cat\":\"work\",\"pid\":0,\"tid\":%u,\"ts\":%.3f}", *first ? "" : ",", tid, ts);
+            *first = false;
+            instant = "wait"; arg_name = "chain";
+            break;
+        case trace_event_pop:
+            instant = "pop"; arg_name = "lane";
+            break;
+        case trace_event_steal:
+            instant = "steal"; arg_name = "victim";
+            break;
+        case trace_event_chain_done:
+            instant = "chain done"; arg_name = "chain";
+            break;
+    }
+    fprintf(f, "%s\n{\"ph\":\"i\",\"s\":\"t\",\"cat\":\"sched\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"name\":\"%s\",\"args\":{\"%s\":%u}}",
+            *first ? "" : ",", tid, ts, instant, arg_name, event->arg);
+    *first = false;
+}
+
+bool lake_work_trace_dump(char const *path)
+{
+    lake_san_assert(g_bedrock != nullptr, LAKE_FRAMEWORK_REQUIRED, nullptr);
+
+    FILE *f = fopen(path, "w");
+    if (f == nullptr) {
+        lake_error("Failed to open '%s' to dump the job system trace.", path);
+        return false;
+    }
+    u64 const start = lake_atomic_read_explicit(&g_bedrock->trace_start, lake_memory_model_relaxed);
+    f64 const us_per_tick = (f64)LAKE_US_PER_SECOND / (f64)lake_rtc_frequency();
+    bool first = true;
+
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (s32 i = 0; i < g_bedrock->thread_count; i++) {
+        struct tls *tls = &g_bedrock->tls[i];
+        u64 const head = lake_atomic_read_explicit(&tls->trace_head, lake_memory_model_acquire);
+        u64 const tail = head > TRACE_EVENT_COUNT ? head - TRACE_EVENT_COUNT : 0lu;
+
+        fprintf(f, "%s\n{\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":\"worker %d\"}}",
+                first ? "" : ",", i, i);
+        first = false;
+
+        for (u64 e = tail; e < head; e++) {
+            struct trace_event const *event = &tls->trace_events[e & (TRACE_EVENT_COUNT - 1)];
+            if (event->timestamp < start) continue;
+            write_trace_event(f, event, (u32)i, (f64)(event->timestamp - start) * us_per_tick, &first);
+        }
+    }
+    fprintf(f, "\n]}\n");
+
+    bool const ok = !ferror(f);
+    if (fclose(f) != 0 || !ok) {
+        lake_error("Failed to write the job system trace into '%s'.", path);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,108 @@
+#include "internal.h"
+
+/** How many released objects are destroyed by a single job. */
+#define ZERO_REFCNT_BATCH_SIZE 64
+/** How many jobs a single flush may submit, the rest waits for the next flush. */
+#define ZERO_REFCNT_FLUSH_JOB_COUNT 64
+
+/** A destructor has returned, fibers waiting for the last one are resumed. */
+static void finish_zero_refcnt(void)
+{
+    if (lake_atomic_sub_explicit(&g_bedrock->zero_refcnt_running, 1u, lake_memory_model_release) == 1u)
+        unpark_fibers(&g_bedrock->zero_refcnt_waiters, UINT32_MAX);
+}
+
+static FN_LAKE_WORK(destroy_zero_refcnt_batch, void *unused)
+{
+    (void)unused;
+    struct zero_refcnt doomed;
+
+    for (u32 i = 0; i < ZERO_REFCNT_BATCH_SIZE; i++) {
+        /* counted before it's taken, so a flush that finds the ring empty still sees it running */
+        lake_atomic_add_explicit(&g_bedrock->zero_refcnt_running, 1u, lake_memory_model_relaxed);
+        lake_atomic_thread_fence(lake_memory_model_seq_cst);
+        if (!lake_mpmc_dequeue_t(&g_bedrock->zero_refcnt.ring, zero_refcnt_node, &doomed)) {
+            finish_zero_refcnt();
+            break;
+        }
+        doomed.procedure(doomed.self);
+        finish_zero_refcnt();
+    }
+}
+
+static bool zero_refcnt_is_running(void const *unused)
+{
+    (void)unused;
+    return lake_atomic_read_explicit(&g_bedrock->zero_refcnt_running, lake_memory_model_acquire) != 0u;
+}
+
+/** Parks until the destructors that were running have returned. */
+static FN_LAKE_WORK(await_zero_refcnt_batches, void *unused)
+{
+    (void)unused;
+    park_fiber(&g_bedrock->zero_refcnt_waiters, zero_refcnt_is_running, nullptr);
+}
+
+static lake_work_details const g_destroy_batch = {
+    .procedure = destroy_zero_refcnt_batch,
+    .argument = nullptr,
+    .name = "bedrock/zero_refcnt",
+    .priority = lake_work_priority_background,
+};
+
+static lake_work_details const g_await_batches = {
+    .procedure = await_zero_refcnt_batches,
+    .argument = nullptr,
+    .name = "bedrock/zero_refcnt_await",
+    .priority = lake_work_priority_background,
+};
+
+void lake_defer_zero_refcnt(void *self, PFN_lake_work zero_refcnt)
+{
+    struct zero_refcnt const doomed = { .procedure = zero_refcnt, .self = self };
+
+    /* a full queue can't make us wait, the object is destroyed right away like it used to */
+    if (g_bedrock == nullptr || !lake_mpmc_enqueue_t(&g_bedrock->zero_refcnt.ring, zero_refcnt_node, &doomed)) {
+        zero_refcnt(self);
+        return;
+    }
+    /* don't wait for the flush if a whole batch is ready, if the work can't be submitted it will */
+    u32 const deferred = lake_atomic_add_explicit(&g_bedrock->zero_refcnt_deferred, 1u, lake_memory_model_relaxed) + 1;
+    if (deferred % ZERO_REFCNT_BATCH_SIZE == 0)
+        (void)lake_submit_foreign_work(1, &g_destroy_batch);
+}
+
+u32 lake_zero_refcnt_flush(lake_work_chain *out_chain)
+{
+    lake_san_assert(g_bedrock != nullptr, LAKE_FRAMEWORK_REQUIRED, nullptr);
+    lake_mpmc_ring *ring = &g_bedrock->zero_refcnt.ring;
+
+    u32 queued = 0;
+
+    for (;;) {
+        ssize const in = lake_atomic_read_explicit(&ring->enqueue_pos, lake_memory_model_relaxed);
+        ssize const out = lake_atomic_read_explicit(&ring->dequeue_pos, lake_memory_model_relaxed);
+        queued = in > out ? (u32)(in - out) : 0u;
+        if (queued != 0) break;
+
+        /* Nothing is left to submit, but batches may still run destructors of the objects they 
+         * took. Then the chain is of a job that waits for them, pairs with the fence of a batch. */
+        lake_atomic_thread_fence(lake_memory_model_seq_cst);
+        u32 const running = lake_atomic_read_explicit(&g_bedrock->zero_refcnt_running, lake_memory_model_acquire);
+        /* a destructor that returned in the meantime may have queued more objects */
+        if (lake_atomic_read_explicit(&ring->enqueue_pos, lake_memory_model_relaxed) != in)
+            continue;
+        if (running == 0) {
+            if (out_chain) *out_chain = nullptr;
+            return 0;
+        }
+        lake_submit_work(1, &g_await_batches, out_chain);
+        return running;
+    }
+    lake_work_details work[ZERO_REFCNT_FLUSH_JOB_COUNT];
+    u32 const job_count = lake_min((queued + ZERO_REFCNT_BATCH_SIZE - 1) / ZERO_REFCNT_BATCH_SIZE, ZERO_REFCNT_FLUSH_JOB_COUNT);
+    for (u32 i = 0; i < job_count; i++)
+        work[i] = g_destroy_batch;
+    lake_submit_work(job_count, work, out_chain);
+    return queued;
+}
@@ -0,0 +1,853 @@
+#include "../framework.h"
+
+/** Capacity of a worker's job deque, from the framework hints. */
+static u32 g_deque_capacity = 0;
+static u32 g_worker_thread_count = 0;
+static u32 g_tagged_heap_count = 0;
+
+struct parallel_for_sum {
+    u32            *values;
+    atomic_u64      sum;
+    atomic_u32      calls;
+};
+
+static FN_LAKE_PARALLEL_FOR(parallel_for_sum_range, struct parallel_for_sum *work)
+{
+    u64 sum = 0;
+    for (usize i = begin; i < end; i++) {
+        work->values[i] += 1;
+        sum += i;
+    }
+    lake_atomic_add(&work->sum, sum);
+    lake_atomic_add(&work->calls, 1u);
+}
+
+static s32 parallel_for_sum_test(usize count, usize grain_size)
+{
+    struct parallel_for_sum work = { .values = lake_drift_n(u32, lake_max(count, 1lu)) };
+    lake_memset(work.values, 0, sizeof(u32) * count);
+    lake_atomic_init(&work.sum, 0lu);
+    lake_atomic_init(&work.calls, 0u);
+
+    lake_parallel_for(count, grain_size, (PFN_lake_parallel_for)parallel_for_sum_range, &work, "tests/parallel_for");
+
+    for (usize i = 0; i < count; i++) {
+        if (work.values[i] != 1) {
+            test_log_context();
+            test_log("Index %lu was visited %u times, expected once.", i, work.values[i]);
+            return TEST_RESULT_FAILED;
+        }
+    }
+    u64 const expected = count ? (u64)count * (count - 1) / 2 : 0;
+    if (lake_atomic_read(&work.sum) != expected) {
+        test_log_context();
+        test_log("Sum of indices is %lu, expected %lu.", lake_atomic_read(&work.sum), expected);
+        return TEST_RESULT_FAILED;
+    }
+    /* a chunk is never smaller than the grain, except for the tail of the range */
+    if (grain_size && lake_atomic_read(&work.calls) > (count + grain_size - 1) / grain_size) {
+        test_log_context();
+        test_log("Range of %lu was split into %u chunks, grain size was %lu.", count, lake_atomic_read(&work.calls), grain_size);
+        return TEST_RESULT_FAILED;
+    }
+    return TEST_RESULT_OKAY;
+}
+
+FN_TEST_CASE(JobSystem, parallel_for_empty_range)
+{
+    return parallel_for_sum_test(0, 0);
+}
+
+FN_TEST_CASE(JobSystem, parallel_for_default_grain)
+{
+    return parallel_for_sum_test(100000, 0);
+}
+
+FN_TEST_CASE(JobSystem, parallel_for_grain_size)
+{
+    return parallel_for_sum_test(10007, 64);
+}
+
+FN_TEST_CASE(JobSystem, parallel_for_grain_larger_than_range)
+{
+    return parallel_for_sum_test(17, 1024);
+}
+
+static FN_LAKE_WORK(chain_reuse_work, atomic_u32 *counter)
+{
+    lake_atomic_add(counter, 1u);
+}
+
+FN_TEST_CASE(JobSystem, chain_reuse)
+{
+    /* chains are released and acquired again right away, a late close must not reach the new one */
+    u32 const rounds = 256;
+    atomic_u32 counter;
+    lake_atomic_init(&counter, 0u);
+
+    for (u32 i = 0; i < rounds; i++) {
+        lake_work_details const work[2] = {
+            { .procedure = (PFN_lake_work)chain_reuse_work, .argument = &counter, .name = "tests/chain_reuse_work" },
+            { .procedure = (PFN_lake_work)chain_reuse_work, .argument = &counter, .name = "tests/chain_reuse_work" },
+        };
+        lake_submit_work_and_yield(2, work);
+
+        /* a chain that starts at zero is done already */
+        lake_work_chain empty = lake_acquire_chain_n(0);
+        lake_yield(empty);
+    }
+    if (lake_atomic_read(&counter) != 2 * rounds) {
+        test_log_context();
+        test_log("Ran %u of %u jobs on reused chains.", lake_atomic_read(&counter), 2 * rounds);
+        return TEST_RESULT_FAILED;
+    }
+    return TEST_RESULT_OKAY;
+}
+
+struct fiber_sync_test {
+    lake_fiber_mutex        mutex;
+    lake_fiber_semaphore    semaphore;
+    lake_fiber_condvar      condvar;
+    lake_work_chain         gate;
+    bool                    ready;
+    u32                     guarded;
+    atomic_u32              done;
+};
+
+/** Holds the mutex while it waits for the gate, so the other lockers must park. */
+static FN_LAKE_WORK(mutex_holder, struct fiber_sync_test *test)
+{
+    lake_fiber_mutex_lock(&test->mutex);
+    lake_yield(test->gate);
+    test->guarded++;
+    lake_fiber_mutex_unlock(&test->mutex);
+}
+
+static FN_LAKE_WORK(mutex_locker, struct fiber_sync_test *test)
+{
+    lake_fiber_mutex_lock(&test->mutex);
+    test->guarded++;
+    lake_fiber_mutex_unlock(&test->mutex);
+}
+
+static FN_LAKE_WORK(open_gate, struct fiber_sync_test *test)
+{
+    lake_release_chain(test->gate);
+}
+
+FN_TEST_CASE(JobSystem, fiber_mutex_contended)
+{
+    /* on the stack, drifted memory may be reused by work running while this fiber waits */
+    struct fiber_sync_test state = { .mutex = lake_fiber_mutex_init };
+    struct fiber_sync_test *test = &state;
+    test->gate = lake_acquire_chain();
+
+    /* work is popped from the back of the deque, so the holder runs first and the gate last */
+    lake_work_details work[5];
+    work[0] = (lake_work_details){ .procedure = (PFN_lake_work)open_gate, .argument = test, .name = "tests/open_gate" };
+    for (u32 i = 1; i < 4; i++)
+        work[i] = (lake_work_details){ .procedure = (PFN_lake_work)mutex_locker, .argument = test, .name = "tests/mutex_locker" };
+    work[4] = (lake_work_details){ .procedure = (PFN_lake_work)mutex_holder, .argument = test, .name = "tests/mutex_holder" };
+    lake_submit_work_and_yield(5, work);
+
+    if (test->guarded != 4 || lake_atomic_read(&test->mutex.state) != 0) {
+        test_log_context();
+        test_log("Mutex guarded %u increments (expected 4), it's state is %u.", test->guarded, lake_atomic_read(&test->mutex.state));
+        return TEST_RESULT_FAILED;
+    }
+    return TEST_RESULT_OKAY;
+}
+
+static FN_LAKE_WORK(semaphore_acquirer, struct fiber_sync_test *test)
+{
+    lake_fiber_semaphore_acquire(&test->semaphore);
+    lake_atomic_add(&test->done, 1u);
+}
+
+static FN_LAKE_WORK(semaphore_releaser, struct fiber_sync_test *test)
+{
+    lake_fiber_semaphore_release(&test->semaphore, 4);
+}
+
+FN_TEST_CASE(JobSystem, fiber_semaphore_release)
+{
+    /* on the stack, drifted memory may be reused by work running while this fiber waits */
+    struct fiber_sync_test state = { .semaphore = lake_fiber_semaphore_init(0) };
+    struct fiber_sync_test *test = &state;
+
+    lake_work_details work[5];
+    work[0] = (lake_work_details){ .procedure = (PFN_lake_work)semaphore_releaser, .argument = test, .name = "tests/semaphore_releaser" };
+    for (u32 i = 1; i < 5; i++)
+        work[i] = (lake_work_details){ .procedure = (PFN_lake_work)semaphore_acquirer, .argument = test, .name = "tests/semaphore_acquirer" };
+    lake_submit_work_and_yield(5, work);
+
+    if (lake_atomic_read(&test->done) != 4 || lake_fiber_semaphore_try_acquire(&test->semaphore)) {
+        test_log_context();
+        test_log("Semaphore was acquired %u times (expected 4), it's count is %u.", lake_atomic_read(&test->done), lake_atomic_read(&test->semaphore.count));
+        return TEST_RESULT_FAILED;
+    }
+    return TEST_RESULT_OKAY;
+}
+
+static FN_LAKE_WORK(condvar_waiter, struct fiber_sync_test *test)
+{
+    lake_fiber_mutex_lock(&test->mutex);
+    while (!test->ready)
+        lake_fiber_condvar_wait(&test->condvar, &test->mutex);
+    test->guarded++;
+    lake_fiber_mutex_unlock(&test->mutex);
+}
+
+static FN_LAKE_WORK(condvar_broadcaster, struct fiber_sync_test *test)
+{
+    lake_fiber_mutex_lock(&test->mutex);
+    test->ready = true;
+    lake_fiber_condvar_broadcast(&test->condvar);
+    lake_fiber_mutex_unlock(&test->mutex);
+}
+
+FN_TEST_CASE(JobSystem, fiber_condvar_broadcast)
+{
+    /* on the stack, drifted memory may be reused by work running while this fiber waits */
+    struct fiber_sync_test state = { .mutex = lake_fiber_mutex_init, .condvar = lake_fiber_condvar_init };
+    struct fiber_sync_test *test = &state;
+
+    lake_work_details work[4];
+    work[0] = (lake_work_details){ .procedure = (PFN_lake_work)condvar_broadcaster, .argument = test, .name = "tests/condvar_broadcaster" };
+    for (u32 i = 1; i < 4; i++)
+        work[i] = (lake_work_details){ .procedure = (PFN_lake_work)condvar_waiter, .argument = test, .name = "tests/condvar_waiter" };
+    lake_submit_work_and_yield(4, work);
+
+    if (test->guarded != 3) {
+        test_log_context();
+        test_log("Condition variable woke %u waiters, expected 3.", test->guarded);
+        return TEST_RESULT_FAILED;
+    }
+    return TEST_RESULT_OKAY;
+}
+
+static FN_LAKE_WORK(count_work, atomic_u32 *counter)
+{
+    lake_atomic_add(counter, 1u);
+}
+
+FN_TEST_CASE(JobSystem, submit_past_deque_capacity)
+{
+    /* a burst larger than the deque must spill, even with no other worker to steal from it */
+    u32 const count = 3 * g_deque_capacity + 1;
+    atomic_u32 counter;
+    lake_atomic_init(&counter, 0u);
+
+    lake_work_details *work = lake_drift_n(lake_work_details, count);
+    for (u32 i = 0; i < count; i++)
+        work[i] = (lake_work_details){ .procedure = (PFN_lake_work)count_work, .argument = &counter, .name = "tests/count_work" };
+    lake_submit_work_and_yield(count, work);
+
+    if (lake_atomic_read(&counter) != count) {
+        test_log_context();
+        test_log("Ran %u of %u submitted jobs, the deque capacity is %u.", lake_atomic_read(&counter), count, g_deque_capacity);
+        return TEST_RESULT_FAILED;
+    }
+    return TEST_RESULT_OKAY;
+}
+
+FN_TEST_CASE(JobSystem, submit_past_deque_capacity_large_stack)
+{
+    /* the spilled work needs a bigger stack than the submitter has */
+    u32 const count = 2 * g_deque_capacity + 1;
+    atomic_u32 counter;
+    lake_atomic_init(&counter, 0u);
+
+    lake_work_details *work = lake_drift_n(lake_work_details, count);
+    for (u32 i = 0; i < count; i++)
+        work[i] = (lake_work_details){ 
+            .procedure = (PFN_lake_work)count_work, 
+            .argument = &counter, 
+            .name = "tests/count_work", 
+            .stack = lake_fiber_stack_large,
+        };
+    lake_submit_work_and_yield(count, work);
+
+    if (lake_atomic_read(&counter) != count) {
+        test_log_context();
+        test_log("Ran %u of %u submitted jobs with large stacks.", lake_atomic_read(&counter), count);
+        return TEST_RESULT_FAILED;
+    }
+    return TEST_RESULT_OKAY;
+}
+
+FN_TEST_CASE(JobSystem, work_batch)
+{
+    /* runs of different priorities, the batch is flushed many times before the yield */
+    u32 const count = 3 * g_deque_capacity + LAKE_WORK_BATCH_CAPACITY / 2;
+    atomic_u32 counter;
+    lake_atomic_init(&counter, 0u);
+
+    lake_work_batch batch = {0};
+    for (u32 i = 0; i < count; i++) {
+        lake_work_details const work = { 
+            .procedure = (PFN_lake_work)count_work, 
+            .argument = &counter, 
+            .name = "tests/count_work", 
+            .priority = (i / 7) % 2 ? lake_work_priority_background : lake_work_priority_normal,
+        };
+        lake_work_batch_add(&batch, &work);
+    }
+    lake_work_batch_yield(&batch);
+
+    if (lake_atomic_read(&counter) != count || batch.count != 0 || batch.chain != nullptr) {
+        test_log_context();
+        test_log("Ran %u of %u jobs submitted in batches.", lake_atomic_read(&counter), count);
+        return TEST_RESULT_FAILED;
+    }
+    return TEST_RESULT_OKAY;
+}
+
+static FN_LAKE_WORK(foreign_release, lake_fiber_semaphore *done)
+{
+    lake_fiber_semaphore_release(done, 1);
+}
+
+FN_TEST_CASE(JobSystem, submit_foreign_work)
+{
+    /* from a worker thread, foreign submission is the same as unchained submission */
+    lake_fiber_semaphore done = lake_fiber_semaphore_init(0);
+    lake_work_details work[4];
+    for (u32 i = 0; i < 4; i++)
+        work[i] = (lake_work_details){ .procedure = (PFN_lake_work)foreign_release, .argument = &done, .name = "tests/foreign_release" };
+    u32 const submitted = lake_submit_foreign_work(4, work);
+    for (u32 i = 0; i < submitted; i++)
+        lake_fiber_semaphore_acquire(&done);
+
+    if (!lake_is_worker_thread() || submitted != 4) {
+        test_log_context();
+        test_log("Submitted %u of 4 jobs, from a worker thread: %s.", submitted, lake_is_worker_thread() ? "yes" : "no");
+        return TEST_RESULT_FAILED;
+    }
+    return TEST_RESULT_OKAY;
+}
+
+struct doomed_object {
+    lake_refcnt             refcnt;
+    atomic_u32             *destroyed;
+    /** Released by the destructor, it's destroyed by a later flush. */
+    struct doomed_object   *child;
+};
+
+static FN_LAKE_WORK(destroy_doomed_object, struct doomed_object *object)
+{
+    lake_atomic_add(object->destroyed, 1u);
+    if (object->child)
+        lake_dec_refcnt_deferred(&object->child->refcnt, object->child, (PFN_lake_work)destroy_doomed_object);
+}
+
+FN_TEST_CASE(JobSystem, zero_refcnt_batch)
+{
+    /* some batches are destroyed before the flush, the children only after another one */
+    u32 const count = 5 * 64 + 7;
+    atomic_u32 destroyed;
+    lake_atomic_init(&destroyed, 0u);
+
+    struct doomed_object *objects = lake_drift_n(struct doomed_object, 2 * count);
+    for (u32 i = 0; i < 2 * count; i++) {
+        lake_atomic_init(&objects[i].refcnt, 1);
+        objects[i].destroyed = &destroyed;
+        objects[i].child = i < count ? &objects[count + i] : nullptr;
+    }
+    for (u32 i = 0; i < count; i++)
+        lake_dec_refcnt_deferred(&objects[i].refcnt, &objects[i], (PFN_lake_work)destroy_doomed_object);
+
+    lake_work_chain chain = nullptr;
+    while (lake_zero_refcnt_flush(&chain))
+        lake_yield(chain);
+
+    if (lake_atomic_read(&destroyed) != 2 * count) {
+        test_log_context();
+        test_log("Destroyed %u of %u released objects.", lake_atomic_read(&destroyed), 2 * count);
+        return TEST_RESULT_FAILED;
+    }
+    return TEST_RESULT_OKAY;
+}
+
+/** Tests of the tagged heap run one at a time, one of them takes every heap there is 
+ *  and others count the blocks or bytes of the whole heap. */
+static lake_fiber_mutex g_tagged_heap_lock = lake_fiber_mutex_init;
+
+#define FN_TAGGED_HEAP_TEST_CASE(NAME) \
+    static s32 tagged_heap_##NAME(void); \
+    FN_TEST_CASE(JobSystem, tagged_heap_##NAME) \
+    { \
+        lake_fiber_mutex_lock(&g_tagged_heap_lock); \
+        s32 const result = tagged_heap_##NAME(); \
+        lake_fiber_mutex_unlock(&g_tagged_heap_lock); \
+        return result; \
+    } \
+    static s32 tagged_heap_##NAME(void)
+
+#define THALLOC_JOB_COUNT   8
+#define THALLOC_PER_JOB     1024
+#define THALLOC_SIZE        4096
+
+struct thalloc_job {
+    lake_heap_tag   tag;
+    u32             job_idx;
+    u32            *out[THALLOC_PER_JOB];
+};
+
+static FN_LAKE_WORK(thalloc_job, struct thalloc_job *job)
+{
+    for (u32 i = 0; i < THALLOC_PER_JOB; i++) {
+        job->out[i] = lake_thalloc_n(job->tag, u32, THALLOC_SIZE / sizeof(u32));
+        if (job->out[i] == nullptr) return;
+        for (u32 j = 0; j < THALLOC_SIZE / sizeof(u32); j++)
+            job->out[i][j] = job->job_idx;
+        /* the fiber may move to another worker thread and it's block cache */
+        if (i % 128 == 0) lake_yield(nullptr);
+    }
+}
+
+FN_TAGGED_HEAP_TEST_CASE(worker_caches)
+{
+    /* every job allocates many blocks worth of memory, twice under the same tag */
+    static struct thalloc_job jobs[THALLOC_JOB_COUNT];
+    lake_heap_tag const tag = 0x7e57;
+
+    for (u32 round = 0; round < 2; round++) {
+        lake_work_details work[THALLOC_JOB_COUNT];
+        for (u32 i = 0; i < THALLOC_JOB_COUNT; i++) {
+            jobs[i] = (struct thalloc_job){ .tag = tag, .job_idx = i };
+            work[i] = (lake_work_details){ .procedure = (PFN_lake_work)thalloc_job, .argument = &jobs[i], .name = "tests/thalloc_job" };
+        }
+        lake_submit_work_and_yield(THALLOC_JOB_COUNT, work);
+
+        /* no allocation was handed out twice */
+        for (u32 i = 0; i < THALLOC_JOB_COUNT; i++) {
+            for (u32 k = 0; k < THALLOC_PER_JOB; k++) {
+                u32 const *data = jobs[i].out[k];
+                if (data == nullptr || data[0] != i || data[THALLOC_SIZE / sizeof(u32) - 1] != i) {
+                    test_log_context();
+                    test_log("Allocation %u of job %u in round %u was %s.", k, i, round, data ? "overwritten" : "not made");
+                    lake_thfree(tag);
+                    return TEST_RESULT_FAILED;
+                }
+            }
+        }
+        lake_thfree(tag);
+    }
+    return TEST_RESULT_OKAY;
+}
+
+FN_TAGGED_HEAP_TEST_CASE(tag_table)
+{
+    /* tags that differ only in their high bits, freed and inserted again in between */
+    u32 const count = g_tagged_heap_count;
+    u32 **data = lake_drift_n(u32 *, count);
+
+    for (u32 round = 0; round < 4; round++) {
+        for (u32 i = 0; i < count; i++) {
+            if (round > 0 && (i + round + 1) % 2) continue;
+            data[i] = lake_thalloc_t((i + 1) << 20, u32);
+            if (data[i] == nullptr) {
+                test_log_context();
+                test_log("Can't allocate from tag %X in round %u.", (i + 1) << 20, round);
+                return TEST_RESULT_FAILED;
+            }
+            *data[i] = i;
+        }
+        for (u32 i = 0; i < count; i++) {
+            if (*data[i] != i) {
+                test_log_context();
+                test_log("Allocation under tag %X was overwritten in round %u.", (i + 1) << 20, round);
+                return TEST_RESULT_FAILED;
+            }
+        }
+        for (u32 i = 0; i < count; i++)
+            if ((i + round) % 2 == 0) lake_thfree((i + 1) << 20);
+    }
+    for (u32 i = 0; i < count; i++)
+        lake_thfree((i + 1) << 20);
+    return TEST_RESULT_OKAY;
+}
+
+FN_TAGGED_HEAP_TEST_CASE(block_ranges)
+{
+    /* ranges of blocks are found between the holes left by freed heaps */
+    usize const blocks[] = { 3, 1, 5, 2, 7, 1, 4, 6 };
+    u32 const count = lake_min(lake_arraysize(blocks), g_tagged_heap_count);
+    lake_thblock_range ranges[lake_arraysize(blocks)];
+
+    for (u32 round = 0; round < 3; round++) {
+        for (u32 i = 0; i < count; i++) {
+            if (round > 0 && (i + round) % 3) continue;
+            ranges[i] = lake_thblock(0xb10c0 + i, blocks[i] * LAKE_TAGGED_HEAP_BLOCK_SIZE);
+            if (ranges[i].memory == nullptr) {
+                test_log_context();
+                test_log("Can't acquire %lu blocks in round %u.", blocks[i], round);
+                return TEST_RESULT_FAILED;
+            }
+            lake_memset(ranges[i].memory, (s32)i, ranges[i].alloc);
+        }
+        for (u32 i = 0; i < count; i++) {
+            u8 const *memory = (u8 const *)ranges[i].memory;
+            if (memory[0] != i || memory[ranges[i].alloc - 1] != i) {
+                test_log_context();
+                test_log("A range of %lu blocks was overwritten in round %u.", blocks[i], round);
+                return TEST_RESULT_FAILED;
+            }
+        }
+        for (u32 i = 0; i < count; i++)
+            if ((i + round + 1) % 3 == 0) lake_thfree(0xb10c0 + i);
+    }
+    for (u32 i = 0; i < count; i++)
+        lake_thfree(0xb10c0 + i);
+    return TEST_RESULT_OKAY;
+}
+
+FN_TAGGED_HEAP_TEST_CASE(interior_decommit)
+{
+    /* a heap in use keeps its memory, while free blocks below it are decommitted */
+    lake_thblock_range freed = {0}, kept = {0};
+    usize released = 0;
+
+    /* a worker running other tests may refill it's block cache with some of the freed blocks 
+     * before we decommit them, then the heaps are made again */
+    for (u32 attempt = 0; attempt < 8; attempt++) {
+        if (attempt > 0) lake_thfree(0xdec1);
+        freed = lake_thblock(0xdec0, 4 * LAKE_TAGGED_HEAP_BLOCK_SIZE);
+        kept = lake_thblock(0xdec1, 2 * LAKE_TAGGED_HEAP_BLOCK_SIZE);
+        if (freed.memory == nullptr || kept.memory == nullptr) {
+            test_log_context();
+            test_log("Can't acquire the blocks.");
+            lake_thfree(0xdec0);
+            lake_thfree(0xdec1);
+            return TEST_RESULT_FAILED;
+        }
+        lake_memset(freed.memory, 0xa, freed.alloc);
+        lake_memset(kept.memory, 0xb, kept.alloc);
+        lake_thfree(0xdec0);
+        released = lake_thadvise(512lu * 1024 * 1024, lake_thadvise_release | lake_thadvise_suboptimal);
+        if (released >= freed.alloc) break;
+    }
+    if (released < freed.alloc) {
+        test_log_context();
+        test_log("Only %lu bytes were decommitted.", released);
+        lake_thfree(0xdec1);
+        return TEST_RESULT_FAILED;
+    }
+    /* decommitted blocks are committed again when they're taken */
+    s32 result = TEST_RESULT_OKAY;
+    for (u32 i = 0; i < 4 && result == TEST_RESULT_OKAY; i++) {
+        lake_thblock_range range = lake_thblock(0xdec2 + i, (i + 1) * LAKE_TAGGED_HEAP_BLOCK_SIZE);
+        if (range.memory == nullptr) {
+            result = TEST_RESULT_FAILED;
+            break;
+        }
+        lake_memset(range.memory, (s32)i, range.alloc);
+        u8 const *memory = (u8 const *)range.memory;
+        if (memory[0] != i || memory[range.alloc - 1] != i) result = TEST_RESULT_FAILED;
+    }
+    u8 const *memory = (u8 const *)kept.memory;
+    if (memory[0] != 0xb || memory[kept.alloc - 1] != 0xb) {
+        test_log_context();
+        test_log("A heap in use lost its memory.");
+        result = TEST_RESULT_FAILED;
+    }
+    for (u32 i = 0; i < 4; i++)
+        lake_thfree(0xdec2 + i);
+    lake_thfree(0xdec1);
+    return result;
+}
+
+FN_TAGGED_HEAP_TEST_CASE(page_policy)
+{
+    /* what backs the memory depends on the host, but blocks must be able to use huge pages */
+    lake_thpage_report const pages = lake_thpages();
+    lake_thblock_range range = lake_thblock(0x9a9e, LAKE_TAGGED_HEAP_BLOCK_SIZE);
+    bool const aligned = ((uptr)range.memory & (LAKE_TAGGED_HEAP_BLOCK_SIZE - 1)) == 0;
+    lake_thfree(0x9a9e);
+
+    if (range.memory == nullptr || !aligned || !lake_is_pow2(pages.huge_page_size) 
+            || pages.fiber_stacks != lake_page_policy_standard 
+            || pages.roots == lake_page_policy_hugetlb) 
+    {
+        test_log_context();
+        test_log("A block at %p, huge pages of %lu bytes, policies %u/%u/%u.", range.memory, 
+                pages.huge_page_size, pages.roots, pages.fiber_stacks, pages.blocks);
+        return TEST_RESULT_FAILED;
+    }
+    return TEST_RESULT_OKAY;
+}
+
+/** Slabs are carved at an alignment of their size, see `SLAB_SIZE` in the internal header. */
+static uptr const g_slab_size = 64lu * 1024;
+
+/** Every index allocates objects of a few sizes, frees some of them and checks the rest. */
+static FN_LAKE_PARALLEL_FOR(thslab_churn_range, atomic_u32 *failures)
+{
+    for (usize i = begin; i < end; i++) {
+        usize const size = 1 + (i * 37) % LAKE_THSLAB_MAX_SIZE;
+        u8 *objects[8];
+        for (u32 j = 0; j < lake_arraysize(objects); j++) {
+            objects[j] = (u8 *)lake_thslab_alloc(0x51ab, size);
+            if (objects[j]) lake_memset(objects[j], (s32)(i + j), size);
+        }
+        for (u32 j = 0; j < lake_arraysize(objects); j += 2)
+            lake_thslab_free(0x51ab, objects[j], size);
+        for (u32 j = 1; j < lake_arraysize(objects); j += 2) {
+            if (objects[j] == nullptr || objects[j][0] != (u8)(i + j) || objects[j][size - 1] != (u8)(i + j))
+                lake_atomic_add(failures, 1u);
+            lake_thslab_free(0x51ab, objects[j], size);
+        }
+    }
+}
+
+FN_TAGGED_HEAP_TEST_CASE(slabs)
+{
+    /* a freed object is reused by the next allocation of it's size class */
+    void *first = lake_thslab_alloc(0x51ab, 24);
+    void *second = lake_thslab_alloc(0x51ab, 32);
+    lake_thslab_free(0x51ab, first, 24);
+    void *reused = lake_thslab_alloc(0x51ab, 20);
+    if (first == nullptr || second == nullptr || reused != first || ((uptr)second & 15)) {
+        test_log_context();
+        test_log("Objects at %p and %p, the first one was reused at %p.", first, second, reused);
+        lake_thfree(0x51ab);
+        return TEST_RESULT_FAILED;
+    }
+    atomic_u32 failures;
+    lake_atomic_init(&failures, 0u);
+    lake_parallel_for(4096, 64, (PFN_lake_parallel_for)thslab_churn_range, &failures, "tests/thslab_churn");
+    /* objects freed right before the heap, they must not come back after it */
+    void *stale[2] = { lake_thslab_alloc(0x51ab, 24), lake_thslab_alloc(0x51ab, 24) };
+    lake_thslab_free(0x51ab, stale[0], 24);
+    lake_thslab_free(0x51ab, stale[1], 24);
+    lake_thfree(0x51ab);
+
+    if (lake_atomic_read(&failures) != 0) {
+        test_log_context();
+        test_log("%u objects were overwritten while in use.", lake_atomic_read(&failures));
+        return TEST_RESULT_FAILED;
+    }
+    /* the slabs are gone with the heap, the tag starts over with a new slab carved in order */
+    u8 *fresh[2] = { lake_thslab_alloc(0x51ab, 24), lake_thslab_alloc(0x51ab, 24) };
+    lake_thfree(0x51ab);
+    if (fresh[0] == nullptr || fresh[1] != fresh[0] + 32 || ((uptr)fresh[0] & (g_slab_size - 1)) != 0) {
+        test_log_context();
+        test_log("Objects at %p and %p after the heap was freed, objects at %p and %p were freed before it.", 
+                (void *)fresh[0], (void *)fresh[1], stale[0], stale[1]);
+        return TEST_RESULT_FAILED;
+    }
+    return TEST_RESULT_OKAY;
+}
+
+static bool find_thstats(lake_heap_tag tag, lake_thstats *out)
+{
+    lake_thstats stats[32];
+    u32 const count = lake_thstats_snapshot(lake_arraysize(stats), stats);
+    for (u32 i = 0; i < lake_min(count, lake_arraysize(stats)); i++) {
+        if (stats[i].tag != tag) continue;
+        *out = stats[i];
+        return true;
+    }
+    return false;
+}
+
+FN_TAGGED_HEAP_TEST_CASE(stats)
+{
+    /* small allocations from a block of this worker thread, and a large one through the heap */
+    lake_heap_tag const tag = 0x57a75;
+    usize const large = 3 * LAKE_TAGGED_HEAP_BLOCK_SIZE / 2;
+    for (u32 i = 0; i < 64; i++)
+        (void)lake_thalloc(tag, 1000, 8);
+    (void)lake_thalloc(tag, large, 16);
+
+    lake_thstats stats = {0};
+    if (!find_thstats(tag, &stats) || stats.allocations != 65 || stats.blocks != 3
+            || stats.bytes_requested != 64 * 1000 + large
+            || stats.bytes_committed != 3 * LAKE_TAGGED_HEAP_BLOCK_SIZE)
+    {
+        test_log_context();
+        test_log("Heap %X has %lu allocations of %lu bytes, in %u blocks.", 
+                stats.tag, stats.allocations, stats.bytes_requested, stats.blocks);
+        lake_thfree(tag);
+        return TEST_RESULT_FAILED;
+    }
+    lake_thfree(tag);
+    if (find_thstats(tag, &stats)) {
+        test_log_context();
+        test_log("A freed heap is still in the snapshot.");
+        return TEST_RESULT_FAILED;
+    }
+
+    /* the high-water marks stay with the tag */
+    (void)lake_thalloc(tag, 1000, 8);
+    bool const found = find_thstats(tag, &stats);
+    lake_thfree(tag);
+    if (!found || stats.blocks != 1 || stats.blocks_high_water != 3 
+            || stats.bytes_requested_high_water != 64 * 1000 + large)
+    {
+        test_log_context();
+        test_log("Heap %X has %u blocks, at most %u.", stats.tag, stats.blocks, stats.blocks_high_water);
+        return TEST_RESULT_FAILED;
+    }
+    return TEST_RESULT_OKAY;
+}
+
+FN_TEST_CASE(JobSystem, adaptive_workers)
+{
+    atomic_u32 counter;
+    lake_atomic_init(&counter, 0u);
+
+    lake_work_adaptive_workers(true);
+    lake_work_details *work = lake_drift_n(lake_work_details, g_deque_capacity);
+    for (u32 i = 0; i < g_deque_capacity; i++)
+        work[i] = (lake_work_details){ .procedure = (PFN_lake_work)count_work, .argument = &counter, .name = "tests/count_work" };
+    lake_submit_work_and_yield(g_deque_capacity, work);
+    u32 const adapted = lake_work_active_workers();
+    lake_work_adaptive_workers(false);
+    u32 const restored = lake_work_active_workers();
+
+    if (lake_atomic_read(&counter) != g_deque_capacity || adapted == 0 
+            || adapted > g_worker_thread_count || restored != g_worker_thread_count) {
+        test_log_context();
+        test_log("Ran %u of %u jobs, %u active workers while adapting and %u after, of %u.", 
+                lake_atomic_read(&counter), g_deque_capacity, adapted, restored, g_worker_thread_count);
+        return TEST_RESULT_FAILED;
+    }
+    return TEST_RESULT_OKAY;
+}
+
+struct timer_test {
+    lake_fiber_semaphore    fired;
+    atomic_u64              fired_at;
+};
+
+static FN_LAKE_WORK(timer_fire, struct timer_test *test)
+{
+    lake_atomic_write(&test->fired_at, lake_rtc_counter());
+    lake_fiber_semaphore_release(&test->fired, 1);
+}
+
+FN_TEST_CASE(JobSystem, timer_delayed_work)
+{
+    struct timer_test state = { .fired = lake_fiber_semaphore_init(0) };
+    struct timer_test *test = &state;
+    u64 const delay_ns = LAKE_MS_TO_NS(5);
+
+    lake_work_details const work = { .procedure = (PFN_lake_work)timer_fire, .argument = test, .name = "tests/timer_fire" };
+    u64 const submitted_at = lake_rtc_counter();
+    lake_work_timer const timer = lake_submit_work_after(&work, delay_ns, 0);
+    lake_fiber_semaphore_acquire(&test->fired);
+
+    f64 const elapsed_ns = (f64)(lake_atomic_read(&test->fired_at) - submitted_at) * LAKE_NS_PER_SECOND / (f64)lake_rtc_frequency();
+    if (timer == 0 || elapsed_ns < (f64)delay_ns || lake_cancel_work_timer(timer)) {
+        test_log_context();
+        test_log("Work delayed by %lu ns ran after %.0f ns, the timer is %lx.", delay_ns, elapsed_ns, timer);
+        return TEST_RESULT_FAILED;
+    }
+    return TEST_RESULT_OKAY;
+}
+
+FN_TEST_CASE(JobSystem, timer_periodic_cancel)
+{
+    /* not on the stack, work submitted right before the cancel may run after we return */
+    static struct timer_test state = { .fired = lake_fiber_semaphore_init(0) };
+    struct timer_test *test = &state;
+
+    lake_work_details const work = { .procedure = (PFN_lake_work)timer_fire, .argument = test, .name = "tests/timer_fire" };
+    lake_work_timer const timer = lake_submit_work_after(&work, LAKE_MS_TO_NS(1), LAKE_MS_TO_NS(2));
+    for (u32 i = 0; i < 3; i++)
+        lake_fiber_semaphore_acquire(&test->fired);
+
+    bool const cancelled = lake_cancel_work_timer(timer);
+    bool const cancelled_twice = lake_cancel_work_timer(timer);
+
+    if (!cancelled || cancelled_twice) {
+        test_log_context();
+        test_log("Cancelling a periodic timer returned %u, and %u when cancelled again.", cancelled, cancelled_twice);
+        return TEST_RESULT_FAILED;
+    }
+    return TEST_RESULT_OKAY;
+}
+
+static FN_LAKE_WORK(accounted_child, void *unused)
+{
+    (void)unused;
+    volatile u64 sum = 0;
+    for (u32 i = 0; i < 100000; i++) sum += i;
+}
+
+static FN_LAKE_WORK(accounted_parent, void *unused)
+{
+    (void)unused;
+    lake_work_details const child = { .procedure = (PFN_lake_work)accounted_child, .name = "tests/accounted_child" };
+    lake_submit_work_and_yield(1, &child);
+}
+
+FN_TEST_CASE(JobSystem, work_accounting)
+{
+    lake_work_details work[8];
+    for (u32 i = 0; i < lake_arraysize(work); i++)
+        work[i] = (lake_work_details){ .procedure = (PFN_lake_work)accounted_parent, .name = "tests/accounted_parent" };
+
+    lake_work_accounting(true);
+    lake_submit_work_and_yield(lake_arraysize(work), work);
+    lake_work_accounting(false);
+
+    lake_work_account accounts[64];
+    u32 const count = lake_work_accounting_collect(lake_arraysize(accounts), accounts);
+    lake_work_account const *parent = nullptr, *child = nullptr;
+    for (u32 i = 0; i < lake_min(count, lake_arraysize(accounts)); i++) {
+        if (!lake_strncmp(accounts[i].name, "tests/accounted_parent", LAKE_WORK_ACCOUNT_NAME_SIZE)) parent = &accounts[i];
+        if (!lake_strncmp(accounts[i].name, "tests/accounted_child", LAKE_WORK_ACCOUNT_NAME_SIZE)) child = &accounts[i];
+    }
+    /* the parents wait for their children, and the time adds up - give or take the rounding */
+    s64 const unaccounted = parent ? (s64)parent->wall_ns - (s64)(parent->cpu_ns + parent->wait_ns) : 0;
+    if (!parent || !child || parent->count != 8 || child->count != 8 || child->cpu_ns == 0
+            || parent->wait_ns == 0 || unaccounted > 1000 || unaccounted < -1000) {
+        test_log_context();
+        test_log("Accounted %u job names, parent %lu jobs (wall %lu, cpu %lu, wait %lu ns), child %lu jobs.", count,
+                parent ? parent->count : 0, parent ? parent->wall_ns : 0, parent ? parent->cpu_ns : 0, 
+                parent ? parent->wait_ns : 0, child ? child->count : 0);
+        return TEST_RESULT_FAILED;
+    }
+    return TEST_RESULT_OKAY;
+}
+
+static struct test_case_details g_tests[] = {
+    IMPL_TEST_CASE(JobSystem, parallel_for_empty_range),
+    IMPL_TEST_CASE(JobSystem, parallel_for_default_grain),
+    IMPL_TEST_CASE(JobSystem, parallel_for_grain_size),
+    IMPL_TEST_CASE(JobSystem, parallel_for_grain_larger_than_range),
+    IMPL_TEST_CASE(JobSystem, chain_reuse),
+    IMPL_TEST_CASE(JobSystem, fiber_mutex_contended),
+    IMPL_TEST_CASE(JobSystem, fiber_semaphore_release),
+    IMPL_TEST_CASE(JobSystem, fiber_condvar_broadcast),
+    IMPL_TEST_CASE(JobSystem, submit_past_deque_capacity),
+    IMPL_TEST_CASE(JobSystem, submit_past_deque_capacity_large_stack),
+    IMPL_TEST_CASE(JobSystem, work_batch),
+    IMPL_TEST_CASE(JobSystem, submit_foreign_work),
+    IMPL_TEST_CASE(JobSystem, zero_refcnt_batch),
+    IMPL_TEST_CASE(JobSystem, tagged_heap_worker_caches),
+    IMPL_TEST_CASE(JobSystem, tagged_heap_tag_table),
+    IMPL_TEST_CASE(JobSystem, tagged_heap_block_ranges),
+    IMPL_TEST_CASE(JobSystem, tagged_heap_stats),
+    IMPL_TEST_CASE(JobSystem, tagged_heap_interior_decommit),
+    IMPL_TEST_CASE(JobSystem, tagged_heap_page_policy),
+    IMPL_TEST_CASE(JobSystem, tagged_heap_slabs),
+    IMPL_TEST_CASE(JobSystem, adaptive_workers),
+    IMPL_TEST_CASE(JobSystem, timer_delayed_work),
+    IMPL_TEST_CASE(JobSystem, timer_periodic_cancel),
+    IMPL_TEST_CASE(JobSystem, work_accounting),
+};
+
+FN_TEST_SUITE(JobSystem)
+{
+    *out = (struct test_suite_details){
+        .count = lake_arraysize(g_tests),
+        .tests = g_tests,
+    };
+    g_deque_capacity = 1u << framework->hints.log2_work_count;
+    g_worker_thread_count = framework->hints.worker_thread_count;
+    g_tagged_heap_count = framework->hints.tagged_heap_count;
+}
@@ -39,6 +39,7 @@ struct main_test_suite {
     }
 static struct main_test_suite g_test_suites[] = {
     IMPL_MAIN_TEST_SUITE(Defer),
+    IMPL_MAIN_TEST_SUITE(JobSystem),
 };
 char const *g_run_target = nullptr;
 
@@ -111,6 +112,8 @@ static s32 run_test_suite(
         work[i].procedure   = (PFN_lake_work)run_test;
         work[i].argument    = &runs[i];
         work[i].name        = construct_fiber_name(suite->name, runs[i].details.name);
+        work[i].priority    = lake_work_priority_normal;
+        work[i].stack       = lake_fiber_stack_default;
     }
     lake_submit_work_and_yield(test_count, work);
     u32 const case_ok = lake_atomic_read(&suite->status_ok);
@@ -164,7 +167,7 @@ FN_LAKE_FRAMEWORK(testing)
     lake_log_enable_timestamps(false);
 
     lake_log(-6, "A total of #[cyan]%u#[normal] test suites will be executed, using the following context:", suite_count);
-    lake_log(-6, "    Worker threads: #[cyan]%u#[normal], running a #[cyan]%lu#[normal] capacity job queue.", framework->hints.worker_thread_count, 1lu << framework->hints.log2_work_count);
+    lake_log(-6, "    Worker threads: #[cyan]%u#[normal], each running a #[cyan]%lu#[normal] capacity job deque.", framework->hints.worker_thread_count, 1lu << framework->hints.log2_work_count);
     lake_log(-6, "    Fibers: #[cyan]%u#[normal], each with a #[cyan]%u KiB#[normal] stack.", framework->hints.fiber_count, framework->hints.fiber_stack_size >> 10);
     
     /* execute test suites one by one */
@@ -3,7 +3,7 @@
 /* bedrock */
 FN_TEST_SUITE(Defer);
 // FN_TEST_SUITE(Drifter);
-// FN_TEST_SUITE(JobSystem);
+FN_TEST_SUITE(JobSystem);
 // FN_TEST_SUITE(TaggedHeap);
 
 /* data structures */